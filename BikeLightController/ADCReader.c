@@ -1,17 +1,54 @@
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <avr/sleep.h>
 
 #include <stdint.h>
 #include <string.h>
 
+#include "Hal.h"
 #include "PointerTricks.h"
+#include "Benchmark.h"
+#include "ISRProfiler.h"
+#include "EnergyMonitor.h"
+#include "Clock.h"
+#include "TimerServices.h"
 #include "ADCReader.h"
+#include "Units.h"
 
 #define NCHANNELS 2
 
 #define BITBOOST 4
 #define AVGLENGTH (1<<BITBOOST)
 
+#define ADCCONVCYCLES (UNITS_ADCCONVCYCLES >> clockShift()) // Free running conversion period
+
+#if (AVGLENGTH >> 3) != UNITS_ACCPERCOUNT
+	#error "The accumulate no longer matches UNITS_ACCPERCOUNT"
+#endif
+
+#if ADC_ADAPTIVE
+#if LAMPDIM_BACKEND != LAMPDIM_RHEOSTAT || ISRPROF_ENABLE
+	#error "ADC_ADAPTIVE paces the slow conversions with Timer-0, which the PWM dimmer or the ISR profiler has"
+#endif
+#if ADC_SLOWSHIFT < 3 || ADC_SLOWSHIFT > 7
+	#error "ADC_SLOWSHIFT must give a whole number of Timer-0 counts that fits in eight bits (3 to 7)"
+#endif
+	#define SLOWTOP ((13 << ADC_SLOWSHIFT) / 8 - 1) // Timer-0 at F_CPU / 1024 counts eight ADC clocks
+	#define ADTSMASK ((1<<ADTS2) | (1<<ADTS1) | (1<<ADTS0))
+	#define ADTSTIMER0A ((1<<ADTS1) | (1<<ADTS0)) // Timer-0 compare match A
+	#define WAKEDEV (ADC_WAKEDEV << BITBOOST) // In units of the channel sums
+#endif
+
+#if ADC_HIRES
+#if ADC_HIRESBITS < 11 || ADC_HIRESBITS > 13
+	#error "ADC_HIRESBITS must be 11 to 13"
+#endif
+	#define HIRESSHIFT (ADC_HIRESBITS - 10)
+	#define HIRESCONVERSIONS (NCHANNELS << (2 * HIRESSHIFT)) // Four times the samples for each extra bit
+#endif
+
+#define MUXTRACK (ADC_ADAPTIVE || ADC_HIRES) // Conversions aren't all free running so the channel each latched is followed
+
 static struct {
 	struct ChannelData {
 		uint_fast16_t store[AVGLENGTH];
@@ -21,8 +58,34 @@ static struct {
 		volatile uint_fast16_t bias;
 	} chan[NCHANNELS];
 	volatile uint_fast8_t adcPendingResults;
+#if MUXTRACK
+	uint_fast8_t inFlight; // The next conversion had already started when the last interrupt returned
+	uint_fast8_t inFlightMux; // And the ADMUX it latched
+#endif
+#if ADC_ADAPTIVE
+	uint_fast8_t slow; // Conversions wait on Timer-0
+	uint_fast8_t sampleShift; // Free running conversions the next result stands for, as a power of two
+	uint_fast8_t stable; // Consecutive results close to their channel's average
+	volatile uint_fast8_t wake;
+#endif
+#if ADC_HIRES
+	volatile uint_fast8_t hiRes; // A window is open, conversions are started by adcHiResWindow()
+	volatile uint_fast8_t hiResLeft; // Conversions still to sum
+	volatile uint_fast16_t hiResSum[NCHANNELS];
+	uint_fast8_t hiResWindows; // Main line only
+#endif
 } adcState;
 
+#if ADC_ADAPTIVE
+static inline void adcPace(uint_fast8_t mux, uint_fast8_t sampleMux, uint_fast16_t dev);
+#endif
+#if MUXTRACK
+static void adcFreeRun(uint_fast8_t nextMux);
+#endif
+#if ADC_HIRES
+static uint_fast16_t hiResReading(uint_fast8_t cChan);
+#endif
+
 void initADC()
 {
 	memset(&adcState, 0, sizeof(adcState));
@@ -32,10 +95,22 @@ void startADC()
 {
 	PRR &= ~(1<<PRADC); // Power on the ADC
 	ADCSRA &= ~(1<<ADEN); // Disable the ADC
+#if ADC_ADAPTIVE
+		PRR &= ~(1<<PRTIM0); // Power on Timer-0, left stopped until it's needed
+		TCCR0B = 0;
+		TCCR0A = (1<<WGM01); // CTC
+		OCR0A = SLOWTOP;
+		ADCSRB &= ~ADTSMASK; // Free running
+		adcState.slow = adcState.sampleShift = adcState.stable = 0;
+#endif
+#if MUXTRACK
+		adcState.inFlight = 0;
+#endif
 		ADMUX = (1<<REFS1) | (1<<REFS0) | (1<<MUX1) | (1<<MUX0); // Start off by sampling the "voltage source" line with the 1.1V source as the reference
-		ADCSRA = (1<<ADATE) | (1<<ADIF) | (1<<ADIE) | (1<<ADPS2) | (1<<ADPS1) | (1<<ADPS0); // Set the clock rate to clk/16 or 62.5KHz at 1MHz, auto triggering, enabling interrupts while clearing any standing interrupts
+		FLAG_WRITE(ADCSRA, (1<<ADATE) | (1<<ADIF) | (1<<ADIE) | clockADCSelect(), (1<<ADIF)); // Set the clock rate to F_CPU / 128 or 62.5KHz at 8MHz, auto triggering, enabling interrupts while clearing any standing interrupts
 	ADCSRA |= (1<<ADEN); // Enable ADC
 	ADCSRA |= (1<<ADSC); // Start converting
+	ISRPROF_RESYNC(ISRPROF_ADC);
 }
 
 void stopADC()
@@ -45,7 +120,11 @@ void stopADC()
 	cli();
 		ADCSRA &= ~(1<<ADEN) & ~(1<<ADIE); // Disable the ADC
 		PRR |= (1<<PRADC); // Power off the ADC
-		ADCSRA |= (1<<ADIF); // Ensure no ADC interrupts are pending
+		FLAG_CLEAR(ADCSRA, (1<<ADIF)); // Ensure no ADC interrupts are pending
+#if ADC_ADAPTIVE
+		TCCR0B = 0;
+		PRR |= (1<<PRTIM0); // Power off Timer-0
+#endif
 	SREG = statReg;
 }
 
@@ -56,23 +135,43 @@ uint_fast8_t testIntADC()
 
 ISR(ADC_vect)
 {
-//PIND = (1<<PD5); // Toggle reset line
+	BENCH_BEGIN(BENCH_ADCISR);
+	ISRPROF_ENTERPERIODIC(ISRPROF_ADC, ADCCONVCYCLES);
+	ENERGY_ENTER(ENERGY_ISRADC);
 	uint_fast16_t adcVal = ADC;
+	uint_fast8_t shift = 0; // The result stands for 1 << shift free running conversions
 
+#if MUXTRACK
+	uint_fast8_t mux = ADMUX;
+	uint_fast8_t sampleMux = adcState.inFlight ? adcState.inFlightMux : mux; // Single conversions latch ADMUX after the last interrupt
+	uint_fast8_t cChan = !(sampleMux & (1<<MUX2)); // ADC7 (current) is channel 0
+#else
 	uint_fast8_t cChan = ((ADMUX & (1<<MUX2))>>MUX2);
+#endif
+
+	FLAG_WRITE(ADCSRA, ADCSRA & ~(1<<ADIE) & ~(1<<ADIF), (1<<ADIF)); // The next result is a conversion away, let anything else in meanwhile
+	sei();
+	ISRPROF_UNMASK(ISRPROF_ADC);
 
 	struct ChannelData *chan = adcState.chan + cChan;
 	FIX_POINTER(chan);
 
+#if ADC_ADAPTIVE
+	shift = adcState.sampleShift;
+
+	uint_fast16_t boosted = adcVal << BITBOOST;
+	uint_fast16_t dev = boosted > chan->avgVal ? boosted - chan->avgVal : chan->avgVal - boosted;
+#endif
+
 	chan->avgVal -= chan->store[chan->avgIdx & (AVGLENGTH-1)];
 	chan->store[chan->avgIdx & (AVGLENGTH-1)] = adcVal;
 	chan->avgVal += adcVal;
 
 	// Remove the channel bias before accumulating
 	if(chan->bias <= chan->avgVal) { // Therefore (chan->avgVal - chan->bias) is +ve or zero
-		chan->accVal += (chan->avgVal - chan->bias + 4) >> 3; // Do the accumulate. Sadly we have to truncate the precision otherwise we can't track enough current over the whole discharge period
+		chan->accVal += (((uint_fast32_t)(chan->avgVal - chan->bias) << shift) + 4) >> 3; // Do the accumulate. Sadly we have to truncate the precision otherwise we can't track enough current over the whole discharge period
 	} else { // (chan->bias > chan->avgVal) Therefore (chan->avgVal - chan->bias) is -ve so (chan->bias - chan->avgVal) is positive and of the same magnitude
-		uint_fast16_t subVal = (chan->bias - chan->avgVal + 4) >> 3;
+		uint_fast32_t subVal = (((uint_fast32_t)(chan->bias - chan->avgVal) << shift) + 4) >> 3;
 		if(subVal <= chan->accVal) {
 			chan->accVal -= subVal;
 		} else {
@@ -81,32 +180,210 @@ ISR(ADC_vect)
 	}
 	chan->avgIdx++;
 
+#if ADC_HIRES
+	adcState.adcPendingResults += !adcState.hiResLeft; // Not for each of a window's results, the averages carry them to the checks after it
+#else
 	adcState.adcPendingResults++;
+#endif
 
+#if ADC_HIRES
+	if(adcState.hiRes) { // One conversion at a time, each started by adcHiResWindow() going to sleep
+		if(adcState.hiResLeft) { // Not the one that was under way as the window opened
+			adcState.hiResSum[cChan] += adcVal;
+			adcState.hiResLeft--;
+		}
+#if ADC_ADAPTIVE
+		else if(adcState.slow) { // The paced conversion the window was waiting on
+			TCCR0B = 0;
+			ADCSRB &= ~ADTSMASK;
+			FLAG_WRITE(ADCSRA, ADCSRA & ~(1<<ADATE) & ~(1<<ADIF), (1<<ADIF));
+			adcState.slow = 0;
+		}
+#endif
+		adcState.inFlight = 0;
+#if ADC_ADAPTIVE
+		adcState.sampleShift = 0;
+#endif
+		ADMUX = sampleMux ^ (1<<MUX2); // Switch channels
+	} else {
+#if ADC_ADAPTIVE
+		adcPace(mux, sampleMux, dev);
+#else
+		adcState.inFlight = 1; // Free running
+		adcState.inFlightMux = mux;
+		ADMUX = mux ^ (1<<MUX2); // Switch channels for the one after it
+#endif
+	}
+#elif ADC_ADAPTIVE
+	adcPace(mux, sampleMux, dev);
+#else
 	ADMUX ^= (1<<MUX2); // Switch channels
-//PIND = (1<<PD5); // Toggle reset line
+#endif
+	cli();
+	FLAG_WRITE(ADCSRA, (ADCSRA & ~(1<<ADIF)) | (1<<ADIE), (1<<ADIF)); // Anything that came in meanwhile is taken straight after the reti
+	ENERGY_EXIT();
+	ISRPROF_EXIT(ISRPROF_ADC);
+	BENCH_END(BENCH_ADCISR);
 }
 
-uint_fast8_t isADCUpdated(uint_fast8_t nSamples)
+#if ADC_ADAPTIVE
+static inline void adcPace(uint_fast8_t mux, uint_fast8_t sampleMux, uint_fast16_t dev)
+{
+	uint_fast8_t goSlow = adcState.slow;
+
+	if(dev > WAKEDEV || adcState.wake) { // Something's changing
+		adcState.wake = 0;
+		adcState.stable = 0;
+		goSlow = 0;
+	} else if(adcState.stable < ADC_SETTLESAMPLES) {
+		goSlow = ++adcState.stable == ADC_SETTLESAMPLES;
+	}
+
+	if(!adcState.slow) { // Free running, the next conversion has already latched ADMUX
+		adcState.inFlight = 1;
+		adcState.inFlightMux = mux;
+		adcState.sampleShift = 0;
+		ADMUX = mux ^ (1<<MUX2); // Switch channels for the one after it
+		if(goSlow) { // Which now waits a slow period for Timer-0
+			TCNT0 = 0;
+			FLAG_CLEAR(TIFR0, (1<<OCF0A));
+			TCCR0B = clockTimer0Select();
+			ADCSRB = (ADCSRB & ~ADTSMASK) | ADTSTIMER0A;
+			adcState.slow = 1;
+		}
+	} else if(goSlow) { // Nothing converting until Timer-0 next matches
+		ADMUX = sampleMux ^ (1<<MUX2); // Already set if this is the first slow result
+		FLAG_CLEAR(TIFR0, (1<<OCF0A)); // Re-arm the trigger
+		adcState.inFlight = 0;
+		adcState.sampleShift = ADC_SLOWSHIFT;
+	} else { // Start the next one now and carry on free running from it
+		adcFreeRun(sampleMux ^ (1<<MUX2));
+	}
+}
+#endif
+
+#if MUXTRACK
+static void adcFreeRun(uint_fast8_t nextMux) // With interrupts off and nothing converting
+{
+	ADMUX = nextMux;
+#if ADC_ADAPTIVE
+	TCCR0B = 0;
+	ADCSRB &= ~ADTSMASK;
+	adcState.sampleShift = 0;
+	adcState.slow = 0;
+#endif
+	FLAG_WRITE(ADCSRA, (ADCSRA & ~(1<<ADIF)) | (1<<ADATE) | (1<<ADSC), (1<<ADIF)); // The one after it repeats this channel, inFlightMux keeps the results straight
+	adcState.inFlight = 1;
+	adcState.inFlightMux = nextMux;
+}
+#endif
+
+#if ADC_HIRES
+void adcHiResWindow()
 {
 	uint_fast8_t statReg = SREG;
-	uint_fast8_t rVal;
 
 	cli();
-		rVal = adcState.adcPendingResults;
+		adcState.hiRes = 1;
+#if ADC_ADAPTIVE
+		if(adcState.slow) { // Wait for the conversion Timer-0 is pacing, the interrupt stops the trigger once it's in
+			adcState.stable--; // So that the next steady result goes straight back to the slow rate
+		} else
+#endif
+		FLAG_WRITE(ADCSRA, ADCSRA & ~(1<<ADATE) & ~(1<<ADIF), (1<<ADIF)); // Nothing follows whatever is converting now
 	SREG = statReg;
 
-	rVal = rVal >= (nSamples<<1);
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	cli();
+	while(ADCSRA & ((1<<ADATE) | (1<<ADSC) | (1<<ADIF))) { // Let that finish and be taken by the interrupt, so the results before the window each stand for the time they should
+		sleep_enable();
+		ENERGY_SLEEP();
+		sei();
+		sleep_cpu();
+		sleep_disable();
+		ENERGY_WAKE();
+		cli();
+	}
 
-	if(rVal) {
+		adcState.hiResSum[0] = adcState.hiResSum[1] = 0;
+		adcState.hiResLeft = HIRESCONVERSIONS;
+
+	while(adcState.hiResLeft) {
+		set_sleep_mode((ADCSRA & (1<<ADIF)) ? SLEEP_MODE_IDLE : SLEEP_MODE_ADC); // Going into noise reduction starts the next conversion (or waits on the one under way), not with a result still to be taken
+		sleep_enable();
+		ENERGY_SLEEP();
+		sei();
+		sleep_cpu();
+		sleep_disable();
+		ENERGY_WAKE();
 		cli();
-			adcState.adcPendingResults -= (nSamples<<1);
-		SREG = statReg;
 	}
+	SREG = statReg;
+
+	ENERGY_STATE(ENERGY_ADCNR); // The counts put back are the window's
+	timerSkip((uint_fast32_t)HIRESCONVERSIONS * (13 * 128)); // Timer-1 stood still through each conversion
+	ENERGY_STATE(ENERGY_RUN);
+
+	cli();
+		adcState.hiRes = 0;
+		adcFreeRun(ADMUX); // Already switched to the next channel
+	SREG = statReg;
+	adcState.hiResWindows++;
+}
+
+uint_fast8_t adcHiResWindows()
+{
+	return adcState.hiResWindows;
+}
+
+uint_fast16_t getADCHiResCurrentReading()
+{
+	return hiResReading(0);
+}
+
+uint_fast16_t getADCHiResVoltageReading()
+{
+	return hiResReading(1);
+}
+
+static uint_fast16_t hiResReading(uint_fast8_t cChan)
+{
+	uint_fast8_t statReg = SREG;
+	uint_fast16_t rVal, bias;
+
+	cli();
+		bias = adcState.chan[cChan].bias;
+	SREG = statReg;
+
+	rVal = (adcState.hiResSum[cChan] + (1<<(HIRESSHIFT-1))) >> HIRESSHIFT; // Decimated, the last window is only ever read from the main line
+	bias = (bias + (1<<(BITBOOST-HIRESSHIFT-1))) >> (BITBOOST-HIRESSHIFT); // From sixteenths of a count
+
+	return bias < rVal ? rVal - bias : 0;
+}
+#endif
+
+uint_fast8_t isADCUpdated(uint_fast8_t nSamples)
+{
+	uint_fast8_t statReg = SREG;
+	uint_fast8_t rVal;
+
+	cli();
+		rVal = adcState.adcPendingResults >= (nSamples<<1);
+		if(rVal) {
+			adcState.adcPendingResults -= (nSamples<<1);
+		}
+	SREG = statReg;
 
 	return rVal;
 }
 
+void adcFullRate()
+{
+#if ADC_ADAPTIVE
+	adcState.wake = 1; // Seen by the next result, at most a slow period away
+#endif
+}
+
 void adcUpdateVoltageBias()
 {
 	uint_fast8_t statReg = SREG;
@@ -129,6 +406,15 @@ void adcUpdateCurrentBias()
 	SREG = statReg;
 }
 
+void adcSeedAccumulatedCurrent(uint_fast32_t acc)
+{
+	uint_fast8_t statReg = SREG;
+
+	cli();
+		adcState.chan[0].accVal = acc;
+	SREG = statReg;
+}
+
 uint_fast16_t getADCVoltageReading()
 {
 	uint_fast8_t statReg = SREG;
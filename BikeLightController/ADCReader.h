@@ -1,6 +1,46 @@
 #ifndef ADCREADER_H_
 #define ADCREADER_H_
 
+	// With ADC_ADAPTIVE the conversions drop from free running (one every 13 ADC clocks, 208uS) to one every
+	// 1 << ADC_SLOWSHIFT of those once both channels have read steady for ADC_SETTLESAMPLES conversions in a row. The slow
+	// conversions are triggered by a Timer-0 compare so it can only be had when neither the PWM dimmer nor the ISR
+	// profiler has the timer. A reading more than ADC_WAKEDEV counts from its channel's average, or an adcFullRate() call
+	// for a rheostat step or a button, puts it back to free running. Each slow result is accumulated as the number of
+	// free running ones it stands in for so getAccumulatedCurrent() keeps its units whatever the rate.
+
+	#include "LampControl.h"
+	#include "ISRProfiler.h"
+
+	#ifndef ADC_ADAPTIVE
+		#define ADC_ADAPTIVE 0
+	#endif
+
+	#ifndef ADC_SLOWSHIFT
+		#define ADC_SLOWSHIFT 5 // 32 conversions, 6.7mS
+	#endif
+
+	#ifndef ADC_SETTLESAMPLES
+		#define ADC_SETTLESAMPLES 240 // 50mS of steady readings
+	#endif
+
+	#ifndef ADC_WAKEDEV
+		#define ADC_WAKEDEV 4 // ADC counts
+	#endif
+
+	// With ADC_HIRES adcHiResWindow() takes 4^(ADC_HIRESBITS-10) conversions of each channel one at a time under
+	// SLEEP_MODE_ADC, with the CPU and the I/O clock stopped, and decimates them to ADC_HIRESBITS. The results pass through
+	// the averaging and accumulation as usual. The I/O clock stopping also stops Timer-1, so the time slept is added back
+	// with timerSkip(), and the USART, Timer-0 PWM and TWI, so the main loop only opens a window when the clock isn't held
+	// for any of them and the bus is idle. 12 bits is a 6.7mS window, 13 bits 27mS.
+
+	#ifndef ADC_HIRES
+		#define ADC_HIRES 0
+	#endif
+
+	#ifndef ADC_HIRESBITS
+		#define ADC_HIRESBITS 12
+	#endif
+
 	#define ADCMAXVALUE ((1<<10) - 1)
 
 	void initADC();
@@ -8,10 +48,18 @@
 	void stopADC();
 	uint_fast8_t testIntADC();
 	uint_fast8_t isADCUpdated(uint_fast8_t nSamples);
+	void adcFullRate(); // Something is about to change, back to free running from the next conversion
 	void adcUpdateVoltageBias();
 	void adcUpdateCurrentBias();
+	void adcSeedAccumulatedCurrent(uint_fast32_t acc); // After the bias update, charge already used from the pack
 	uint_fast16_t getADCCurrentReading();
 	uint_fast16_t getADCVoltageReading();
 	uint_fast32_t getAccumulatedCurrent();
+#if ADC_HIRES
+	void adcHiResWindow(); // Main line only, returns with the ADC back where it was
+	uint_fast16_t getADCHiResCurrentReading(); // Bias removed, in 1/(1 << (ADC_HIRESBITS-10)) of an ADC count
+	uint_fast16_t getADCHiResVoltageReading();
+	uint_fast8_t adcHiResWindows(); // Windows taken, wraps
+#endif
 
 #endif /* ADCREADER_H_ */
\ No newline at end of file
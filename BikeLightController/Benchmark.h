@@ -0,0 +1,42 @@
+#ifndef BENCHMARK_H_
+#define BENCHMARK_H_
+
+	// Section markers for cycle counting the image under an AVR simulator (simavr or the Atmel Studio simulator)
+	// Each marker is a single OUT to GPIOR0 (one cycle). Opening a section writes (id<<1) and closing it writes (id<<1)|1,
+	// the simulator watches for writes to GPIOR0 and attributes the cycles in between to that id. Sections with
+	// different ids may nest (getTime() inside a main loop wake) so the watcher keeps a start cycle per id.
+	// tools/SimBench.c is that watcher for simavr, with the board stubbed out around it and a baseline to compare against.
+
+	#ifndef BENCHMARK_ENABLE
+		#define BENCHMARK_ENABLE 0
+	#endif
+
+	#define BENCH_ADCISR 1 // Body of ISR(ADC_vect)
+	#define BENCH_TWIISR 2 // Body of ISR(TWI_vect)
+	#define BENCH_MAINWAKE 3 // One pass of the main loop after waking from sleep
+	#define BENCH_GETTIME 4 // getTime()
+	#define BENCH_LAMPRESET 5 // The lampPowerDown(LAMPRESYNCSTEPS) that puts the rheostat in a known state at boot
+	#define BENCH_BOOT 6 // Reset through to entering the main loop
+	#define BENCH_LAMPLEVEL 7 // A lamp level change, however many steps or lamps it takes the LampWiper.h backend
+	#define BENCH_GETTICKS 8 // getTicks(), against BENCH_GETTIME for the cost of the scaling to milliseconds
+
+	// A host build hands the same markers to hostBenchMark(), which times them against the model's clock. That only
+	// moves for what the model simulates (bus transactions, conversions, sleep), not for the instructions in between,
+	// so it's the I/O bound sections such as the lamp ones it's good for. RideReplay lists them when built with it.
+
+	#if BENCHMARK_ENABLE
+		#ifdef __AVR__
+			#define BENCH_BEGIN(_id) (GPIOR0 = (uint8_t)((_id)<<1))
+			#define BENCH_END(_id) (GPIOR0 = (uint8_t)(((_id)<<1) | 1))
+		#else
+			#include "HostPeripherals.h"
+
+			#define BENCH_BEGIN(_id) hostBenchMark((uint8_t)((_id)<<1))
+			#define BENCH_END(_id) hostBenchMark((uint8_t)(((_id)<<1) | 1))
+		#endif
+	#else
+		#define BENCH_BEGIN(_id)
+		#define BENCH_END(_id)
+	#endif
+
+#endif /* BENCHMARK_H_ */
\ No newline at end of file
@@ -5,6 +5,8 @@
 
 #include <stdint.h>
 
+#include "Hal.h"
+#include "Clock.h"
 #include "twi.h"
 #include "PinControl.h"
 #include "ADCReader.h"
@@ -12,36 +14,95 @@
 #include "LowPowerDetect.h"
 #include "TimerServices.h"
 #include "LampControl.h"
+#include "LampWiper.h"
+#include "PWMDimmer.h"
+#include "PatternSequencer.h"
 #include "BikeLightController.h"
+#include "Benchmark.h"
+#include "ISRProfiler.h"
+#include "EventTrace.h"
+#include "Telemetry.h"
+#include "HeadUnitLink.h"
+#include "FaultLog.h"
+#include "LampMemory.h"
+#include "StateOfCharge.h"
+#include "Supervisor.h"
+#include "StackMonitor.h"
+#include "Units.h"
+#include "EnergyMonitor.h"
+
+// Written in figures on Units.h's nominal board and pinned to the raw counts they've always been, so that a change to
+// the board figures can't move them. The capacity comes to 9.77mAh there, nothing like a lamp pack, which is why Units.h's
+// figures can't be taken as the board's until they've been read off the schematic.
+#define TRIPCAPACITY (UNITS_CHARGE(977) / 100) // getAccumulatedCurrent()
+#define TRIPCURRENT UNITS_CURRENT(2150)
+#define TRIPVOLTAGE UNITS_VOLTAGE(5990)
+
+_Static_assert(TRIPCURRENT == 20, "the current limit has moved");
+_Static_assert(TRIPVOLTAGE == 600, "the voltage limit has moved");
+_Static_assert(TRIPCAPACITY + UNITS_CHARGE(1) / 200 >= 1574074 && TRIPCAPACITY <= 1574074 + UNITS_CHARGE(1) / 200,
+	"the capacity limit has moved"); // By more than the figure's last place, there's no hundredth of a mAh on the count
+
+// Warning levels for the trace, an eighth of the capacity and a quarter of the current headroom left or within a sixteenth of the voltage limit
+#define WARNCAPACITY (TRIPCAPACITY - (TRIPCAPACITY>>3))
+#define WARNCURRENT (TRIPCURRENT - (TRIPCURRENT>>2))
+#define WARNVOLTAGE (TRIPVOLTAGE + (TRIPVOLTAGE>>4))
 
 static void goToSleep();
 static uint_fast8_t interruptsPending();
 static uint_fast8_t initAVR();
+#if ADC_HIRES
+static uint_fast8_t hiResWindowAllowed();
+#endif
+#if TRACE_ENABLE || TELEMETRY_ENABLE || TWI_SLAVE
+static uint_fast8_t adcWarnings(uint_fast32_t accCurrent, uint_fast16_t curCurrent, uint_fast16_t curVoltage);
+#endif
+#if TELEMETRY_ENABLE || TWI_SLAVE
+static void reportStatus();
+#endif
 
 int main(void)
 {
 	static uint_fast8_t resetSource;
+	static uint_fast8_t bootType;
 
-	resetSource = initAVR();
+	BENCH_BEGIN(BENCH_BOOT);
 
-	// if(resetSource & ((1<<WDRF) | (1<<BORF))) { // If either brown-out or watchdog caused a reset
-	if(resetSource & (1<<WDRF)) { // If watchdog caused a reset
-		for(;;); // Then it's probably best to stay shutdown
+	resetSource = initAVR();
+	initClock(); // Held at full speed until the main loop
+	bootType = supervisorBoot(resetSource);
+	initISRProfiler();
+	initEventTrace(resetSource);
+	initTelemetry();
+	initFaultLog();
+
+	if(bootType == SUPERVISOR_SHUTDOWN) { // If the watchdog reset followed a safety shutdown (or keeps catching hangs)
+		sei(); // Only the telemetry interrupt is set up, let it carry the fault log out
+		faultLogReport();
+		HALT(); // Then it's probably best to stay shutdown
 	}
 
-	wdt_enable(WDTO_500MS);
+	supervisorStart();
+	initLampMemory();
 
 	initTimers();
 	initADC();
 	initOverCurrentDetection();
 	initLowPowerDetection();
+#if LAMPDIM_BACKEND != LAMPDIM_RHEOSTAT
+	initPWMDimmer();
+#endif
+#if PATTERN_ENABLE
+	initPatterns();
+#endif
 
 	sei(); // Interrupts on as soon as possible
+	faultLogReport(); // Oldest first, before any status frames
 
 	// Calibrate the analogue channels for bias...
-	for(int tCnt = 0; tCnt < 20; tCnt++) { // Wait for a bit (about 2 seconds)
+	for(int tCnt = 0; tCnt < (bootType == SUPERVISOR_RESTART ? 1 : 20); tCnt++) { // Wait for a bit (about 2 seconds, the supply is already up after a hang)
 		wdt_reset();
-		noIntWait(781);
+		noIntWait(TIMER1TICKS(100));
 	}
 	startADC();
 		while(!isADCUpdated(64)) { // Wait for the ADC and power levels to settle
@@ -51,10 +112,15 @@ int main(void)
 
 	// We can't update the voltage bias because we get some leakage through the diode when the startup power is applied
 	adcUpdateCurrentBias();
+	socSeed(getADCVoltageReading(), TRIPCAPACITY); // The pack at rest, nothing drawn from it before fetOn()
 
 	// If the over current is already tripped then we're in trouble and can't detect the over current condition
 	if(overCurrentTripped() || testIntOverCurrent()) {
-		for(;;); // In which case trigger the watchdog
+		fetOff(); // Still off, but make sure
+		holdLampInReset();
+		TRACE_EVENT(TRACE_TRIP, TRACETRIP_OVERCURRENT);
+		faultLogRecord(TRACETRIP_OVERCURRENT);
+		HALT(); // In which case trigger the watchdog
 	}
 
 	noIntTimerStart(); // This starts a timer period (256mS) that's not governed by timer interrupts
@@ -64,7 +130,9 @@ int main(void)
 		if(overCurrentTripped() || testIntOverCurrent()) { // If the over current has tripped
 			fetOff(); // Power off
 			holdLampInReset();
-			for(;;); // Trigger watchdog
+			TRACE_EVENT(TRACE_TRIP, TRACETRIP_OVERCURRENT);
+			faultLogRecord(TRACETRIP_OVERCURRENT);
+			HALT(); // Trigger watchdog
 		} else { // If the over current hasn't tripped
 			startOverCurrentDetection(); // Then enable interrupt based over current detection
 		}
@@ -73,84 +141,181 @@ int main(void)
 
 	// We're now confident that main power has been applied is stable and is not over current
 	if(lowPowerTripped() || testIntLowPower()) { // If the low power signal has tripped
-		doShutdownProcess();
 		fetOff(); // Power off
-		for(;;); // Trigger watchdog
+		doShutdownProcess();
+		TRACE_EVENT(TRACE_TRIP, TRACETRIP_LOWPOWER);
+		faultLogRecord(TRACETRIP_LOWPOWER);
+		HALT(); // Trigger watchdog
 	} else {
 		startLowPowerDetection(); // Then enable interrupt based low power detection
 	}
 
 	startTimers();
 	startADC();
+#if LAMPDIM_BACKEND != LAMPDIM_RHEOSTAT
+	startPWMDimmer();
+#endif
 	twi_init();
+	initHeadUnitLink();
 	// Lamp reset...
 	fullInit23008();
-	lampPowerDown(96); // Make sure the lamp rheostat starts off in a known state (lowest power)
+	BENCH_BEGIN(BENCH_LAMPRESET);
+	if(bootType == SUPERVISOR_RESTART && supervisorRecord.lampValid) {
+		lampPowerDown(supervisorRecord.lampLevel + 2); // Where the count had got to, give or take a step caught in flight
+	} else { // Including a hang the interrupt didn't catch, the level was lost with it
+		lampPowerDown(LAMPRESYNCSTEPS); // Make sure the lamp rheostat starts off in a known state (lowest power), nothing to measure yet
+	}
+	BENCH_END(BENCH_LAMPRESET);
+#if LAMPDIM_BACKEND == LAMPDIM_RHEOSTAT
+	takeLampOutOfReset(); // The PWM backends drive the line themselves
+#endif
+	if(bootType == SUPERVISOR_RESTART) {
+		lampResume(supervisorRecord.lampLevel, supervisorRecord.lampOn); // Back as the rider left it
+	}
+	lampMemoryRecall(bootType != SUPERVISOR_RESTART); // Or as they last used it after a power cycle
 
 	uint_fast8_t sampleDelay = 32;
 	uint_fast32_t lastTick = getTickNumber();
-	uint_fast32_t lastTLast = getTime();
+#if TRACE_ENABLE
+	uint_fast8_t adcWarn = 0;
+#endif
+
+	BENCH_END(BENCH_BOOT);
+	clockRelease(CLOCKHOLD_BOOT);
+	initEnergyMonitor(); // From here on
 
 	for(;;) {
 		wdt_reset();
 		goToSleep();
-		// PIND = (1<<PD5); // Toggle reset line
+		BENCH_BEGIN(BENCH_MAINWAKE);
 		if(isADCUpdated(sampleDelay)) {
-			PIND = (1<<PD5); // Toggle reset line
 			uint_fast32_t accCurrent = getAccumulatedCurrent();
 			uint_fast16_t curCurrent = getADCCurrentReading();
 			uint_fast16_t curVoltage = getADCVoltageReading();
 
-			if(accCurrent > 1574074) {
-				doShutdownProcess();
+#if TRACE_ENABLE
+			uint_fast8_t warn = adcWarnings(accCurrent, curCurrent, curVoltage);
+			if(warn != adcWarn) {
+				adcWarn = warn;
+				TRACE_EVENT(TRACE_ADCWARN, warn);
+			}
+#endif
+
+			if(accCurrent > TRIPCAPACITY) {
 				fetOff();
-				for(;;);
+				doShutdownProcess();
+				TRACE_EVENT(TRACE_TRIP, TRACETRIP_CAPACITY);
+				faultLogRecord(TRACETRIP_CAPACITY);
+				HALT();
 			}
 
 
-			if(curCurrent > 20) {
+			if(curCurrent > TRIPCURRENT) {
 				fetOff();
-				for(;;);
+				holdLampInReset();
+				TRACE_EVENT(TRACE_TRIP, TRACETRIP_CURRENT);
+				faultLogRecord(TRACETRIP_CURRENT);
+				HALT();
 			}
 
 
-			if(curVoltage < 600) {
-				doShutdownProcess();
+			if(curVoltage < TRIPVOLTAGE) {
 				fetOff();
-				for(;;);
+				doShutdownProcess();
+				TRACE_EVENT(TRACE_TRIP, TRACETRIP_VOLTAGE);
+				faultLogRecord(TRACETRIP_VOLTAGE);
+				HALT();
 			}
 
-			testLampState(&lastTLast);
+			testLampState();
 
 			sampleDelay = 1;
-		} else {
-			uint_fast32_t currentTick = getTickNumber();
-			if(currentTick != lastTick) {
-				lastTick = currentTick;
-				// Poll the lamp controller
-				PIND = (1<<PD5); // Toggle reset line
+		}
+		uint_fast32_t currentTick = getTickNumber();
+		if(currentTick != lastTick) { // Whether or not there were samples, a pass of the lamp polling can outlast a pair of them
+			lastTick = currentTick;
+			supervisorTick();
+			lampMemoryTick();
+			socTick();
+#if ADC_HIRES
+			if(hiResWindowAllowed()) {
+				adcHiResWindow(); // Once a tick, ahead of the status frame that would hold the clock up
 			}
+#endif
+			// Poll the lamp controller
+#if TELEMETRY_ENABLE || TWI_SLAVE
+			reportStatus(); // Once a tick, queued and left for the USART interrupt and published for the head unit
+#endif
+			headUnitPoll();
 		}
+		BENCH_END(BENCH_MAINWAKE);
 	}
 }
 
 static void goToSleep()
 {
+	clockIdle(); // Down to the reduced clock if nothing needs it up
 	set_sleep_mode(SLEEP_MODE_IDLE);
 	cli();
 		if(!interruptsPending()) {
 			sleep_enable();
+			ENERGY_SLEEP();
 			sei();
 			sleep_cpu();
 			sleep_disable();
+			ENERGY_WAKE();
 		}
 	sei();
 }
 
 static uint_fast8_t interruptsPending()
 {
+#if PATTERN_ENABLE
+	return testIntADC() || testIntOverCurrent() || testIntLowPower() || testIntTimers() || testIntPattern();
+#else
 	return testIntADC() || testIntOverCurrent() || testIntLowPower() || testIntTimers();
+#endif
+}
+
+#if ADC_HIRES
+static uint_fast8_t hiResWindowAllowed()
+{
+#if PATTERN_ENABLE
+	if(currentPattern() != PATTERNSTEADY) { // Timer-2 would stand still through the window
+		return 0;
+	}
+#endif
+	return twi_idle() && !clockHeld(); // Nor may the bus, the USART or the Timer-0 PWM be busy
+}
+#endif
+
+#if TRACE_ENABLE || TELEMETRY_ENABLE || TWI_SLAVE
+static uint_fast8_t adcWarnings(uint_fast32_t accCurrent, uint_fast16_t curCurrent, uint_fast16_t curVoltage)
+{
+	return (curCurrent > WARNCURRENT ? TRACEWARN_CURRENT : 0) | (curVoltage < WARNVOLTAGE ? TRACEWARN_VOLTAGE : 0) |
+		(accCurrent > WARNCAPACITY ? TRACEWARN_CAPACITY : 0);
+}
+#endif
+
+#if TELEMETRY_ENABLE || TWI_SLAVE
+static void reportStatus()
+{
+	uint_fast32_t accCurrent = getAccumulatedCurrent();
+	uint_fast16_t curCurrent = getADCCurrentReading();
+	uint_fast16_t curVoltage = getADCVoltageReading();
+	uint_fast8_t flags = adcWarnings(accCurrent, curCurrent, curVoltage);
+
+	flags |= overCurrentTripped() ? TELEMFLAG_OVERCURRENT : 0;
+	flags |= lowPowerTripped() ? TELEMFLAG_LOWPOWER : 0;
+	flags |= lampIsOn() ? TELEMFLAG_LAMPON : 0;
+	flags |= stackHeadroom() < STACKMON_WARNBYTES ? TELEMFLAG_STACKLOW : 0;
+
+#if TELEMETRY_ENABLE
+	telemetrySendStatus(curCurrent, curVoltage, accCurrent, lampGetLevel(), flags);
+#endif
+	headUnitUpdate(curCurrent, curVoltage, accCurrent, lampGetLevel(), flags);
 }
+#endif
 
 static uint_fast8_t initAVR()
 {
@@ -178,6 +343,9 @@ static uint_fast8_t initAVR()
 
 void doShutdownProcess()
 {
+#if PATTERN_ENABLE
+	selectPattern(PATTERNSTEADY); // Stop the sequencer so it can't bring the lamp back out of reset
+#endif
 	holdLampInReset();
 }
 
@@ -0,0 +1,235 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include <stdint.h>
+
+#include "Hal.h"
+#include "twi.h"
+#include "ISRProfiler.h"
+#include "Clock.h"
+
+#define TIMER0CSMASK ((1<<CS02) | (1<<CS01) | (1<<CS00))
+#define TIMER1CSMASK ((1<<CS12) | (1<<CS11) | (1<<CS10))
+#define TIMER2CSMASK ((1<<CS22) | (1<<CS21) | (1<<CS20))
+#define ADPSMASK ((1<<ADPS2) | (1<<ADPS1) | (1<<ADPS0))
+
+#define FULLTIMER1CS ((1<<CS12) | (1<<CS10)) // clk/1024
+#define FULLTIMER2CS ((1<<CS22) | (1<<CS21) | (1<<CS20)) // clk/1024
+#define FULLADPS ((1<<ADPS2) | (1<<ADPS1) | (1<<ADPS0)) // clk/128, 62.5KHz at 8MHz
+#define TWIBITRATE(_clk) ((((_clk) / TWI_FREQ) - 16) / 2) // SCL is clk / (16 + 2 * TWBR)
+
+#if CLOCK_SCALING
+#if CLOCK_IDLESHIFT == 2
+	#define IDLETIMER1CS (1<<CS12) // clk/256
+	#define IDLETIMER2CS ((1<<CS22) | (1<<CS21)) // clk/256
+	#define IDLEADPS ((1<<ADPS2) | (1<<ADPS0)) // clk/32
+#elif CLOCK_IDLESHIFT == 4
+	#define IDLETIMER1CS ((1<<CS11) | (1<<CS10)) // clk/64
+	#define IDLETIMER2CS (1<<CS22) // clk/64
+	#define IDLEADPS ((1<<ADPS1) | (1<<ADPS0)) // clk/8
+#else
+	#error "CLOCK_IDLESHIFT must leave Timer-1, Timer-2 and the ADC a prescaler that keeps their rates (2 or 4)"
+#endif
+
+#if TWIBITRATE(F_CPU >> CLOCK_IDLESHIFT) < 10
+	#error "TWI_FREQ is too fast for the reduced clock"
+#endif
+
+static struct {
+	volatile uint_fast8_t holds;
+	volatile uint_fast8_t shift;
+} clockState;
+
+static void switchClock(uint_fast8_t shift);
+
+void initClock()
+{
+	uint_fast8_t statReg = SREG;
+
+	clockState.holds = CLOCKHOLD_BOOT;
+	clockState.shift = 0;
+
+	cli();
+		CLKPR = (1<<CLKPCE);
+		CLKPR = 0; // Full speed, whatever CKDIV8 started us at
+	SREG = statReg;
+}
+
+void clockHold(uint_fast8_t reason)
+{
+	uint_fast8_t statReg = SREG;
+
+	cli();
+		clockState.holds |= reason;
+	SREG = statReg;
+
+	if(clockState.shift != 0) {
+		switchClock(0);
+	}
+}
+
+void clockRelease(uint_fast8_t reason)
+{
+	uint_fast8_t statReg = SREG;
+
+	cli();
+		clockState.holds &= ~reason;
+	SREG = statReg;
+}
+
+void clockIdle()
+{
+	if(clockState.holds == 0 && clockState.shift == 0) { // Interrupts only ever release
+		switchClock(CLOCK_IDLESHIFT);
+	}
+}
+
+uint_fast8_t clockShift()
+{
+	return clockState.shift;
+}
+
+uint_fast8_t clockHeld()
+{
+	return clockState.holds;
+}
+
+uint_fast8_t clockTimer0Select()
+{
+	return clockTimer1Select(); // Same selects
+}
+
+uint_fast8_t clockTimer1Select()
+{
+	return clockState.shift ? IDLETIMER1CS : FULLTIMER1CS;
+}
+
+uint_fast8_t clockTimer2Select()
+{
+	return clockState.shift ? IDLETIMER2CS : FULLTIMER2CS;
+}
+
+uint_fast8_t clockADCSelect()
+{
+	return clockState.shift ? IDLEADPS : FULLADPS;
+}
+
+uint_fast8_t clockTWIBitRate()
+{
+	return clockState.shift ? TWIBITRATE(F_CPU >> CLOCK_IDLESHIFT) : TWIBITRATE(F_CPU);
+}
+
+static void switchClock(uint_fast8_t shift)
+{
+	uint_fast8_t statReg = SREG;
+	uint_fast16_t tThen, tNow;
+
+	if((TCCR1B & TIMER1CSMASK) && !(PRR & (1<<PRTIM1))) { // Once the time base is running line the switch up on one of its counts
+		tThen = TCNT1;
+		for(;;) {
+			do {
+				tNow = TCNT1;
+			} while(tThen == tNow); // The prescaler has only just passed a multiple of 1024
+			cli();
+			if(TCNT1 == tNow) { // Still on that count, anything that got in first was quick
+				break;
+			}
+			SREG = statReg;
+			tThen = TCNT1; // Wait for the next one
+		}
+	}
+
+	cli();
+		CLKPR = (1<<CLKPCE);
+		CLKPR = shift;
+		GTCCR = (1<<PSRSYNC); // Restart the Timer-0/1 prescaler so that the next count is a whole one at the new rate
+		clockState.shift = shift;
+		TCCR1B = (TCCR1B & ~TIMER1CSMASK) | clockTimer1Select();
+		if((TCCR0A & ((1<<WGM01) | (1<<WGM00))) == (1<<WGM01) && (TCCR0B & TIMER0CSMASK)) { // CTC, pacing slow ADC conversions
+			TCCR0B = (TCCR0B & ~TIMER0CSMASK) | clockTimer0Select();
+		}
+		if(TCCR2B & TIMER2CSMASK) { // A pattern is playing
+			TCCR2B = (TCCR2B & ~TIMER2CSMASK) | clockTimer2Select();
+		}
+		if(ADCSRA & (1<<ADEN)) {
+			FLAG_WRITE(ADCSRA, (ADCSRA & ~ADPSMASK & ~(1<<ADIF)) | clockADCSelect(), (1<<ADIF)); // Leaving any result pending
+		}
+		TWBR = clockTWIBitRate();
+		ISRPROF_RESYNC(ISRPROF_ADC);
+		ISRPROF_RESYNC(ISRPROF_TIMER1OVF);
+	SREG = statReg;
+}
+#else
+static struct {
+	volatile uint_fast8_t holds; // Only kept for clockHeld()
+} clockState;
+
+void initClock()
+{
+	uint_fast8_t statReg = SREG;
+
+	clockState.holds = CLOCKHOLD_BOOT;
+
+	cli();
+		CLKPR = (1<<CLKPCE);
+		CLKPR = 0; // Full speed, whatever CKDIV8 started us at
+	SREG = statReg;
+}
+
+void clockHold(uint_fast8_t reason)
+{
+	uint_fast8_t statReg = SREG;
+
+	cli();
+		clockState.holds |= reason;
+	SREG = statReg;
+}
+
+void clockRelease(uint_fast8_t reason)
+{
+	uint_fast8_t statReg = SREG;
+
+	cli();
+		clockState.holds &= ~reason;
+	SREG = statReg;
+}
+
+void clockIdle()
+{
+}
+
+uint_fast8_t clockShift()
+{
+	return 0;
+}
+
+uint_fast8_t clockHeld()
+{
+	return clockState.holds;
+}
+
+uint_fast8_t clockTimer0Select()
+{
+	return clockTimer1Select(); // Same selects
+}
+
+uint_fast8_t clockTimer1Select()
+{
+	return FULLTIMER1CS;
+}
+
+uint_fast8_t clockTimer2Select()
+{
+	return FULLTIMER2CS;
+}
+
+uint_fast8_t clockADCSelect()
+{
+	return FULLADPS;
+}
+
+uint_fast8_t clockTWIBitRate()
+{
+	return TWIBITRATE(F_CPU);
+}
+#endif
\ No newline at end of file
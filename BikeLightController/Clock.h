@@ -0,0 +1,47 @@
+#ifndef CLOCK_H_
+#define CLOCK_H_
+
+	// The system clock and the one place its frequency is set
+	// F_CPU is the oscillator with the CLKPR prescaler at one, the TWI bit rate, the ADC, Timer-1, Timer-2 and USART settings
+	// are all worked out from it. initClock() puts CLKPR back to one whatever the CKDIV8 fuse left it at. With CLOCK_SCALING
+	// the CPU then drops to F_CPU >> CLOCK_IDLESHIFT whenever nothing holds it up, and the Timer-1, Timer-2 and ADC (and
+	// Timer-0 while it paces slow ADC conversions) prescalers are moved the other way as it does so their count and conversion rates (and so getTime()) don't change.
+	// The TWI bit rate is reworked to match. The USART and the Timer-0 PWM can't follow the clock down so they hold it up
+	// while in use, as do startup and the rheostat stepping bursts, whose TWI interrupts would otherwise run four times slower.
+	// Switching lines Timer-1 up on a count and restarts its prescaler, so each switch costs up to a count (128uS) of waiting.
+
+	#include <stdint.h>
+
+	#ifndef F_CPU
+		#define F_CPU 8000000UL
+	#endif
+
+	#ifndef CLOCK_SCALING
+		#define CLOCK_SCALING 0
+	#endif
+
+	#ifndef CLOCK_IDLESHIFT
+		#define CLOCK_IDLESHIFT 2 // Divide by four (2MHz at 8MHz), or 4 for sixteen
+	#endif
+
+	// Reasons for running at full speed, one bit each
+	#define CLOCKHOLD_BOOT 0x01
+	#define CLOCKHOLD_LAMP 0x02 // Rheostat stepping
+	#define CLOCKHOLD_USART 0x04 // Telemetry going out
+	#define CLOCKHOLD_PWM 0x08 // Timer-0 dimmer trimming
+
+	void initClock();
+	void clockHold(uint_fast8_t reason); // Main line only, switches up straight away
+	void clockRelease(uint_fast8_t reason); // Safe from an interrupt, the clock stays up until the next clockIdle()
+	void clockIdle(); // Main line only, drops the clock if nothing holds it up
+	uint_fast8_t clockShift(); // CLKPR setting in force, zero at full speed
+	uint_fast8_t clockHeld(); // Non-zero while anything holds the clock up, whether or not it's scaled
+
+	// Clock selects that give the same count or conversion rate at whatever clock is in force
+	uint_fast8_t clockTimer0Select(); // F_CPU / 1024
+	uint_fast8_t clockTimer1Select(); // F_CPU / 1024
+	uint_fast8_t clockTimer2Select(); // F_CPU / 1024
+	uint_fast8_t clockADCSelect(); // F_CPU / 128
+	uint_fast8_t clockTWIBitRate(); // TWBR for TWI_FREQ
+
+#endif /* CLOCK_H_ */
\ No newline at end of file
@@ -0,0 +1,161 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include <stdint.h>
+
+#include "Eeprom.h"
+#include "EnergyMonitor.h"
+
+#define EEMODEATOMIC 0
+#define EEMODEERASE (1<<EEPM0)
+#define EEMODEWRITE (1<<EEPM1)
+
+#define RINGADDR(_ring, _slot) ((_ring)->base + (_slot) * (_ring)->size)
+#define RINGNEXT(_ring, _slot) ((_slot) + 1 >= (_ring)->slots ? 0 : (_slot) + 1) // From empty, the first
+#define NEXTSEQ(_seq) ((_seq) == 0xFE ? 0 : (_seq) + 1)
+
+static void program(uint_fast8_t addr, uint_fast8_t data, uint_fast8_t mode);
+static uint_fast8_t ringSlotSeq(const struct EepromRing *ring, uint_fast8_t slot);
+
+uint_fast8_t eepromRead(uint_fast8_t addr)
+{
+	if(EECR & (1<<EEPE)) {
+		ENERGY_ENTER(ENERGY_WAITEEPROM);
+		while(EECR & (1<<EEPE)); // Wait for any programming to finish
+		ENERGY_EXIT();
+	}
+
+	EEAR = addr;
+	EECR |= (1<<EERE);
+
+	return EEDR;
+}
+
+void eepromWrite(uint_fast8_t addr, uint_fast8_t data)
+{
+	uint_fast8_t current = eepromRead(addr);
+
+	if(current == data) {
+		return; // Saves the wear as well as the time
+	}
+
+	program(addr, data, (current & data) == data ? EEMODEWRITE : EEMODEATOMIC); // Programming can only clear bits
+}
+
+void eepromErase(uint_fast8_t addr)
+{
+	if(eepromRead(addr) != 0xFF) {
+		program(addr, 0xFF, EEMODEERASE);
+	}
+}
+
+uint_fast8_t eepromRingInit(struct EepromRing *ring, uint8_t *entry)
+{
+	uint_fast8_t slot, seq, idx;
+
+	ring->newest = ring->slots;
+	ring->seq = 0xFE; // So that the first save is 0
+	ring->step = EEPROMRING_IDLE;
+	for(slot = 0; slot < ring->slots; slot++) {
+		seq = ringSlotSeq(ring, slot);
+		if(seq != 0xFF && ringSlotSeq(ring, RINGNEXT(ring, slot)) != NEXTSEQ(seq)) {
+			ring->newest = slot;
+			ring->seq = seq;
+			break;
+		}
+	}
+
+	// Erase the slot the next save goes in, only bytes that need it take any time
+	slot = RINGNEXT(ring, ring->newest);
+	for(idx = 0; idx < ring->size; idx++) {
+		eepromErase(RINGADDR(ring, slot) + idx);
+	}
+
+	if(ring->newest == ring->slots) {
+		return 0;
+	}
+	for(idx = 0; idx < ring->size; idx++) {
+		entry[idx] = eepromRead(RINGADDR(ring, ring->newest) + idx);
+	}
+	return 1;
+}
+
+void eepromRingSave(struct EepromRing *ring, uint8_t *entry)
+{
+	uint_fast8_t idx, sum = 0;
+
+	ring->seq = NEXTSEQ(ring->seq);
+	entry[ring->size - 1] = ring->seq;
+	for(idx = 0; idx < ring->size; idx++) {
+		sum += idx != ring->size - 2 ? entry[idx] : 0;
+	}
+	entry[ring->size - 2] = -sum;
+	ring->step = 0;
+}
+
+uint_fast8_t eepromRingStep(struct EepromRing *ring, const uint8_t *entry)
+{
+	uint_fast8_t slot = RINGNEXT(ring, ring->newest);
+
+	if(ring->step == EEPROMRING_IDLE) {
+		return 0;
+	}
+	if(EECR & (1<<EEPE)) {
+		return 1; // Another ring's byte is still programming, this one's waits for the next call rather than for that
+	}
+
+	if(ring->step < ring->size) {
+		eepromWrite(RINGADDR(ring, slot) + ring->step, entry[ring->step]); // Write only, it's erased
+		if(ring->step == ring->size - 1) {
+			ring->newest = slot;
+		}
+	} else {
+		eepromErase(RINGADDR(ring, slot) + ring->step - ring->size); // The one after the new newest
+	}
+
+	ring->step = ring->step + 1 < 2 * ring->size ? ring->step + 1 : EEPROMRING_IDLE;
+
+	return ring->step != EEPROMRING_IDLE;
+}
+
+uint_fast8_t eepromRingRead(const struct EepromRing *ring, uint_fast8_t age, uint8_t *entry)
+{
+	uint_fast8_t slot, seq, idx, sum = 0;
+
+	if(ring->newest == ring->slots || age >= ring->slots) {
+		return 0;
+	}
+	slot = ring->newest >= age ? ring->newest - age : ring->newest + ring->slots - age;
+	seq = ring->seq >= age ? ring->seq - age : ring->seq + 0xFF - age; // Counting back, skipping 0xFF
+	for(idx = 0; idx < ring->size; idx++) {
+		entry[idx] = eepromRead(RINGADDR(ring, slot) + idx);
+		sum += entry[idx];
+	}
+
+	return sum == 0 && entry[ring->size - 1] == seq;
+}
+
+static uint_fast8_t ringSlotSeq(const struct EepromRing *ring, uint_fast8_t slot)
+{
+	uint_fast8_t idx, data = 0xFF, sum = 0;
+
+	for(idx = 0; idx < ring->size; idx++) {
+		data = eepromRead(RINGADDR(ring, slot) + idx);
+		sum += data;
+	}
+
+	return sum == 0 ? data : 0xFF; // The last byte read is the sequence number, an erased slot doesn't sum to zero
+}
+
+static void program(uint_fast8_t addr, uint_fast8_t data, uint_fast8_t mode)
+{
+	uint_fast8_t statReg = SREG;
+
+	// eepromRead() has already waited out any programming in progress
+	EEAR = addr;
+	EEDR = data;
+	cli();
+		EECR = mode | (1<<EEMPE);
+		EECR |= (1<<EEPE); // Within four cycles of setting EEMPE
+	SREG = statReg;
+}
\ No newline at end of file
@@ -0,0 +1,43 @@
+#ifndef EEPROM_H_
+#define EEPROM_H_
+
+	// Byte access to the 256 byte EEPROM and where each module keeps its data in it
+	// Erase and write together take 3.4ms, either on its own 1.8ms. eepromWrite() skips bytes that already hold the value
+	// and only programs (without the erase) when no bit has to go from 0 to 1, so writing over erased cells is quickest.
+
+	// Layout
+	#define EEPROM_FAULTLOG 0x00 // FAULTLOG_ENTRIES * sizeof(struct FaultLogEntry)
+	#define EEPROM_LAMPMEMORY 0x80 // LAMPMEMORY_SLOTS * sizeof(struct LampMemoryEntry)
+	#define EEPROM_CHARGESTATE 0xC0 // SOC_SLOTS * sizeof(struct SocEntry)
+
+	uint_fast8_t eepromRead(uint_fast8_t addr);
+	void eepromWrite(uint_fast8_t addr, uint_fast8_t data);
+	void eepromErase(uint_fast8_t addr);
+
+	// A ring of fixed size entries saved a byte at a time from the main loop, for state that's kept up to date while running
+	// Each entry ends in a check byte, which makes its byte sum zero, and a sequence number that skips 0xFF. The newest
+	// is the valid entry the next slot doesn't follow on from. The slot after it is erased in advance so that a save is
+	// write only programming, the sequence number goes last so a save cut short by a power failure leaves the one before
+	// it standing, and the slot after the new one is then erased ready for the next. eepromRingStep() does one byte
+	// a call, so called once a tick the programming of one has finished long before the next, and a save of n bytes
+	// takes at least 2n ticks. Rings stepped in the same tick take turns, a step that finds another's byte still
+	// programming leaves its own for the next call rather than wait up to 3.4ms for it. Spreading saves over the slots
+	// spreads the wear. eepromRingRead() goes back through the run of entries saved before the newest, one slot is always
+	// the erased one so a ring holds at most slots - 1.
+	#define EEPROMRING_IDLE 0xFF // eepromRing.step between saves
+
+	struct EepromRing {
+		uint8_t base; // Address of the first slot
+		uint8_t slots;
+		uint8_t size; // Of an entry, check and sequence number included
+		uint8_t newest; // Slot, slots when empty
+		uint8_t seq; // The newest's, 0xFE when empty
+		uint8_t step; // Byte of the save under way, EEPROMRING_IDLE between saves
+	};
+
+	uint_fast8_t eepromRingInit(struct EepromRing *ring, uint8_t *entry); // Zero if there's no entry, otherwise reads the newest
+	void eepromRingSave(struct EepromRing *ring, uint8_t *entry); // Fills in the check and sequence number, entry must stay put until it's done
+	uint_fast8_t eepromRingStep(struct EepromRing *ring, const uint8_t *entry); // Zero once the save is done
+	uint_fast8_t eepromRingRead(const struct EepromRing *ring, uint_fast8_t age, uint8_t *entry); // Zero unless age saves back is in the run
+
+#endif /* EEPROM_H_ */
\ No newline at end of file
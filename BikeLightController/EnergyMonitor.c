@@ -0,0 +1,83 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include <stdint.h>
+#include <string.h>
+
+#include "EnergyMonitor.h"
+
+#if ENERGY_ENABLE
+#define ACTIVEUA ((uint_fast32_t)ENERGY_ACTIVEUAPERMHZ * (F_CPU / 1000000UL)) // At F_CPU
+#define IDLEUA ((uint_fast32_t)ENERGY_IDLEUAPERMHZ * (F_CPU / 1000000UL))
+#define MAXTOTAL ((uint_fast32_t)1 << 13) // Counts, scaled down to this the sums of products below fit 32 bits
+
+struct EnergyMonitorState energyState;
+
+void initEnergyMonitor()
+{
+	uint_fast8_t statReg = SREG;
+
+	cli();
+		memset(&energyState, 0, sizeof(energyState));
+		energyState.last = TCNT1;
+		energyState.state = ENERGY_RUN;
+	SREG = statReg;
+}
+
+uint_fast32_t energyTicks(uint_fast8_t state)
+{
+	uint_fast8_t statReg = SREG;
+	uint_fast32_t ticks;
+
+	cli();
+		ticks = energyState.ticks[state];
+	SREG = statReg;
+
+	return ticks;
+}
+
+uint_fast16_t energyMicroWattHours()
+{
+	uint_fast8_t statReg = SREG;
+	uint_fast32_t total = 0, active, idle, adcNR, microAmps;
+	uint_fast8_t idx;
+
+	cli();
+		for(idx = 0; idx < ENERGY_NSTATES; idx++) {
+			total += energyState.ticks[idx];
+		}
+		active = energyState.activeClocked;
+		idle = energyState.idleClocked;
+		adcNR = energyState.ticks[ENERGY_ADCNR];
+	SREG = statReg;
+
+	while(total >= MAXTOTAL) { // Only the shares matter
+		total >>= 1;
+		active >>= 1;
+		idle >>= 1;
+		adcNR >>= 1;
+	}
+	if(total == 0) {
+		return 0;
+	}
+
+	microAmps = (((active * ACTIVEUA + idle * IDLEUA) >> CLOCK_IDLESHIFT) + adcNR * ENERGY_ADCNRUA) / total;
+	microAmps = microAmps * ENERGY_VCC_MV / 1000;
+
+	return microAmps < 0xFFFF ? microAmps : 0xFFFF;
+}
+#else
+void initEnergyMonitor()
+{
+}
+
+uint_fast32_t energyTicks(uint_fast8_t state)
+{
+	return 0;
+}
+
+uint_fast16_t energyMicroWattHours()
+{
+	return 0;
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,116 @@
+#ifndef ENERGYMONITOR_H_
+#define ENERGYMONITOR_H_
+
+	// MCU energy accounting, how the time splits between running, each sleep mode, each interrupt handler and the busy waits
+	// The CPU is always in exactly one ENERGY_... state and each change charges the Timer-1 counts since the last one to
+	// the state being left. A stretch is only known to a count (128uS, whatever the clock is scaled to, see Clock.h) but
+	// the stretches add up to the elapsed time so the shares come out right over many of them. The count is taken
+	// modulo the Timer-1 period, the overflow interrupt makes a change of its own every period so no stretch is longer.
+	// Handlers that nest (see Hal.h) charge their time to themselves and give it back to whatever they interrupted as
+	// they return. ANALOG_COMP, INT0 and WDT never return so aren't counted. Running and idle sleep are also counted at
+	// the clock they ran at, which with the datasheet supply figures below gives energyMicroWattHours(), a rough MCU
+	// energy per hour at the shares seen so far. The table can be read with energyTicks() or straight out of RAM over
+	// debugWIRE.
+
+	#include <stdint.h>
+
+	#ifndef ENERGY_ENABLE
+		#define ENERGY_ENABLE 0
+	#endif
+
+	// Supply figures, ATmega48 at 5V from the datasheet's typical characteristics
+	#ifndef ENERGY_VCC_MV
+		#define ENERGY_VCC_MV 5000
+	#endif
+
+	#ifndef ENERGY_ACTIVEUAPERMHZ
+		#define ENERGY_ACTIVEUAPERMHZ 500 // Running
+	#endif
+
+	#ifndef ENERGY_IDLEUAPERMHZ
+		#define ENERGY_IDLEUAPERMHZ 130 // Idle sleep, the I/O clock still running
+	#endif
+
+	#ifndef ENERGY_ADCNRUA
+		#define ENERGY_ADCNRUA 250 // ADC noise reduction sleep, the ADC converting with the other clocks stopped
+	#endif
+
+	// States
+	#define ENERGY_RUN 0 // Main line
+	#define ENERGY_IDLE 1 // Idle sleep
+	#define ENERGY_ADCNR 2 // ADC noise reduction sleep, the only other mode the firmware uses
+	#define ENERGY_ISRADC 3
+	#define ENERGY_ISRTWI 4
+	#define ENERGY_ISRTIMER 5 // Timer-1 overflow and Timer-2 compare
+	#define ENERGY_ISRUSART 6
+	#define ENERGY_WAITTWI 7 // Main line busy waiting on the bus
+	#define ENERGY_WAITEEPROM 8 // And on EEPROM programming
+	#define ENERGY_NSTATES 9
+
+	void initEnergyMonitor();
+	uint_fast32_t energyTicks(uint_fast8_t state); // Timer-1 counts spent in state since initEnergyMonitor()
+	uint_fast16_t energyMicroWattHours(); // Estimated MCU energy per hour, so the mean supply power in uW
+
+#if ENERGY_ENABLE
+	#include <avr/io.h>
+	#include <avr/interrupt.h>
+
+	#include "Clock.h"
+	#include "TimerServices.h"
+
+	extern struct EnergyMonitorState {
+		uint32_t ticks[ENERGY_NSTATES];
+		uint32_t activeClocked; // Counts running, scaled by the clock they ran at, in 1 / (1 << CLOCK_IDLESHIFT) counts at F_CPU
+		uint32_t idleClocked; // The same for idle sleep
+		uint16_t last; // TCNT1 at the last change
+		uint8_t state;
+	} energyState;
+
+	static inline uint8_t energySwitch(uint8_t state)
+	{
+		uint8_t statReg = SREG;
+		uint8_t left, shift;
+		uint16_t now, elapsed;
+
+		cli();
+			now = TCNT1;
+			elapsed = now - energyState.last;
+			if(now < energyState.last) { // Wrapped at TIMER1TOP
+				elapsed += TIMER1TOP + 1;
+			}
+			energyState.last = now;
+			left = energyState.state;
+			energyState.state = state;
+			energyState.ticks[left] += elapsed;
+
+			shift = CLKPR & 0x0F;
+			shift = shift < CLOCK_IDLESHIFT ? CLOCK_IDLESHIFT - shift : 0;
+			if(left == ENERGY_IDLE) {
+				energyState.idleClocked += (uint32_t)elapsed << shift;
+			} else if(left != ENERGY_ADCNR) {
+				energyState.activeClocked += (uint32_t)elapsed << shift;
+			}
+		SREG = statReg;
+
+		return left;
+	}
+
+	static inline uint8_t energySleepState()
+	{
+		return (SMCR & ((1<<SM2) | (1<<SM1) | (1<<SM0))) == (1<<SM0) ? ENERGY_ADCNR : ENERGY_IDLE;
+	}
+
+	#define ENERGY_ENTER(_state) uint8_t energyLeft = energySwitch(_state) // Interrupt handlers and busy waits
+	#define ENERGY_EXIT() ((void)energySwitch(energyLeft)) // Back to whatever was going on before
+	#define ENERGY_SLEEP() ((void)energySwitch(energySleepState())) // Just before sleep_cpu(), with the mode already set
+	#define ENERGY_WAKE() ((void)energySwitch(ENERGY_RUN)) // Straight after it
+	#define ENERGY_STATE(_state) ((void)energySwitch(_state))
+#else
+	#define ENERGY_ENTER(_state)
+	#define ENERGY_EXIT()
+	#define ENERGY_SLEEP()
+	#define ENERGY_WAKE()
+	#define ENERGY_STATE(_state)
+#endif
+
+#endif /* ENERGYMONITOR_H_ */
\ No newline at end of file
@@ -0,0 +1,73 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include <stdint.h>
+#include <string.h>
+
+#include "TimerServices.h"
+#include "EventTrace.h"
+
+#if TRACE_ENABLE
+struct EventTrace eventTrace __attribute__((section(".noinit"))); // Left alone by the start up code so a trip survives the reset
+
+static struct {
+	uint_fast32_t tLast;
+	uint_fast8_t ready; // Nothing is recorded until the ring has been checked at boot
+} traceState;
+
+void initEventTrace(uint_fast8_t resetSource)
+{
+	uint_fast8_t valid = eventTrace.magic[0] == TRACEMAGIC0 && eventTrace.magic[1] == TRACEMAGIC1 &&
+		eventTrace.length == TRACE_LENGTH && eventTrace.head < TRACE_LENGTH && eventTrace.count <= TRACE_LENGTH;
+
+	if((resetSource & (1<<PORF)) || !valid) { // RAM contents are undefined after power on
+		memset(&eventTrace, 0, sizeof(eventTrace));
+		eventTrace.magic[0] = TRACEMAGIC0;
+		eventTrace.magic[1] = TRACEMAGIC1;
+		eventTrace.length = TRACE_LENGTH;
+	}
+
+	traceState.tLast = getTime();
+	traceState.ready = 1;
+
+	traceEvent(TRACE_BOOT, resetSource);
+}
+
+void traceEvent(uint_fast8_t id, uint_fast8_t payload)
+{
+	uint_fast32_t tNow = getTime();
+	uint_fast32_t tDelta;
+	uint_fast8_t statReg = SREG;
+
+	if(!traceState.ready) {
+		return;
+	}
+
+	cli();
+		tDelta = tNow > traceState.tLast ? tNow - traceState.tLast : 0; // Time steps back when the timers are restarted during boot
+		traceState.tLast = tNow;
+		if(tDelta > 0xFFFF) {
+			tDelta = 0xFFFF;
+		}
+
+		struct EventTraceRecord *rec = eventTrace.record + eventTrace.head;
+		rec->id = id;
+		rec->payload = payload;
+		rec->dtLow = tDelta;
+		rec->dtHigh = tDelta >> 8;
+
+		eventTrace.head = (eventTrace.head + 1) & (TRACE_LENGTH - 1);
+		if(eventTrace.count < TRACE_LENGTH) {
+			eventTrace.count++;
+		}
+	SREG = statReg;
+}
+#else
+void initEventTrace(uint_fast8_t resetSource)
+{
+}
+
+void traceEvent(uint_fast8_t id, uint_fast8_t payload)
+{
+}
+#endif
\ No newline at end of file
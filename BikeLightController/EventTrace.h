@@ -0,0 +1,68 @@
+#ifndef EVENTTRACE_H_
+#define EVENTTRACE_H_
+
+	// A small ring of four byte records (event id, payload, milliseconds since the previous record) kept in .noinit RAM
+	// so that it survives the watchdog reset that follows a trip. Read the eventTrace structure out over debugWIRE (or
+	// from the simulator) and feed the bytes to tools/TraceDecode to get a timeline.
+
+	#ifndef TRACE_ENABLE
+		#define TRACE_ENABLE 0
+	#endif
+
+	#ifndef TRACE_LENGTH
+		#define TRACE_LENGTH 16 // Records, a power of two no larger than 128
+	#endif
+
+	#define TRACEMAGIC0 'E'
+	#define TRACEMAGIC1 'T'
+
+	// Event ids and what their payload holds
+	#define TRACE_BOOT 1 // MCUSR reset source, times restart from here
+	#define TRACE_FETON 2
+	#define TRACE_FETOFF 3
+	#define TRACE_TRIP 4 // TRACETRIP_... reason
+	#define TRACE_RHEOSTAT 5 // Lamp level after a move (rheostat position, or the PWM level)
+	#define TRACE_BUTTONS 6 // MCP23008 INTCAP, buttons read low when pressed
+	#define TRACE_LAMP 7 // 1 on, 0 off
+	#define TRACE_I2CERR 8 // twi_writeTo() result
+	#define TRACE_ADCWARN 9 // TRACEWARN_... flags, logged when they change
+
+	#define TRACETRIP_OVERCURRENT 1 // Comparator interrupt
+	#define TRACETRIP_LOWPOWER 2 // INT0 pin
+	#define TRACETRIP_CAPACITY 3 // Accumulated current
+	#define TRACETRIP_CURRENT 4
+	#define TRACETRIP_VOLTAGE 5
+	#define TRACETRIP_HANG 6 // Watchdog interrupt
+
+	#define TRACELAMP(_idx) ((uint_fast8_t)(_idx) << 5) // Which lamp, in the top three bits of the TRACE_RHEOSTAT, TRACE_BUTTONS and TRACE_LAMP payloads
+
+	#define TRACEWARN_CURRENT 0x01
+	#define TRACEWARN_VOLTAGE 0x02
+	#define TRACEWARN_CAPACITY 0x04
+
+	struct EventTrace {
+		uint8_t magic[2];
+		uint8_t length; // TRACE_LENGTH, so a dump can be decoded without knowing the build
+		uint8_t head; // Where the next record goes
+		uint8_t count; // Valid records, up to length
+		uint8_t pad[3];
+		struct EventTraceRecord {
+			uint8_t id;
+			uint8_t payload;
+			uint8_t dtLow; // Milliseconds since the previous record, saturating at 0xFFFF
+			uint8_t dtHigh;
+		} record[TRACE_LENGTH];
+	};
+
+	extern struct EventTrace eventTrace;
+
+	void initEventTrace(uint_fast8_t resetSource);
+	void traceEvent(uint_fast8_t id, uint_fast8_t payload);
+
+#if TRACE_ENABLE
+	#define TRACE_EVENT(_id, _payload) traceEvent(_id, _payload)
+#else
+	#define TRACE_EVENT(_id, _payload)
+#endif
+
+#endif /* EVENTTRACE_H_ */
\ No newline at end of file
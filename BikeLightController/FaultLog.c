@@ -0,0 +1,123 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/wdt.h>
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "ADCReader.h"
+#include "TimerServices.h"
+#include "LampControl.h"
+#include "Eeprom.h"
+#include "Telemetry.h"
+#include "FaultLog.h"
+
+#if FAULTLOG_ENABLE
+_Static_assert(offsetof(struct FaultLogEntry, check) + 1 == TELEMETRYFAULTLENGTH, "the fault frame is the entry less its check byte");
+
+static struct {
+	struct EepromRing ring;
+	uint_fast8_t count; // Entries in the run leading up to the newest
+	uint_fast8_t newestReason;
+} faultLogState;
+
+void initFaultLog()
+{
+	struct FaultLogEntry entry;
+
+	faultLogState.ring.base = EEPROM_FAULTLOG;
+	faultLogState.ring.slots = FAULTLOG_ENTRIES;
+	faultLogState.ring.size = sizeof(struct FaultLogEntry);
+	faultLogState.count = 0;
+	if(eepromRingInit(&faultLogState.ring, (uint8_t*)&entry)) {
+		faultLogState.newestReason = entry.reason;
+		while(faultLogState.count < FAULTLOG_ENTRIES - 1 &&
+			eepromRingRead(&faultLogState.ring, faultLogState.count, (uint8_t*)&entry)) {
+			faultLogState.count++;
+		}
+	}
+}
+
+void faultLogRecord(uint_fast8_t reason)
+{
+	struct FaultLogEntry entry;
+
+	cli(); // Called on the way to HALT(), nothing else gets to run from here on
+
+	entry.time = getTime();
+	entry.charge = getAccumulatedCurrent();
+	entry.current = getADCCurrentReading();
+	entry.voltage = getADCVoltageReading();
+	entry.level = lampGetLevel();
+	entry.reason = reason;
+	eepromRingSave(&faultLogState.ring, (uint8_t*)&entry);
+	while(eepromRingStep(&faultLogState.ring, (const uint8_t*)&entry) && faultLogState.ring.step < sizeof(entry)) {
+		continue; // The entry only, the next boot erases the slot after it
+	}
+	eepromRead(EEPROM_FAULTLOG); // Waits for the programming to finish
+
+	faultLogState.count += faultLogState.count < FAULTLOG_ENTRIES - 1 ? 1 : 0;
+	faultLogState.newestReason = reason;
+}
+
+uint_fast8_t faultLogRead(uint_fast8_t age, struct FaultLogEntry *entry)
+{
+	return age < faultLogState.count && eepromRingRead(&faultLogState.ring, age, (uint8_t*)entry);
+}
+
+uint_fast8_t faultLogNewest(uint_fast8_t *reason)
+{
+	*reason = faultLogState.count ? faultLogState.newestReason : 0;
+
+	return faultLogState.count ? faultLogState.ring.seq : FAULTLOGNONE;
+}
+
+#if TELEMETRY_ENABLE
+void faultLogReport()
+{
+	struct FaultLogEntry entry;
+	uint8_t frame[TELEMETRYFAULTLENGTH];
+	uint_fast8_t age;
+
+	for(age = faultLogState.count; age-- != 0;) { // Oldest first
+		if(faultLogRead(age, &entry)) {
+			memcpy(frame, &entry, offsetof(struct FaultLogEntry, check)); // The sequence number follows on, without the check
+			frame[TELEMETRYFAULTLENGTH - 1] = entry.seq;
+			while(telemetryFree() < TELEMETRYFAULTLENGTH + TELEMETRYOVERHEAD) { // Needs interrupts on to drain
+				wdt_reset();
+			}
+			telemetrySend(TELEMETRY_FAULT, frame, TELEMETRYFAULTLENGTH);
+		}
+	}
+}
+#else
+void faultLogReport()
+{
+}
+#endif
+#else
+void initFaultLog()
+{
+}
+
+void faultLogRecord(uint_fast8_t reason)
+{
+}
+
+uint_fast8_t faultLogRead(uint_fast8_t age, struct FaultLogEntry *entry)
+{
+	return 0;
+}
+
+uint_fast8_t faultLogNewest(uint_fast8_t *reason)
+{
+	*reason = 0;
+
+	return FAULTLOGNONE;
+}
+
+void faultLogReport()
+{
+}
+#endif
\ No newline at end of file
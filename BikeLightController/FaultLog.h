@@ -0,0 +1,38 @@
+#ifndef FAULTLOG_H_
+#define FAULTLOG_H_
+
+	// Why the last few trips happened, kept in EEPROM so that it survives the watchdog reset and any power cycles after it
+	// Entries go round an Eeprom.h ring of FAULTLOG_ENTRIES slots, whose init erases the slot after the newest at boot so
+	// that recording a trip is write only programming. A trip can't wait on the main loop's ticks, so the entry is stepped
+	// out on the spot and the erase of the slot after it left to the next boot. That's 16 bytes at 1.8ms, under 30ms, and
+	// with interrupts off from the start so nothing else runs between the trip and the HALT() that follows. One slot is
+	// always the erased one so the ring holds FAULTLOG_ENTRIES - 1 trips.
+
+	#ifndef FAULTLOG_ENABLE
+		#define FAULTLOG_ENABLE 0
+	#endif
+
+	#ifndef FAULTLOG_ENTRIES
+		#define FAULTLOG_ENTRIES 8 // Slots, 16 bytes of EEPROM each
+	#endif
+
+	#define FAULTLOGNONE 0xFF // Sequence number while the log is empty
+
+	struct FaultLogEntry {
+		uint32_t time; // getTime() at the trip, milliseconds since boot
+		uint32_t charge; // Accumulated current
+		uint16_t current;
+		uint16_t voltage;
+		uint8_t level; // Lamp level
+		uint8_t reason; // TRACETRIP_... from EventTrace.h
+		uint8_t check; // Makes the byte sum of the entry zero
+		uint8_t seq; // Counts trips, skipping 0xFF, written last
+	};
+
+	void initFaultLog();
+	void faultLogRecord(uint_fast8_t reason);
+	uint_fast8_t faultLogRead(uint_fast8_t age, struct FaultLogEntry *entry);
+	uint_fast8_t faultLogNewest(uint_fast8_t *reason);
+	void faultLogReport();
+
+#endif /* FAULTLOG_H_ */
\ No newline at end of file
@@ -0,0 +1,45 @@
+#ifndef HAL_H_
+#define HAL_H_
+
+	// The little that the firmware needs beyond the avr-libc register names
+	// Built for the AVR these expand to exactly the inline code they stand in for. A host build (see host/HostPeripherals.h)
+	// maps the register names onto simulated peripherals and needs these to model write-one-to-clear flags and the fatal spins
+
+	#include "Supervisor.h"
+
+	#ifdef __AVR__
+		#define FLAG_CLEAR(_reg, _flags) ((_reg) |= (_flags)) // Writing a one clears an interrupt flag
+		#define FLAG_WRITE(_reg, _val, _flags) ((_reg) = (_val)) // Register write where any of _flags set in _val are cleared
+		#define HALT_SPIN() for(;;) // Spin until the watchdog resets us
+	#else
+		#include "HostPeripherals.h"
+
+		#define FLAG_CLEAR(_reg, _flags) ((_reg) &= (uint8_t)~(_flags))
+		#define FLAG_WRITE(_reg, _val, _flags) ((_reg) = (uint8_t)(((_val) & ~(_flags)) | ((_reg) & (_flags) & ~(_val))))
+		#define HALT_SPIN() hostHalt()
+	#endif
+
+	#define HALT() do { supervisorShutdown(); HALT_SPIN(); } while(0) // A deliberate shutdown, see Supervisor.h
+
+	// Interrupt priorities
+	// The AVR only orders pending interrupts by their vector, once a handler is running it holds everything off until it
+	// returns. The safety paths are INT0 (low power) and ANALOG_COMP (over current), both run on to HALT() and what matters
+	// is how long they can be kept from starting. So the long handlers, ADC (the averaging and 32 bit accumulate), TWI and
+	// the Timer-2 pattern step, mask their own source and sei() as soon as they've read what can't wait, then cli() and
+	// unmask again on the way out. The short ones (Timer-1 overflow, the USART pair) and the main line's cli() sections are
+	// a few loads and stores and run through with interrupts off. The budgets are CPU cycles from the interrupt being
+	// raised, the response and the prologue included. INT0 is first in the vector table and only ever waits out the stretch
+	// already under way. ANALOG_COMP is near the end and can also see Timer-2, Timer-1, one of the USART pair and the ADC
+	// taken ahead of it, once each as the nested ones are masked. Neither safety handler returns so nothing they cut into
+	// is ever resumed, and what they read (the time base, event trace and fault log) is only written with interrupts off.
+	// The host model counts each handler a nominal entry and checks the stretches and latencies, RideReplay reports them.
+	// The figures below are estimates still: they're to be set from the image's own, which tools/SimBench.c measures
+	// under simavr and checks against them, and that hasn't been run yet.
+	#define ISRHOLD_NESTED 48 // Entry to the sei() of a nested handler
+	#define ISRHOLD_BLOCKING 64 // The whole of a short handler
+	#define ISRHOLD_MAINLINE 64 // A main line cli() section, switchClock()'s is the longest
+	#define ISRHOLD_MAX (ISRHOLD_BLOCKING > ISRHOLD_MAINLINE ? ISRHOLD_BLOCKING : ISRHOLD_MAINLINE)
+	#define ISRLATENCY_INT0 ISRHOLD_MAX
+	#define ISRLATENCY_ANALOGCOMP (ISRHOLD_MAX + 2 * ISRHOLD_NESTED + 2 * ISRHOLD_BLOCKING) // 288, 36uS at 8MHz and 144uS at the reduced clock
+
+#endif /* HAL_H_ */
\ No newline at end of file
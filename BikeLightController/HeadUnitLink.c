@@ -0,0 +1,83 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "HeadUnitLink.h"
+#include "LampControl.h"
+#include "FaultLog.h"
+#include "StackMonitor.h"
+#include "EnergyMonitor.h"
+
+#if TWI_SLAVE
+static struct {
+	uint8_t image[2][HEADUNITREGS]; // The one not published is rebuilt, a read latches its image so can't be torn
+	uint8_t published;
+} headUnitState;
+
+void initHeadUnitLink()
+{
+	memset(&headUnitState, 0, sizeof(headUnitState));
+
+	twi_setSlaveImage(headUnitState.image[0], HEADUNITREGS);
+	twi_setAddress(HEADUNIT_ADDRESS);
+}
+
+void headUnitUpdate(uint_fast16_t current, uint_fast16_t voltage, uint_fast32_t charge, uint_fast8_t level, uint_fast8_t flags)
+{
+	uint8_t *image = headUnitState.image[headUnitState.published ^ 1];
+	uint_fast8_t lastTrip;
+	uint_fast16_t headroom, energy;
+	struct twi_counters twiCount;
+
+	image[HEADUNITREG_STATUS] = flags;
+	image[HEADUNITREG_CURRENT] = current;
+	image[HEADUNITREG_CURRENT + 1] = current >> 8;
+	image[HEADUNITREG_VOLTAGE] = voltage;
+	image[HEADUNITREG_VOLTAGE + 1] = voltage >> 8;
+	image[HEADUNITREG_CHARGE] = charge;
+	image[HEADUNITREG_CHARGE + 1] = charge >> 8;
+	image[HEADUNITREG_CHARGE + 2] = charge >> 16;
+	image[HEADUNITREG_CHARGE + 3] = charge >> 24;
+	image[HEADUNITREG_LEVEL] = level;
+	image[HEADUNITREG_FAULTLOG] = faultLogNewest(&lastTrip);
+	image[HEADUNITREG_LASTTRIP] = lastTrip;
+	headroom = stackHeadroom();
+	image[HEADUNITREG_STACKFREE] = headroom < 0xFF ? headroom : 0xFF;
+	twi_getCounters(&twiCount);
+	image[HEADUNITREG_I2CTIMEOUTS] = twiCount.timeouts;
+	energy = energyMicroWattHours();
+	image[HEADUNITREG_MCUENERGY] = energy;
+	image[HEADUNITREG_MCUENERGY + 1] = energy >> 8;
+
+	twi_setSlaveImage(image, HEADUNITREGS);
+	headUnitState.published ^= 1;
+}
+
+void headUnitPoll()
+{
+	uint8_t written[TWI_SLAVERX_LENGTH];
+	uint_fast8_t length = twi_slaveWritten(written);
+
+	if(length > 1 && written[0] == HEADUNITREG_LEVEL) { // Only the level is writable, anything else is ignored
+		uint_fast8_t level = lampGetLevel();
+		uint_fast8_t target = written[1] < LAMPLEVELMAX ? written[1] : LAMPLEVELMAX;
+
+		if(target > level) {
+			lampPowerUp(target - level);
+		} else if(target < level) {
+			lampPowerDown(level - target);
+		}
+	}
+}
+#else
+void initHeadUnitLink()
+{
+}
+
+void headUnitUpdate(uint_fast16_t current, uint_fast16_t voltage, uint_fast32_t charge, uint_fast8_t level, uint_fast8_t flags)
+{
+}
+
+void headUnitPoll()
+{
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,33 @@
+#ifndef HEADUNITLINK_H_
+#define HEADUNITLINK_H_
+
+	#include "twi.h"
+
+	// Register mapped I2C slave (TWI_SLAVE) for a handlebar head unit sharing the bus with the MCP23008
+	// The head unit writes a register pointer and then either reads on from it or writes HEADUNITREG_LEVEL to set the
+	// brightness. The pointer auto-increments and reads beyond the map return 0xFF. Reads are served from a register
+	// image that the main loop rebuilds once a tick so the TWI interrupt only ever copies bytes out, multi-byte
+	// registers are little endian.
+
+	#ifndef HEADUNIT_ADDRESS
+		#define HEADUNIT_ADDRESS 0x30 // Clear of the MCP23008's 0x20 - 0x27
+	#endif
+
+	// Register map
+	#define HEADUNITREG_STATUS 0 // TELEMFLAG_.../TRACEWARN_... flags as in the telemetry status frame
+	#define HEADUNITREG_CURRENT 1 // 2 bytes
+	#define HEADUNITREG_VOLTAGE 3 // 2 bytes
+	#define HEADUNITREG_CHARGE 5 // Accumulated charge, 4 bytes
+	#define HEADUNITREG_LEVEL 9 // Brightness 0 - LAMPLEVELMAX, read/write
+	#define HEADUNITREG_FAULTLOG 10 // Sequence number of the newest fault log entry, FAULTLOGNONE while it's empty
+	#define HEADUNITREG_LASTTRIP 11 // TRACETRIP_... reason of that entry
+	#define HEADUNITREG_STACKFREE 12 // stackHeadroom(), saturates at 255
+	#define HEADUNITREG_I2CTIMEOUTS 13 // Bus recoveries after a timeout, the low byte of the count
+	#define HEADUNITREG_MCUENERGY 14 // energyMicroWattHours(), 2 bytes, zero unless built with ENERGY_ENABLE
+	#define HEADUNITREGS 16
+
+	void initHeadUnitLink();
+	void headUnitUpdate(uint_fast16_t current, uint_fast16_t voltage, uint_fast32_t charge, uint_fast8_t level, uint_fast8_t flags);
+	void headUnitPoll();
+
+#endif /* HEADUNITLINK_H_ */
\ No newline at end of file
@@ -0,0 +1,56 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include <stdint.h>
+#include <string.h>
+
+#include "ISRProfiler.h"
+
+#if ISRPROF_ENABLE
+struct ISRProfilerState isrProfilerState;
+
+void initISRProfiler()
+{
+	memset(&isrProfilerState, 0, sizeof(isrProfilerState));
+#if LAMPDIM_BACKEND == LAMPDIM_RHEOSTAT
+	PRR &= ~(1<<PRTIM0); // Power on Timer-0
+	TCCR0A = 0; // Normal mode
+	TCCR0B = (1<<CS01); // clk/8
+#endif
+}
+
+void isrProfilerRead(uint_fast8_t src, struct ISRProfile *profile)
+{
+	uint_fast8_t statReg = SREG;
+	uint_fast8_t worstHoldOff = 0;
+	uint_fast8_t periodic, held;
+
+	cli();
+		profile->count = isrProfilerState.src[src].count;
+		profile->maxTime = isrProfilerState.src[src].maxTime;
+		profile->avgTime = isrProfilerState.src[src].avgTime8 >> 3;
+		profile->maxLatency = isrProfilerState.src[src].maxLatency;
+		profile->maxHold = isrProfilerState.src[src].nested ? isrProfilerState.src[src].maxHold : isrProfilerState.src[src].maxTime;
+		periodic = isrProfilerState.src[src].periodic;
+		for(uint_fast8_t idx = 0; idx < ISRPROF_NSOURCES; idx++) {
+			held = isrProfilerState.src[idx].nested ? isrProfilerState.src[idx].maxHold : isrProfilerState.src[idx].maxTime;
+			if(idx != src && held > worstHoldOff) {
+				worstHoldOff = held;
+			}
+		}
+	SREG = statReg;
+
+	if(!periodic) { // Not measurable so report the bound
+		profile->maxLatency = worstHoldOff;
+	}
+}
+#else
+void initISRProfiler()
+{
+}
+
+void isrProfilerRead(uint_fast8_t src, struct ISRProfile *profile)
+{
+	memset(profile, 0, sizeof(*profile));
+}
+#endif
\ No newline at end of file
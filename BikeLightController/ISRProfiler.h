@@ -0,0 +1,127 @@
+#ifndef ISRPROFILER_H_
+#define ISRPROFILER_H_
+
+	// Per interrupt entry counts, execution times and entry latencies, timed against the free running Timer-0 count
+	// With the rheostat backend Timer-0 is otherwise unused and is run at clk/8 (1uS ticks at 8MHz), with a PWM backend
+	// the profiler reads the dimmer's clk/1 count instead. Either way times are 8 bit so anything longer than 256 ticks
+	// wraps. Latency can only be measured for sources with a fixed period (the free running ADC and the Timer-1
+	// overflow), it's how late each entry is against the quickest entry seen. For the others isrProfilerRead() reports
+	// the longest any profiled ISR held interrupts off as the bound on their latency, which for the nested handlers (see
+	// Hal.h) is up to their ISRPROF_UNMASK() rather than the whole time. ANALOG_COMP and INT0 never return so they only
+	// count. The table can be read with isrProfilerRead() or straight out of RAM over debugWIRE.
+
+	#ifndef ISRPROF_ENABLE
+		#define ISRPROF_ENABLE 0
+	#endif
+
+	#define ISRPROF_ADC 0
+	#define ISRPROF_TWI 1
+	#define ISRPROF_TIMER1OVF 2
+	#define ISRPROF_ANALOGCOMP 3
+	#define ISRPROF_INT0 4
+	#define ISRPROF_NSOURCES 5
+
+	struct ISRProfile {
+		uint16_t count; // Entries, saturates
+		uint8_t maxTime; // In ticks of ISRPROF_TICKCYCLES cycles
+		uint8_t avgTime; // Running average over roughly the last eight entries
+		uint8_t maxLatency;
+		uint8_t maxHold; // Longest with interrupts off, the whole time for the handlers that don't nest
+	};
+
+	void initISRProfiler();
+	void isrProfilerRead(uint_fast8_t src, struct ISRProfile *profile);
+
+#if ISRPROF_ENABLE
+	#include <avr/io.h>
+
+	#include "LampControl.h"
+
+	#if LAMPDIM_BACKEND == LAMPDIM_RHEOSTAT
+		#define ISRPROF_TICKCYCLES 8
+	#else
+		#define ISRPROF_TICKCYCLES 1
+	#endif
+
+	#define ISRPROF_TICKS(_cycles) ((uint8_t)((_cycles) / ISRPROF_TICKCYCLES)) // Periods only need to be right modulo 256 ticks
+
+	extern struct ISRProfilerState {
+		struct ISRProfilerSource {
+			uint16_t count;
+			uint16_t avgTime8; // Average scaled up by eight
+			uint8_t maxTime;
+			uint8_t maxLatency;
+			uint8_t maxHold; // Nested handlers only
+			uint8_t due; // Periodic sources only, the count the next entry is due at
+			uint8_t periodic;
+			uint8_t nested;
+		} src[ISRPROF_NSOURCES];
+	} isrProfilerState;
+
+	static inline uint8_t isrProfEnter(uint8_t src)
+	{
+		uint8_t tNow = TCNT0;
+		struct ISRProfilerSource *prof = isrProfilerState.src + src;
+
+		if(prof->count != 0xFFFF) {
+			prof->count++;
+		}
+
+		return tNow;
+	}
+
+	static inline uint8_t isrProfEnterPeriodic(uint8_t src, uint8_t period)
+	{
+		uint8_t tNow = isrProfEnter(src);
+		struct ISRProfilerSource *prof = isrProfilerState.src + src;
+		uint8_t late = tNow - prof->due;
+
+		if(!prof->periodic || (late & 0x80)) { // First entry, or earlier than any so far, either way it's the new reference
+			prof->periodic = 1;
+			prof->due = tNow;
+		} else if(late > prof->maxLatency) {
+			prof->maxLatency = late;
+		}
+		prof->due += period;
+
+		return tNow;
+	}
+
+	static inline void isrProfUnmask(uint8_t src, uint8_t tEntry)
+	{
+		uint8_t tHeld = TCNT0 - tEntry;
+		struct ISRProfilerSource *prof = isrProfilerState.src + src;
+
+		if(tHeld > prof->maxHold) {
+			prof->maxHold = tHeld;
+		}
+		prof->nested = 1;
+	}
+
+	static inline void isrProfExit(uint8_t src, uint8_t tEntry)
+	{
+		uint8_t tTaken = TCNT0 - tEntry;
+		struct ISRProfilerSource *prof = isrProfilerState.src + src;
+
+		if(tTaken > prof->maxTime) {
+			prof->maxTime = tTaken;
+		}
+		prof->avgTime8 = prof->avgTime8 - (prof->avgTime8 >> 3) + tTaken;
+	}
+
+	#define ISRPROF_ENTER(_src) uint8_t isrProfEntry = isrProfEnter(_src)
+	#define ISRPROF_ENTERPERIODIC(_src, _periodCycles) uint8_t isrProfEntry = isrProfEnterPeriodic(_src, ISRPROF_TICKS(_periodCycles))
+	#define ISRPROF_UNMASK(_src) isrProfUnmask(_src, isrProfEntry) // Straight after a nested handler's sei()
+	#define ISRPROF_EXIT(_src) isrProfExit(_src, isrProfEntry)
+	#define ISRPROF_COUNT(_src) ((void)isrProfEnter(_src)) // For the ISRs that never return
+	#define ISRPROF_RESYNC(_src) (isrProfilerState.src[_src].periodic = 0) // The period restarted at an unrelated phase
+#else
+	#define ISRPROF_ENTER(_src)
+	#define ISRPROF_ENTERPERIODIC(_src, _periodCycles)
+	#define ISRPROF_UNMASK(_src)
+	#define ISRPROF_EXIT(_src)
+	#define ISRPROF_COUNT(_src)
+	#define ISRPROF_RESYNC(_src)
+#endif
+
+#endif /* ISRPROFILER_H_ */
\ No newline at end of file
@@ -1,7 +1,19 @@
+#include <avr/wdt.h>
+#include <avr/pgmspace.h>
+
 #include <stdint.h>
 
+#include "Benchmark.h"
+#include "Clock.h"
 #include "TimerServices.h"
+#include "ADCReader.h"
 #include "LampControl.h"
+#include "LampWiper.h"
+#include "PWMDimmer.h"
+#include "PatternSequencer.h"
+#include "EventTrace.h"
+#include "Units.h"
+#include "Telemetry.h"
 #include "twi.h"
 
 #define IODIR ((uint_fast8_t)0x00)
@@ -16,9 +28,9 @@
 #define GPIO ((uint_fast8_t)0x09)
 #define OLAT ((uint_fast8_t)0x0A)
 
-#define MCP23008ADDR ((uint_fast8_t)0b00100000)
-#define MCP23008NCS ((uint_fast8_t)0b00010000)
-#define MCP23008UD ((uint_fast8_t)0b00100000)
+#define MCP23008ADDR ((uint_fast8_t)0b00100000) // A2..A0 low, the scan carries on through the seven after it
+#define MCP23008NADDR 8
+#define MCP23008SEQOP ((uint_fast8_t)0b00100000) // IOCON byte mode, the address pointer stays on the register last addressed
 
 #define LAMPONOFF 0b00000010
 #define LAMPUP 0b00000100
@@ -26,31 +38,117 @@
 
 #define LEDLAMPINITIAL (((uint_fast8_t)0b00000001) | MCP23008NCS) // LED and lamp off initially; nCS pin high U/nD low
 
+#define ALLLAMPS ((uint_fast8_t)((1 << LAMP_MAXLAMPS) - 1))
+#define NOPOINTER ((uint_fast8_t)0xFF)
+
+#if (LAMPVERIFY_ENABLE || LAMPVERIFY_CALIBRATE) && LAMPDIM_BACKEND == LAMPDIM_RHEOSTAT && LAMPWIPER_BACKEND == LAMPWIPER_UPDOWN
+	#define VERIFYWIPER 1
+	#if !ADC_HIRES
+		#error "The wiper verification reads the current with ADC_HIRES"
+	#endif
+	#if LAMPVERIFY_CALIBRATE && !TELEMETRY_ENABLE
+		#error "LAMPVERIFY_CALIBRATE reports over the telemetry"
+	#endif
+	#define HIRESSHIFT (ADC_HIRESBITS - 10)
+	#define HIRESTOMA(_reading) (((uint_fast32_t)(_reading) * UNITS_MAPERCOUNT_Q8 + (1 << (7 + HIRESSHIFT))) >> (8 + HIRESSHIFT))
+	#define NOISEMA HIRESTOMA(LAMPVERIFY_NOISE)
+#else
+	#define VERIFYWIPER 0 // The PWM backends' current isn't the wiper's alone and the digital pot can't drift
+#endif
+
+// LampDriver.wiper
+#define WIPERTRUSTED 0x01 // The count is where the wiper is
+#define WIPERCHECKED 0x02 // tVerified is the last check rather than a move
+#define WIPERRESYNCED 0x04 // By a measurement that disagreed, the next one says whether the curve fits
+#define WIPERDUE 0x08 // A check is due, waiting on a hi-res window opened since
+
+// See LampControl.h, the lamp driver's own draw is in there too and it's most of the bottom figure
+static const uint16_t lampCurve[] PROGMEM = {LAMPCURVE_MA};
+
+_Static_assert(sizeof(lampCurve) / sizeof(lampCurve[0]) == LAMPCURVEPOINTS, "LAMPCURVE_MA needs a point every 1 << LAMPCURVESHIFT levels and one past the top");
+
+#if LAMP_MAXLAMPS < 1 || LAMP_MAXLAMPS > MCP23008NADDR
+	#error "LAMP_MAXLAMPS must be 1 to 8, one for each MCP23008 address"
+#endif
+#if LAMP_MAXLAMPS > 1 && LAMPDIM_BACKEND != LAMPDIM_RHEOSTAT
+	#error "The PWM backends have a single Timer-0 output, so a single lamp"
+#endif
+
 static struct {
-	enum LightState {
-		Off = 0,
-		On = 1
-	} ledState, lampState;
-	uint_fast8_t cRegVal;
-	uint_fast8_t rheostatState;
-} driverState = {Off, Off, 0, 0};
-
-static uint_fast8_t processBits(uint_fast8_t pinVals, uint_fast32_t *tLast);
-static uint_fast8_t sendRegByte(uint_fast8_t regAddr, uint_fast8_t regVal);
-static uint_fast8_t sendOLAT(uint_fast8_t regVal);
-static uint_fast8_t readRegs(uint_fast8_t regAddr, uint_fast8_t nBytes, uint8_t *bOut);
+	struct LampDriver {
+		enum LightState {
+			Off = 0,
+			On = 1
+		} ledState, lampState;
+		uint_fast8_t cRegVal;
+		uint_fast8_t rheostatState; // With the PWM backend this is the virtual level rather than the wiper position
+		uint_fast8_t address;
+		uint_fast8_t pointer; // Register the expander's address pointer was left on, NOPOINTER if not known
+		uint_fast32_t tLast; // getTicks() at the last level change from this lamp's buttons
+#if VERIFYWIPER
+		uint_fast32_t tVerified; // getTicks() at the last rheostat move (whatever asked for it) or check of the current
+		uint_fast8_t wiper; // WIPER... flags
+		uint_fast8_t window; // adcHiResWindows() as the check came due
+#endif
+#if TRACE_ENABLE
+		uint_fast8_t tracedButtons;
+		uint_fast8_t tracedLevel;
+#endif
+	} lamp[LAMP_MAXLAMPS];
+	uint_fast8_t nLamps;
+	uint_fast8_t pollIdx; // The lamp testLampState() reads next
+	uint_fast8_t onLevel; // Where a turn on takes the rheostat
+	uint16_t twiTimeouts; // Bus recoveries already acted on
+	uint_fast32_t tChecked; // getTicks() at the last read back of the expanders' IOCON
+#if VERIFYWIPER
+	uint_fast8_t curveMisfit; // Measured against the curve straight after a resync and still out, see LampControl.h
+#endif
+} driverState;
+
+static void findLamps(void);
+static uint_fast8_t restore23008(struct LampDriver *lamp);
+static uint_fast8_t busRecovered(void);
+static uint_fast8_t processBits(struct LampDriver *lamp, uint_fast8_t pinVals);
+static void levelDown(uint_fast8_t lampMask, uint_fast8_t nSteps);
+static void levelUp(uint_fast8_t lampMask, uint_fast8_t nSteps);
+static void levelReset(struct LampDriver *lamp);
+#if VERIFYWIPER
+static void verifyWiper(struct LampDriver *lamp);
+static uint_fast8_t verifyDue(struct LampDriver *lamp, uint_fast32_t tNow);
+static uint_fast16_t curveTolerance(uint_fast8_t level, uint_fast16_t expected);
+#if LAMPVERIFY_CALIBRATE
+static void reportCurve(struct LampDriver *lamp, uint_fast16_t measured, uint_fast16_t reading);
+#endif
+#endif
+#if TRACE_ENABLE
+static void traceButtons(struct LampDriver *lamp, uint_fast8_t pinVals);
+static void traceLevel(uint_fast8_t lampMask);
+#endif
+#if LAMPDIM_BACKEND == LAMPDIM_PWM
+static void applyLevel(void);
+static uint_fast8_t levelToDuty(uint_fast8_t level);
+#endif
+static uint_fast8_t sendRegBytes(struct LampDriver *lamp, uint_fast8_t regAddr, const uint8_t *regVals, uint_fast8_t nBytes);
+static uint_fast8_t sendRegByte(struct LampDriver *lamp, uint_fast8_t regAddr, uint_fast8_t regVal);
+static uint_fast8_t sendOLAT(struct LampDriver *lamp, uint_fast8_t regVal);
+static uint_fast8_t readRegs(struct LampDriver *lamp, uint_fast8_t regAddr, uint_fast8_t nBytes, uint8_t *bOut);
 
 uint_fast8_t shortInit23008(void)
 {
-	uint_fast8_t rVal;
+	uint_fast8_t rVal = 0;
+	uint_fast8_t idx;
 
-	driverState.cRegVal = LEDLAMPINITIAL;
-	driverState.ledState = Off;
-	driverState.lampState = Off;
+	for(idx = 0; idx < driverState.nLamps; idx++) {
+		struct LampDriver *lamp = driverState.lamp + idx;
 
-	rVal = sendOLAT(driverState.cRegVal);
-	rVal |= sendRegByte(IODIR, 0b01001110); // Switches to inputs, unused line to input
-	rVal |= sendRegByte(GPPU, 0b00001110); // Use built in pullups on switches
+		lamp->cRegVal = LEDLAMPINITIAL;
+		lamp->ledState = Off;
+		lamp->lampState = Off;
+
+		rVal |= sendOLAT(lamp, lamp->cRegVal);
+		rVal |= sendRegByte(lamp, IODIR, 0b01001110); // Switches to inputs, unused line to input
+		rVal |= sendRegByte(lamp, GPPU, 0b00001110); // Use built in pullups on switches
+	}
 
 	return rVal;
 }
@@ -59,129 +157,552 @@ void fullInit23008(void)
 {
 	uint_fast8_t rVal;
 	uint_fast8_t intRegVal;
-
-	rVal = sendRegByte(IOCON, 0b00000000);
-	rVal |= shortInit23008();
-
-	rVal |= sendRegByte(GPINTEN, 0b00001110); // Enable interrupts
-	rVal |= sendRegByte(DEFVAL, 0b00001110); // This is the uninterrupted level
-	rVal |= sendRegByte(INTCON, 0b00001110); // These lines honour the DEFVAL register
-	rVal |= readRegs(INTCAP, 1, &intRegVal); // Clear the interrupt state
+	uint_fast8_t idx;
+	struct twi_counters twiCount;
+
+	findLamps(); // Leaves them in byte mode
+	driverState.onLevel = 1;
+#if VERIFYWIPER
+	driverState.curveMisfit = 0;
+#endif
+	rVal = shortInit23008();
+
+	for(idx = 0; idx < driverState.nLamps; idx++) {
+		struct LampDriver *lamp = driverState.lamp + idx;
+
+		rVal |= sendRegByte(lamp, GPINTEN, 0b00001110); // Enable interrupts
+		rVal |= sendRegByte(lamp, DEFVAL, 0b00001110); // This is the uninterrupted level
+		rVal |= sendRegByte(lamp, INTCON, 0b00001110); // These lines honour the DEFVAL register
+		rVal |= readRegs(lamp, INTCAP, 1, &intRegVal); // Clear the interrupt state
+		lamp->tLast = getTicks();
+	}
+	twi_getCounters(&twiCount);
+	driverState.twiTimeouts = twiCount.timeouts; // Anything up to here has been set up from scratch anyway
+
+#if LAMPDIM_BACKEND == LAMPDIM_PWM
+	clockHold(CLOCKHOLD_LAMP);
+	wdt_reset();
+	wiperResync(0, LAMPLEVELMAX, LAMPRESYNCSTEPS); // Park the wiper at full travel, from here on the PWM duty alone sets the brightness
+	clockRelease(CLOCKHOLD_LAMP);
+	driverState.lamp[0].rheostatState = 0;
+#elif LAMPDIM_BACKEND == LAMPDIM_BLEND
+	pwmDimSet(PWMDIMMAX); // No trim to start with
+#endif
 }
 
-void testLampState(uint_fast32_t *tLast)
+void testLampState(void)
 {
-	uint_fast8_t intRegVal;
+	struct LampDriver *lamp = driverState.lamp + driverState.pollIdx;
+	uint_fast8_t lampBit = 1 << driverState.pollIdx;
+	uint_fast8_t intRegVal = 0;
 	uint_fast8_t update = 0;
 
-	readRegs(INTF, 1, &intRegVal);
-	if(intRegVal != 0x0) {
-		struct {
-			uint_fast8_t intCap;
-			uint_fast8_t gpioNow;
-		} regVals;
+	if(busRecovered()) { // The bus was stuck and has been freed, an expander that held it may have reset
+		struct twi_counters twiCount;
+
+		twi_getCounters(&twiCount);
+		driverState.twiTimeouts = twiCount.timeouts;
+		for(uint_fast8_t idx = 0; idx < driverState.nLamps; idx++) {
+#if VERIFYWIPER
+			driverState.lamp[idx].wiper &= ~WIPERTRUSTED; // A reset expander may have glitched nCS on the way
+#endif
+			if(restore23008(driverState.lamp + idx)) {
+				break; // Any timeout there brings it back here next pass
+			}
+		}
+	}
+	if((getTicks() - driverState.tChecked) > TIMER1TICKS(LAMP_CHECKMS)) { // A brown-out resets an expander without a bus timeout, only IOCON shows it
+		driverState.tChecked = getTicks();
+		for(uint_fast8_t idx = 0; idx < driverState.nLamps; idx++) {
+			struct LampDriver *checked = driverState.lamp + idx;
+			uint8_t iocon = MCP23008SEQOP; // A failed read isn't taken as a reset
+
+			checked->pointer = NOPOINTER; // Write the address, a reset expander's pointer isn't where it's cached
+			if(readRegs(checked, IOCON, 1, &iocon) == 0 && iocon != MCP23008SEQOP) { // Reset to sequential mode, or just come up
+#if VERIFYWIPER
+				checked->wiper &= ~WIPERTRUSTED;
+#endif
+				restore23008(checked);
+			}
+		}
+	}
 
-		readRegs(INTCAP, 2, (uint_fast8_t*)&regVals);
+	driverState.pollIdx = driverState.pollIdx + 1 < driverState.nLamps ? driverState.pollIdx + 1 : 0; // One lamp a pass so that more lamps don't lengthen it
+
+	readRegs(lamp, INTF, 1, &intRegVal); // Byte mode, so just the read once the pointer is on INTF
+	if(busRecovered()) {
+		return; // What was read may be from an expander that has just reset, leave it all to the next pass
+	}
+	if(intRegVal != 0x0) {
+		adcFullRate(); // Whatever the buttons do next the current is likely to follow
+		uint_fast8_t intCap = 0;
+		uint_fast8_t gpioNow = 0;
+
+		readRegs(lamp, INTCAP, 1, &intCap);
+		readRegs(lamp, GPIO, 1, &gpioNow);
+		if(busRecovered()) {
+			return;
+		}
+#if TRACE_ENABLE
+		traceButtons(lamp, intCap);
+#endif
 
-		update = processBits(regVals.intCap, tLast);
+		update = processBits(lamp, intCap);
 
-		if(regVals.intCap != regVals.gpioNow) {
-			update |= processBits(regVals.gpioNow, tLast);
+		if(intCap != gpioNow) {
+			update |= processBits(lamp, gpioNow);
 		}
+#if TRACE_ENABLE
+	} else {
+		traceButtons(lamp, LAMPONOFF | LAMPUP | LAMPDOWN); // The interrupt stays asserted while anything is held so they're all released
+#endif
 	}
-	if((getTime() - *tLast) > 1000) { // Large change since last power level change (>1s), this ensures that we don't accidently turn the lamp on or off
-		if(driverState.lampState == Off && driverState.rheostatState > 0) {
-			lampPowerDown(96); // Make sure the rheostat starts off in a known state (lowest power)
-		} else if(driverState.lampState == On && driverState.rheostatState == 0) {
-			lampPowerUp(1); // Make sure we're not in the lowest power state anymore
+	if((getTicks() - lamp->tLast) > TIMER1TICKS(1000)) { // Large change since last power level change (>1s), this ensures that we don't accidently turn the lamp on or off
+		if(lamp->lampState == Off && lamp->rheostatState > 0) {
+			levelReset(lamp);
+		} else if(lamp->lampState == On && lamp->rheostatState == 0) {
+			levelUp(lampBit, 1); // Make sure we're not in the lowest power state anymore
 		}
 	}
-	if(((getTime() - *tLast) > 10000) && (driverState.lampState==Off)) {
+#if VERIFYWIPER
+	verifyWiper(lamp);
+#endif
+	if(((getTicks() - lamp->tLast) > TIMER1TICKS(10000)) && (lamp->lampState==Off)) {
 		// return...
 	}
 
 	if(update) {
-		driverState.cRegVal = MCP23008NCS; // nCS high initially
-		driverState.cRegVal |= driverState.lampState==On ? 0b10000000 : 0b00000000;
-		driverState.cRegVal |= driverState.ledState==On ? 0b0: 0b1;
+		lamp->cRegVal = MCP23008NCS; // nCS high initially
+		lamp->cRegVal |= lamp->lampState==On ? 0b10000000 : 0b00000000;
+		lamp->cRegVal |= lamp->ledState==On ? 0b0: 0b1;
 	
-		sendOLAT(driverState.cRegVal);
+		sendOLAT(lamp, lamp->cRegVal);
 	}
 }
 
+uint_fast8_t lampCount(void)
+{
+	return driverState.nLamps;
+}
+
+#if LAMPWIPER_BACKEND == LAMPWIPER_UPDOWN
+uint_fast8_t lampExpanderOLAT(uint_fast8_t lampIdx)
+{
+	return driverState.lamp[lampIdx].cRegVal;
+}
+
+uint_fast8_t lampExpanderWrite(uint_fast8_t lampIdx, const uint8_t *olatSeq, uint_fast8_t nBytes)
+{
+	return sendRegBytes(driverState.lamp + lampIdx, OLAT, olatSeq, nBytes); // Byte mode keeps every one of them on OLAT
+}
+#endif
+
 void lampPowerDown(uint_fast8_t nSteps)
 {
-	uint_fast8_t rVal;
-	uint_fast8_t localReg;
+	levelDown(ALLLAMPS, nSteps);
+}
+
+void lampPowerUp(uint_fast8_t nSteps)
+{
+	levelUp(ALLLAMPS, nSteps);
+}
 
-	for(; nSteps != 0; --nSteps) {
-		localReg = driverState.cRegVal | MCP23008NCS | MCP23008UD;
+uint_fast8_t lampGetLevel(void)
+{
+	return driverState.lamp[0].rheostatState;
+}
 
-		rVal = sendOLAT(localReg); // nCS and U/nD high
+uint_fast8_t lampIsOn(void)
+{
+	return driverState.lamp[0].lampState == On;
+}
 
-		localReg &= ~MCP23008NCS;
+void lampResume(uint_fast8_t level, uint_fast8_t on)
+{
+	uint_fast8_t idx;
+
+	lampPowerUp(level);
+	for(idx = 0; idx < driverState.nLamps; idx++) {
+		struct LampDriver *lamp = driverState.lamp + idx;
+
+		if(on && lamp->rheostatState > 0) {
+			lamp->lampState = On;
+			TRACE_EVENT(TRACE_LAMP, TRACELAMP(idx) | 1);
+			lamp->cRegVal |= 0b10000000;
+			sendOLAT(lamp, lamp->cRegVal);
+		}
+	}
+}
 
-		rVal |= sendOLAT(localReg); // U/nD high, nCS low
+void lampSetOnLevel(uint_fast8_t level)
+{
+	driverState.onLevel = level < 1 ? 1 : level > LAMPLEVELMAX ? LAMPLEVELMAX : level;
+}
 
-		localReg &= ~MCP23008UD;
+uint_fast16_t lampCurveCurrent(uint_fast8_t level)
+{
+	uint_fast8_t idx = level >> LAMPCURVESHIFT;
+	uint_fast16_t below = pgm_read_word(&lampCurve[idx]);
+	uint_fast16_t above = pgm_read_word(&lampCurve[idx + 1]);
+	uint_fast8_t frac = level & ((1 << LAMPCURVESHIFT) - 1);
 
-		rVal |= sendOLAT(localReg); // nCS and U/nD low
+	return below + (((above - below) * frac + (1 << (LAMPCURVESHIFT - 1))) >> LAMPCURVESHIFT);
+}
 
-		localReg |= MCP23008UD;
+#if LAMPDIM_BACKEND == LAMPDIM_BLEND
+void lampSetTrim(uint_fast8_t duty)
+{
+	pwmDimSet(duty);
+}
 
-		rVal |= sendOLAT(localReg); // nCS low and U/nD high
+uint_fast8_t lampGetTrim(void)
+{
+	return pwmDimGet();
+}
+#endif
 
-		rVal |= sendOLAT(driverState.cRegVal); // nCS high and U/nD low (default)
+static void findLamps(void)
+{
+	uint8_t i2cBuffer[TWI_BUFFER_LENGTH];
+	uint_fast8_t address;
+
+	driverState.nLamps = 0;
+	driverState.pollIdx = 0;
+	for(address = MCP23008ADDR; address < MCP23008ADDR + MCP23008NADDR && driverState.nLamps < LAMP_MAXLAMPS; address++) {
+		struct LampDriver *lamp = driverState.lamp + driverState.nLamps;
+
+		i2cBuffer[0] = IOCON;
+		i2cBuffer[1] = MCP23008SEQOP;
+		if(twi_writeTo(address, i2cBuffer, sizeof(uint8_t) * 2, (uint8_t)1, (uint8_t)1) == 0) { // Anything that acks gets byte mode, an empty address isn't an error
+			lamp->address = address;
+			lamp->pointer = IOCON;
+			lamp->rheostatState = 0;
+			wiperInit(driverState.nLamps);
+#if VERIFYWIPER
+			lamp->wiper = 0; // Wherever it powered up, until the boot's sweep
+#endif
+#if TRACE_ENABLE
+			lamp->tracedButtons = LAMPONOFF | LAMPUP | LAMPDOWN;
+			lamp->tracedLevel = 0;
+#endif
+			driverState.nLamps++;
+		}
+	}
 
-		driverState.rheostatState -= driverState.rheostatState > 0 ? 1 : 0;
+	if(driverState.nLamps == 0) { // Nothing answered, carry on at the first address in case the lamp comes up later
+		driverState.lamp[0].address = MCP23008ADDR;
+		driverState.lamp[0].pointer = NOPOINTER;
+		driverState.lamp[0].rheostatState = 0;
+		wiperInit(0);
+#if VERIFYWIPER
+		driverState.lamp[0].wiper = 0;
+#endif
+#if TRACE_ENABLE
+		driverState.lamp[0].tracedButtons = LAMPONOFF | LAMPUP | LAMPDOWN;
+		driverState.lamp[0].tracedLevel = 0;
+#endif
+		driverState.nLamps = 1;
 	}
 }
 
-void lampPowerUp(uint_fast8_t nSteps)
+static uint_fast8_t busRecovered(void)
 {
-	uint_fast8_t rVal;
-	uint_fast8_t localReg;
+	struct twi_counters twiCount;
+
+	twi_getCounters(&twiCount);
+	return twiCount.timeouts != driverState.twiTimeouts;
+}
+
+static uint_fast8_t restore23008(struct LampDriver *lamp)
+{
+	uint8_t intRegVal;
+
+	// As fullInit23008() left it but with the outputs as they are now so the lamp stays as it was. Stops at the first
+	// failure, a bus that's still stuck costs a timeout a transaction
+	lamp->pointer = NOPOINTER;
+	return sendRegByte(lamp, IOCON, MCP23008SEQOP) || // Byte mode first, a reset leaves it sequential
+		sendOLAT(lamp, lamp->cRegVal) ||
+		sendRegByte(lamp, IODIR, 0b01001110) ||
+		sendRegByte(lamp, GPPU, 0b00001110) ||
+		sendRegByte(lamp, GPINTEN, 0b00001110) ||
+		sendRegByte(lamp, DEFVAL, 0b00001110) ||
+		sendRegByte(lamp, INTCON, 0b00001110) ||
+		readRegs(lamp, INTCAP, 1, &intRegVal);
+}
+
+static void levelDown(uint_fast8_t lampMask, uint_fast8_t nSteps)
+{
+#if LAMPDIM_BACKEND == LAMPDIM_PWM
+	struct LampDriver *lamp = driverState.lamp;
+
+	lamp->rheostatState -= nSteps < lamp->rheostatState ? nSteps : lamp->rheostatState;
+	applyLevel();
+#else
+	uint_fast8_t idx;
+
+	BENCH_BEGIN(BENCH_LAMPLEVEL);
+	clockHold(CLOCKHOLD_LAMP); // Each byte on the bus waits on the TWI interrupt
+	adcFullRate();
+	for(idx = 0; idx < driverState.nLamps; idx++) {
+		struct LampDriver *lamp = driverState.lamp + idx;
+
+		if(!(lampMask & (1 << idx))) {
+			continue;
+		}
+
+		wdt_reset(); // A sweep a lamp, see LampWiper.h
+		if(nSteps > lamp->rheostatState) { // Past the bottom, make sure it's there whatever the count says
+#if VERIFYWIPER
+			if(wiperResync(idx, 0, nSteps) && nSteps - lamp->rheostatState >= LAMPRESYNCSTEPS) {
+				lamp->wiper |= WIPERTRUSTED; // Into the end stop from anywhere
+			}
+#else
+			wiperResync(idx, 0, nSteps);
+#endif
+		} else {
+			wiperSet(idx, lamp->rheostatState - nSteps);
+		}
+		lamp->rheostatState = wiperGet(idx);
+#if VERIFYWIPER
+		lamp->tVerified = getTicks();
+		lamp->wiper &= ~(WIPERCHECKED | WIPERRESYNCED | WIPERDUE);
+#endif
+	}
+	clockRelease(CLOCKHOLD_LAMP);
+	BENCH_END(BENCH_LAMPLEVEL);
+#endif
+#if TRACE_ENABLE
+	traceLevel(lampMask);
+#endif
+}
+
+static void levelUp(uint_fast8_t lampMask, uint_fast8_t nSteps)
+{
+#if LAMPDIM_BACKEND == LAMPDIM_PWM
+	struct LampDriver *lamp = driverState.lamp;
+
+	lamp->rheostatState += nSteps < (LAMPLEVELMAX - lamp->rheostatState) ? nSteps : (LAMPLEVELMAX - lamp->rheostatState);
+	applyLevel();
+#else
+	uint_fast8_t idx;
+
+	BENCH_BEGIN(BENCH_LAMPLEVEL);
+	clockHold(CLOCKHOLD_LAMP);
+	adcFullRate();
+	for(idx = 0; idx < driverState.nLamps; idx++) {
+		struct LampDriver *lamp = driverState.lamp + idx;
+
+		if(!(lampMask & (1 << idx))) {
+			continue;
+		}
+
+		wdt_reset();
+		wiperSet(idx, nSteps < (LAMPLEVELMAX - lamp->rheostatState) ? lamp->rheostatState + nSteps : LAMPLEVELMAX);
+		lamp->rheostatState = wiperGet(idx);
+#if VERIFYWIPER
+		lamp->tVerified = getTicks();
+		lamp->wiper &= ~(WIPERCHECKED | WIPERRESYNCED | WIPERDUE);
+#endif
+	}
+	clockRelease(CLOCKHOLD_LAMP);
+	BENCH_END(BENCH_LAMPLEVEL);
+#endif
+#if TRACE_ENABLE
+	traceLevel(lampMask);
+#endif
+}
+
+static void levelReset(struct LampDriver *lamp)
+{
+	uint_fast8_t lampBit = 1 << (lamp - driverState.lamp);
+
+#if VERIFYWIPER
+	if((lamp->wiper & WIPERTRUSTED) && !driverState.curveMisfit) {
+		if(lamp->rheostatState > 0) {
+			levelDown(lampBit, lamp->rheostatState); // Straight there, the count is good
+		}
+		return;
+	}
+#endif
+	levelDown(lampBit, LAMPRESYNCSTEPS); // Make sure the rheostat starts off in a known state (lowest power)
+}
+
+#if VERIFYWIPER
+static void verifyWiper(struct LampDriver *lamp)
+{
+	uint_fast32_t tNow = getTicks();
+	uint_fast16_t reading, measured, expected, tolerance;
+	uint_fast8_t idx, swept;
+
+	if(!verifyDue(lamp, tNow)) {
+		lamp->wiper &= ~WIPERDUE;
+		return;
+	}
+	if(!(lamp->wiper & WIPERDUE)) { // Anything read until now may have been before it settled
+		lamp->wiper |= WIPERDUE;
+		lamp->window = adcHiResWindows();
+		return;
+	}
+	if(adcHiResWindows() == lamp->window) {
+		return;
+	}
+
+	lamp->tVerified = tNow;
+	lamp->wiper = (lamp->wiper | WIPERCHECKED) & ~WIPERDUE;
+	reading = getADCHiResCurrentReading();
+	measured = HIRESTOMA(reading);
+#if LAMPVERIFY_CALIBRATE
+	reportCurve(lamp, measured, reading);
+	return; // Nothing to compare with yet
+#endif
+	expected = lampCurveCurrent(lamp->rheostatState);
+	tolerance = curveTolerance(lamp->rheostatState, expected);
+	if(measured + tolerance >= expected && measured <= expected + tolerance) {
+		if(tolerance >= NOISEMA) { // The neighbouring levels would have read differently
+			lamp->wiper |= WIPERTRUSTED;
+		}
+		lamp->wiper &= ~WIPERRESYNCED;
+		return;
+	}
+	tolerance += NOISEMA;
+	if(measured + tolerance >= expected && measured <= expected + tolerance) {
+		return; // Can't say either way
+	}
+	if(lamp->wiper & WIPERRESYNCED) { // Out at a level the wiper was just swept to, it's the curve that's wrong
+		driverState.curveMisfit = 1;
+		return;
+	}
+
+	idx = lamp - driverState.lamp;
+	clockHold(CLOCKHOLD_LAMP);
+	adcFullRate();
+	wdt_reset();
+	swept = wiperResync(idx, lamp->rheostatState, LAMPRESYNCSTEPS); // Down into the end stop and back up to the level
+	lamp->rheostatState = wiperGet(idx);
+	clockRelease(CLOCKHOLD_LAMP);
+	lamp->tVerified = getTicks();
+	lamp->wiper = swept ? WIPERTRUSTED | WIPERRESYNCED : 0; // Measured again once it's settled, or swept again once the bus is back
+#if TRACE_ENABLE
+	traceLevel(1 << idx);
+#endif
+}
+
+static uint_fast8_t verifyDue(struct LampDriver *lamp, uint_fast32_t tNow)
+{
+	uint_fast8_t idx;
+
+	if(lamp->lampState != On || driverState.curveMisfit || (tNow - lamp->tLast) < TIMER1TICKS(LAMPVERIFY_SETTLEMS) ||
+		(tNow - lamp->tVerified) < (lamp->wiper & WIPERCHECKED ? TIMER1TICKS(LAMPVERIFY_PERIODMS) : TIMER1TICKS(LAMPVERIFY_SETTLEMS))) {
+		return 0;
+	}
+#if PATTERN_ENABLE
+	if(currentPattern() != PATTERNSTEADY) { // Flashing through the lamp's reset line
+		return 0;
+	}
+#endif
+	for(idx = 0; idx < driverState.nLamps; idx++) {
+		if(driverState.lamp + idx != lamp && driverState.lamp[idx].lampState == On) {
+			return 0; // Its current is in the reading too
+		}
+	}
+
+	return 1;
+}
+
+static uint_fast16_t curveTolerance(uint_fast8_t level, uint_fast16_t expected) // Half the smaller step to a neighbouring level, mA
+{
+	uint_fast16_t step = 0xFFFF;
 
-	for(; nSteps != 0; --nSteps) {
-		localReg = driverState.cRegVal & ~MCP23008NCS;
+	if(level > 0) {
+		step = expected - lampCurveCurrent(level - 1);
+	}
+	if(level < LAMPLEVELMAX && lampCurveCurrent(level + 1) - expected < step) {
+		step = lampCurveCurrent(level + 1) - expected;
+	}
 
-		rVal = sendOLAT(localReg); // nCS low and U/nD low
+	return step >> 1;
+}
 
-		localReg |= MCP23008UD;
+#if LAMPVERIFY_CALIBRATE
+static void reportCurve(struct LampDriver *lamp, uint_fast16_t measured, uint_fast16_t reading)
+{
+	uint8_t frame[TELEMETRYCURVELENGTH];
+
+	frame[0] = lamp->rheostatState;
+	frame[1] = lamp->wiper & WIPERTRUSTED;
+	frame[2] = measured;
+	frame[3] = measured >> 8;
+	frame[4] = reading;
+	frame[5] = reading >> 8;
+	telemetrySend(TELEMETRY_CURVE, frame, TELEMETRYCURVELENGTH);
+}
+#endif
+#endif
+
+#if TRACE_ENABLE
+static void traceButtons(struct LampDriver *lamp, uint_fast8_t pinVals)
+{
+	pinVals &= LAMPONOFF | LAMPUP | LAMPDOWN;
+	if(pinVals != lamp->tracedButtons) { // Only the changes, a held button is seen on every pass
+		lamp->tracedButtons = pinVals;
+		TRACE_EVENT(TRACE_BUTTONS, TRACELAMP(lamp - driverState.lamp) | pinVals);
+	}
+}
 
-		rVal |= sendOLAT(localReg); // nCS low and U/nD high
+static void traceLevel(uint_fast8_t lampMask)
+{
+	uint_fast8_t idx;
 
-		rVal |= sendOLAT(driverState.cRegVal); // nCS high and U/nD low (default)
+	for(idx = 0; idx < driverState.nLamps; idx++) {
+		struct LampDriver *lamp = driverState.lamp + idx;
 
-		driverState.rheostatState += driverState.rheostatState < 31 ? 1 : 0;
+		if((lampMask & (1 << idx)) && lamp->rheostatState != lamp->tracedLevel) { // Holding a button at an end stop keeps asking for steps that go nowhere
+			lamp->tracedLevel = lamp->rheostatState;
+			TRACE_EVENT(TRACE_RHEOSTAT, TRACELAMP(idx) | lamp->tracedLevel);
+		}
 	}
 }
+#endif
 
-static uint_fast8_t processBits(uint_fast8_t pinVals, uint_fast32_t *tLast)
+static uint_fast8_t processBits(struct LampDriver *lamp, uint_fast8_t pinVals)
 {
-	uint_fast32_t tNow = getTime();
+	uint_fast32_t tNow = getTicks();
+	uint_fast8_t lampBit = 1 << (lamp - driverState.lamp);
 
 	if((pinVals & LAMPONOFF) == 0) {
-		if(driverState.lampState == Off && driverState.rheostatState > 0) {
-			driverState.lampState = On;
-			lampPowerDown(96); // Make sure the rheostat starts off in a known state (lowest power)
-			lampPowerUp(1);
-			*tLast = tNow;
+		if(lamp->lampState == Off && lamp->rheostatState > 0) {
+			lamp->lampState = On;
+			TRACE_EVENT(TRACE_LAMP, TRACELAMP(lamp - driverState.lamp) | 1);
+			levelReset(lamp);
+			levelUp(lampBit, driverState.onLevel);
+			lamp->tLast = tNow;
 			return 1;
-		} if(driverState.lampState == On && driverState.rheostatState == 0) {
-			driverState.lampState = Off;
-			lampPowerDown(96); // Make sure the rheostat starts off in a known state (lowest power)
-			*tLast = tNow;
+		} if(lamp->lampState == On && lamp->rheostatState == 0) {
+			lamp->lampState = Off;
+			TRACE_EVENT(TRACE_LAMP, TRACELAMP(lamp - driverState.lamp) | 0);
+			levelReset(lamp);
+			lamp->tLast = tNow;
 			return 1;
 		}
+#if PATTERN_ENABLE
+	} else if((pinVals & (LAMPUP | LAMPDOWN)) == 0) { // Up and down together steps through the flash patterns
+		if((tNow - lamp->tLast) > TIMER1TICKS(500)) {
+			if(nextPattern() == PATTERNSTEADY) {
+#if LAMPDIM_BACKEND == LAMPDIM_PWM
+				applyLevel(); // Pick up any level changes made while the pattern was playing
+#endif
+			}
+			lamp->tLast = tNow;
+		}
+#endif
 	} else {
-		if((tNow - *tLast) > (driverState.rheostatState<<3)) { // Small time since last power level change
+		if((tNow - lamp->tLast) > lamp->rheostatState * (uint_fast16_t)TIMER1TICKS(8)) { // Small time since last power level change
 			if((pinVals & LAMPUP) == 0) {
-				lampPowerUp(1);
-				*tLast = tNow;
+				levelUp(lampBit, 1);
+				lamp->tLast = tNow;
 			} else if((pinVals & LAMPDOWN) == 0){
-				lampPowerDown(1);
-				*tLast = tNow;
+				levelDown(lampBit, 1);
+				lamp->tLast = tNow;
 			}
 		}
 	}
@@ -189,35 +710,80 @@ static uint_fast8_t processBits(uint_fast8_t pinVals, uint_fast32_t *tLast)
 	return 0;
 }
 
-static uint_fast8_t sendRegByte(uint_fast8_t regAddr, uint_fast8_t regVal)
+#if LAMPDIM_BACKEND == LAMPDIM_PWM
+static void applyLevel(void)
+{
+#if PATTERN_ENABLE
+	if(currentPattern() != PATTERNSTEADY) { // The pattern sequencer owns the output while it plays
+		return;
+	}
+#endif
+	pwmDimSet(levelToDuty(driverState.lamp[0].rheostatState));
+}
+
+static uint_fast8_t levelToDuty(uint_fast8_t level)
 {
+	uint_fast16_t duty = (uint_fast16_t)(level + 1) * (level + 1); // Roughly perceptual square law, level 0 is fully off
+
+	duty >>= 2;
+
+	return duty > PWMDIMMAX ? PWMDIMMAX : duty;
+}
+#endif
+
+static uint_fast8_t sendRegBytes(struct LampDriver *lamp, uint_fast8_t regAddr, const uint8_t *regVals, uint_fast8_t nBytes)
+{
+	uint_fast8_t rVal;
+	uint_fast8_t idx;
 	uint8_t i2cBuffer[TWI_BUFFER_LENGTH];
 
 	i2cBuffer[0] = regAddr;
-	i2cBuffer[1] = regVal;
-	return twi_writeTo(MCP23008ADDR, i2cBuffer, sizeof(uint8_t) * 2, (uint8_t)1, (uint8_t)1);
+	for(idx = 0; idx < nBytes; idx++) {
+		i2cBuffer[idx + 1] = regVals[idx];
+	}
+	rVal = twi_writeTo(lamp->address, i2cBuffer, sizeof(uint8_t) * (nBytes + 1), (uint8_t)1, (uint8_t)1);
+	lamp->pointer = rVal ? NOPOINTER : regAddr; // Byte mode, it stays where it was written
+	if(rVal) {
+		TRACE_EVENT(TRACE_I2CERR, rVal);
+	}
+	return rVal;
 	// Wire.beginTransmission(MCP23008ADDR);
 	// Wire.write(regAddr);
 	// Wire.write(regVal);
 	// return Wire.endTransmission(1);
 }
 
-static uint_fast8_t sendOLAT(uint_fast8_t regVal)
+static uint_fast8_t sendRegByte(struct LampDriver *lamp, uint_fast8_t regAddr, uint_fast8_t regVal)
 {
-	return sendRegByte(OLAT, regVal);
+	uint8_t regVals = regVal;
+
+	return sendRegBytes(lamp, regAddr, &regVals, 1);
 }
 
-static uint_fast8_t readRegs(uint_fast8_t regAddr, uint_fast8_t nBytes, uint8_t *bOut)
+static uint_fast8_t sendOLAT(struct LampDriver *lamp, uint_fast8_t regVal)
 {
-	uint_fast8_t rVal;
+	return sendRegByte(lamp, OLAT, regVal);
+}
+
+static uint_fast8_t readRegs(struct LampDriver *lamp, uint_fast8_t regAddr, uint_fast8_t nBytes, uint8_t *bOut)
+{
+	uint_fast8_t rVal = 0;
 	uint8_t i2cBuffer[TWI_BUFFER_LENGTH];
 
-	i2cBuffer[0] = regAddr;
-	rVal = twi_writeTo(MCP23008ADDR, i2cBuffer, sizeof(uint8_t) * 1, (uint8_t)1, (uint8_t)1);
+	if(lamp->pointer != regAddr) { // Byte mode, it's only moved by writing it
+		i2cBuffer[0] = regAddr;
+		rVal = twi_writeTo(lamp->address, i2cBuffer, sizeof(uint8_t) * 1, (uint8_t)1, (uint8_t)1);
+		lamp->pointer = rVal ? NOPOINTER : regAddr;
+		if(rVal) {
+			TRACE_EVENT(TRACE_I2CERR, rVal);
+		}
+	}
 	// Wire.beginTransmission(MCP23008ADDR);
 	// Wire.write(regAddr);
 	// rVal = Wire.endTransmission(1); // At lower clock rates the receiver doesn't like a repeated start here
-	twi_readFrom(MCP23008ADDR,  bOut, nBytes, (uint8_t)1);
+	if(twi_readFrom(lamp->address, bOut, nBytes, (uint8_t)1) != nBytes) {
+		lamp->pointer = NOPOINTER; // Whatever it was left on, write it again next time
+	}
 	// Wire.requestFrom(MCP23008ADDR, nBytes, (uint_fast8_t)1);
 	// for(uint_fast8_t idx = 0; idx < nBytes; idx++) {
 	// 	bOut[idx] = Wire.read();
@@ -1,10 +1,95 @@
 #ifndef LAMPCONTROL_H_
 #define LAMPCONTROL_H_
 
+	// Brightness backends, selected at compile time
+	#define LAMPDIM_RHEOSTAT 0 // MCP23008 stepped up/down rheostat only
+	#define LAMPDIM_PWM 1 // Rheostat parked at full travel, brightness set by the Timer-0 PWM duty alone
+	#define LAMPDIM_BLEND 2 // Rheostat sets the level, PWM duty provides an instant fine trim on top
+
+	#ifndef LAMPDIM_BACKEND
+		#define LAMPDIM_BACKEND LAMPDIM_RHEOSTAT
+	#endif
+
+	// Up to LAMP_MAXLAMPS MCP23008 drivers, the first found scanning up from 0x20 at boot, each with its own buttons, level
+	// and on/off state. testLampState() polls one lamp a pass and the expanders are put in byte mode so a rheostat step is
+	// a single transaction, a second lamp costs less bus time than one did before. lampPowerUp(), lampPowerDown() and
+	// lampResume() act on every lamp and the first lamp found stands for the set in lampGetLevel() and lampIsOn(), so in
+	// the status and the supervisor's record. The PWM backends have the one Timer-0 output between them so drive a single lamp.
+	// What moves each lamp's rheostat to its level is LampWiper.h's.
+
+	#ifndef LAMP_MAXLAMPS
+		#define LAMP_MAXLAMPS 1
+	#endif
+
+	#ifndef LAMP_CHECKMS
+		#define LAMP_CHECKMS 1000 // How often each expander's IOCON is read back, see testLampState()
+	#endif
+
+	#define LAMPLEVELMAX 31
+
+	// Wiper verification, with the rheostat backend, the up/down wiper whose count can drift and ADC_HIRES for the reading.
+	// A lamp's count is only taken as where the wiper is after a sweep into the bottom end stop, or once the current read
+	// in a hi-res window opened after it's been on and settled at a level for LAMPVERIFY_SETTLEMS is within half a step of
+	// lampCurveCurrent(), the step being the smaller of those to the levels either side. Where that half step is under
+	// LAMPVERIFY_NOISE hi-res LSBs the reading can't tell the level from its neighbours, so it never makes the count
+	// trusted there, though one further out than the half step and the noise together still counts as a disagreement.
+	// It's measured again every LAMPVERIFY_PERIODMS for as long as the level stays put. Going to the bottom (a turn on or
+	// off, or the lamp left off above it) steps straight there on a trusted count and only sweeps LAMPRESYNCSTEPS on one
+	// that isn't. A disagreement sweeps and comes back up to the level, and if the current still disagrees at that level
+	// afterwards the curve doesn't fit the lamp, so it's back to sweeping every time until the next boot. The reading is the
+	// whole pack's so a lamp is only checked while it's the only one on and not flashing. Nothing can be measured at boot
+	// with the lamp held in reset, so a power on still starts with the sweep.
+	//
+	// LAMPCURVE_MA, the pack current with one lamp on every 1 << LAMPCURVESHIFT levels from the bottom and one past the top,
+	// is a placeholder with the rough shape of a lamp's rather than a measurement, so the verification is off until it's
+	// been calibrated. Built with LAMPVERIFY_CALIBRATE (and TELEMETRY_ENABLE and ADC_HIRES) each check only sends what it
+	// read as a TELEMETRY_CURVE frame. Step the lamp up through its levels from a power on, a couple of seconds at each, and
+	// tools/LampCurve.c turns a capture of the USART into the LAMPCURVE_MA to build with alongside LAMPCURVE_CALIBRATED.
+	#ifndef LAMPCURVE_MA
+		#define LAMPCURVE_MA 150, 300, 450, 620, 800, 1000, 1220, 1460, 1720 // Placeholder, rising
+	#endif
+
+	#ifndef LAMPCURVE_CALIBRATED
+		#define LAMPCURVE_CALIBRATED 0 // LAMPCURVE_MA has been measured on this lamp
+	#endif
+
+	#define LAMPCURVESHIFT 2 // Points are four levels apart
+	#define LAMPCURVEPOINTS ((LAMPLEVELMAX >> LAMPCURVESHIFT) + 2)
+
+	#ifndef LAMPVERIFY_ENABLE
+		#define LAMPVERIFY_ENABLE LAMPCURVE_CALIBRATED
+	#endif
+
+	#ifndef LAMPVERIFY_CALIBRATE
+		#define LAMPVERIFY_CALIBRATE 0
+	#endif
+
+	#ifndef LAMPVERIFY_NOISE
+		#define LAMPVERIFY_NOISE 2 // Hi-res LSBs, half an ADC count at 12 bits
+	#endif
+
+	#ifndef LAMPVERIFY_SETTLEMS
+		#define LAMPVERIFY_SETTLEMS 1000
+	#endif
+
+	#ifndef LAMPVERIFY_PERIODMS
+		#define LAMPVERIFY_PERIODMS 10000
+	#endif
+
 	uint_fast8_t shortInit23008(void);
 	void fullInit23008(void);
-	void testLampState(uint_fast32_t *tLast);
+	void testLampState(void);
+	uint_fast8_t lampCount(void);
 	void lampPowerDown(uint_fast8_t nSteps);
 	void lampPowerUp(uint_fast8_t nSteps);
+	uint_fast8_t lampGetLevel(void);
+	uint_fast8_t lampIsOn(void);
+	void lampResume(uint_fast8_t level, uint_fast8_t on);
+	void lampSetOnLevel(uint_fast8_t level); // Level a turn on goes to, 1 until LampMemory.h says otherwise
+	uint_fast16_t lampCurveCurrent(uint_fast8_t level); // mA the pack is expected to supply with one lamp on at level
+#if LAMPDIM_BACKEND == LAMPDIM_BLEND
+	void lampSetTrim(uint_fast8_t duty);
+	uint_fast8_t lampGetTrim(void);
+#endif
 
 #endif /* LAMPCONTROL_H_ */
\ No newline at end of file
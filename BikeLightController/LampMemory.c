@@ -0,0 +1,110 @@
+#include <avr/io.h>
+
+#include <stdint.h>
+
+#include "LampControl.h"
+#include "PatternSequencer.h"
+#include "Eeprom.h"
+#include "FaultLog.h"
+#include "LampMemory.h"
+
+#if LAMPMEMORY_ENABLE
+_Static_assert(EEPROM_FAULTLOG + FAULTLOG_ENTRIES * sizeof(struct FaultLogEntry) <= EEPROM_LAMPMEMORY, "the fault log runs into the lamp memory");
+_Static_assert(EEPROM_LAMPMEMORY + LAMPMEMORY_SLOTS * sizeof(struct LampMemoryEntry) <= E2END + 1, "the lamp memory doesn't fit the EEPROM");
+
+static struct {
+	struct EepromRing ring;
+	struct LampMemoryEntry saved; // As in the newest slot, or being written to the one after it
+	uint_fast8_t level; // Seen at the last tick, zero while off
+	uint_fast8_t mode;
+	uint_fast8_t stableTicks;
+	uint_fast8_t settledLevel;
+	uint_fast8_t settledMode;
+	uint_fast16_t idleTicks; // Since the last save
+} memState;
+
+void initLampMemory()
+{
+	memState.ring.base = EEPROM_LAMPMEMORY;
+	memState.ring.slots = LAMPMEMORY_SLOTS;
+	memState.ring.size = sizeof(struct LampMemoryEntry);
+	if(!eepromRingInit(&memState.ring, (uint8_t*)&memState.saved) ||
+		memState.saved.level < 1 || memState.saved.level > LAMPLEVELMAX) {
+		memState.saved.level = 1; // Nothing saved, as the lamp always was
+		memState.saved.mode = 0;
+	}
+
+	memState.settledLevel = memState.saved.level;
+	memState.settledMode = memState.saved.mode;
+	memState.level = memState.saved.mode & LAMPMEMORY_ON ? memState.saved.level : 0; // As lampMemoryRecall() leaves it
+	memState.mode = memState.saved.mode & LAMPMEMORY_ON ? memState.saved.mode : 0; // Off comes back steady
+	memState.stableTicks = LAMPMEMORY_SETTLETICKS;
+	memState.idleTicks = LAMPMEMORY_MINTICKS; // The first change can be saved as soon as it settles
+}
+
+void lampMemoryRecall(uint_fast8_t restore)
+{
+	lampSetOnLevel(memState.saved.level);
+	if(!restore) {
+		memState.level = lampIsOn() ? lampGetLevel() : 0; // Whatever the supervisor put back
+		memState.mode = memState.level ? LAMPMEMORY_ON : 0;
+		return;
+	}
+
+	if(memState.saved.mode & LAMPMEMORY_ON) { // The pattern only with it, a lamp left off comes back on steady
+#if PATTERN_ENABLE
+		selectPattern(memState.saved.mode >> LAMPMEMORY_PATTERNSHIFT);
+#endif
+		lampResume(memState.saved.level, 1); // Straight up from the bottom, no more steps than the level
+	}
+}
+
+void lampMemoryTick()
+{
+	uint_fast8_t level = lampIsOn() ? lampGetLevel() : 0;
+	uint_fast8_t mode = level ? LAMPMEMORY_ON : 0; // On at level zero is on the way to off
+
+#if PATTERN_ENABLE
+	mode |= currentPattern() << LAMPMEMORY_PATTERNSHIFT;
+#endif
+
+	if(level != memState.level || mode != memState.mode) {
+		memState.level = level;
+		memState.mode = mode;
+		memState.stableTicks = 0;
+	} else if(memState.stableTicks < LAMPMEMORY_SETTLETICKS && ++memState.stableTicks == LAMPMEMORY_SETTLETICKS) {
+		if(level) {
+			memState.settledLevel = level;
+			lampSetOnLevel(level);
+		}
+		memState.settledMode = mode;
+	}
+
+	if(memState.idleTicks < LAMPMEMORY_MINTICKS) {
+		memState.idleTicks++;
+	}
+
+	if(eepromRingStep(&memState.ring, (const uint8_t*)&memState.saved)) {
+		return; // A byte a tick, see Eeprom.h
+	}
+	if(memState.idleTicks == LAMPMEMORY_MINTICKS &&
+		(memState.settledLevel != memState.saved.level || memState.settledMode != memState.saved.mode)) {
+		memState.saved.level = memState.settledLevel;
+		memState.saved.mode = memState.settledMode;
+		memState.idleTicks = 0;
+		eepromRingSave(&memState.ring, (uint8_t*)&memState.saved);
+	}
+}
+#else
+void initLampMemory()
+{
+}
+
+void lampMemoryRecall(uint_fast8_t restore)
+{
+}
+
+void lampMemoryTick()
+{
+}
+#endif
\ No newline at end of file
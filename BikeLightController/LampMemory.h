@@ -0,0 +1,44 @@
+#ifndef LAMPMEMORY_H_
+#define LAMPMEMORY_H_
+
+	// The rider's brightness and mode kept in EEPROM so that the lamp comes back up as it was last used after a power cycle
+	// lampMemoryTick() looks at the level, on/off state and flash pattern once a tick and only counts them as settled once
+	// they've stayed put for LAMPMEMORY_SETTLETICKS, so stepping through the levels on the way somewhere isn't saved. The
+	// level kept is the last one the lamp settled at while on, and it's also what a turn on goes to. A save waits for at
+	// least LAMPMEMORY_MINTICKS after the one before, whatever happens in between is coalesced into the next. Saves go round
+	// an Eeprom.h ring of LAMPMEMORY_SLOTS entries a byte a tick, so the main loop never waits on the programming.
+
+	#include <stdint.h>
+
+	#ifndef LAMPMEMORY_ENABLE
+		#define LAMPMEMORY_ENABLE 0
+	#endif
+
+	#ifndef LAMPMEMORY_SLOTS
+		#define LAMPMEMORY_SLOTS 16 // Four bytes of EEPROM each
+	#endif
+
+	#ifndef LAMPMEMORY_SETTLETICKS
+		#define LAMPMEMORY_SETTLETICKS 20 // Five seconds unchanged
+	#endif
+
+	#ifndef LAMPMEMORY_MINTICKS
+		#define LAMPMEMORY_MINTICKS 240 // A minute between saves
+	#endif
+
+	// LampMemoryEntry.mode
+	#define LAMPMEMORY_ON 0x01
+	#define LAMPMEMORY_PATTERNSHIFT 1 // PATTERN... above the on bit
+
+	struct LampMemoryEntry {
+		uint8_t level; // Turn on level, 1 to LAMPLEVELMAX
+		uint8_t mode;
+		uint8_t check; // Makes the byte sum of the entry zero
+		uint8_t seq; // Counts saves, skipping 0xFF, written last
+	};
+
+	void initLampMemory();
+	void lampMemoryRecall(uint_fast8_t restore); // After the lamp reset, non-zero to put the lamp back as it was saved as well
+	void lampMemoryTick();
+
+#endif /* LAMPMEMORY_H_ */
\ No newline at end of file
@@ -0,0 +1,141 @@
+#include <avr/wdt.h>
+
+#include <stdint.h>
+
+#include "LampControl.h"
+#include "LampWiper.h"
+#include "EventTrace.h"
+#include "twi.h"
+
+#if LAMPWIPER_BACKEND == LAMPWIPER_UPDOWN
+static struct {
+	uint_fast8_t position[LAMP_MAXLAMPS]; // Steps counted up from the bottom end stop
+} wiperState;
+
+static uint_fast8_t stepDown(uint_fast8_t lampIdx);
+static uint_fast8_t stepUp(uint_fast8_t lampIdx);
+
+void wiperInit(uint_fast8_t lampIdx)
+{
+	wiperState.position[lampIdx] = 0;
+}
+
+void wiperSet(uint_fast8_t lampIdx, uint_fast8_t level)
+{
+	while(wiperState.position[lampIdx] > level) {
+		if(!stepDown(lampIdx)) {
+			return; // The bus failed, leave the count where the last good step put it
+		}
+	}
+	while(wiperState.position[lampIdx] < level && wiperState.position[lampIdx] < LAMPLEVELMAX) {
+		if(!stepUp(lampIdx)) {
+			return;
+		}
+	}
+}
+
+uint_fast8_t wiperGet(uint_fast8_t lampIdx)
+{
+	return wiperState.position[lampIdx];
+}
+
+uint_fast8_t wiperResync(uint_fast8_t lampIdx, uint_fast8_t level, uint_fast8_t slack)
+{
+	for(slack = slack < LAMPRESYNCSTEPS ? slack : LAMPRESYNCSTEPS; slack != 0; --slack) {
+		if(!stepDown(lampIdx)) {
+			return 0; // Short of the end stop, the count is no better than it was
+		}
+	}
+	wiperState.position[lampIdx] = 0; // Into the end stop, steps past it go nowhere
+	wdt_reset(); // The sweep down and the move up each fit well inside the watchdog period, the two together only just
+	wiperSet(lampIdx, level);
+
+	return wiperState.position[lampIdx] == level;
+}
+
+static uint_fast8_t stepDown(uint_fast8_t lampIdx) // Returns 0 if the step wasn't written
+{
+	uint8_t olatSeq[5];
+
+	olatSeq[0] = lampExpanderOLAT(lampIdx) | MCP23008NCS | MCP23008UD; // nCS and U/nD high
+	olatSeq[1] = olatSeq[0] & ~MCP23008NCS; // U/nD high, nCS low
+	olatSeq[2] = olatSeq[1] & ~MCP23008UD; // nCS and U/nD low
+	olatSeq[3] = olatSeq[1]; // nCS low and U/nD high
+	olatSeq[4] = lampExpanderOLAT(lampIdx); // nCS high and U/nD low (default)
+
+	if(lampExpanderWrite(lampIdx, olatSeq, 5)) {
+		return 0;
+	}
+	wiperState.position[lampIdx] -= wiperState.position[lampIdx] > 0 ? 1 : 0;
+
+	return 1;
+}
+
+static uint_fast8_t stepUp(uint_fast8_t lampIdx)
+{
+	uint8_t olatSeq[3];
+
+	olatSeq[0] = lampExpanderOLAT(lampIdx) & ~MCP23008NCS; // nCS low and U/nD low
+	olatSeq[1] = olatSeq[0] | MCP23008UD; // nCS low and U/nD high
+	olatSeq[2] = lampExpanderOLAT(lampIdx); // nCS high and U/nD low (default)
+
+	if(lampExpanderWrite(lampIdx, olatSeq, 3)) {
+		return 0;
+	}
+	wiperState.position[lampIdx]++;
+
+	return 1;
+}
+#elif LAMPWIPER_BACKEND == LAMPWIPER_DIGIPOT
+#define MCP4532ADDR ((uint_fast8_t)0b00101100) // A1 and A0 low, the next lamp's is the one after it
+#define MCP4532NADDR 4
+#define MCP4532WIPER0 ((uint_fast8_t)0x00) // Volatile wiper 0, write command, D8 in the low bit
+#define MCP4532FULLSCALE ((uint_fast16_t)128) // Wiper on terminal A
+#define LEVELTOWIPER(_level) ((((uint_fast16_t)(_level) * MCP4532FULLSCALE) + LAMPLEVELMAX / 2) / LAMPLEVELMAX)
+
+#if LAMP_MAXLAMPS > MCP4532NADDR
+	#error "The MCP4532 has four addresses, so four lamps at most"
+#endif
+
+static struct {
+	uint_fast8_t level[LAMP_MAXLAMPS]; // Last written
+} wiperState;
+
+void wiperInit(uint_fast8_t lampIdx)
+{
+	wiperState.level[lampIdx] = 0;
+}
+
+void wiperSet(uint_fast8_t lampIdx, uint_fast8_t level)
+{
+	uint_fast8_t rVal;
+	uint_fast16_t wiper;
+	uint8_t i2cBuffer[TWI_BUFFER_LENGTH];
+
+	level = level < LAMPLEVELMAX ? level : LAMPLEVELMAX;
+	wiper = LEVELTOWIPER(level);
+
+	i2cBuffer[0] = MCP4532WIPER0 | (wiper >> 8);
+	i2cBuffer[1] = wiper & 0xFF;
+	rVal = twi_writeTo(MCP4532ADDR + lampIdx, i2cBuffer, sizeof(uint8_t) * 2, (uint8_t)1, (uint8_t)1);
+	if(rVal) {
+		TRACE_EVENT(TRACE_I2CERR, rVal);
+	} else {
+		wiperState.level[lampIdx] = level;
+	}
+}
+
+uint_fast8_t wiperGet(uint_fast8_t lampIdx)
+{
+	return wiperState.level[lampIdx];
+}
+
+uint_fast8_t wiperResync(uint_fast8_t lampIdx, uint_fast8_t level, uint_fast8_t slack)
+{
+	wiperSet(lampIdx, level); // Absolute, there's nothing to have drifted
+
+	return wiperState.level[lampIdx] == (level < LAMPLEVELMAX ? level : LAMPLEVELMAX);
+}
+#else
+	#error "Unknown LAMPWIPER_BACKEND"
+#endif
\ No newline at end of file
@@ -0,0 +1,40 @@
+#ifndef LAMPWIPER_H_
+#define LAMPWIPER_H_
+
+	// What sets each lamp's rheostat, selected at compile time, with levels from 0 (lowest power) to LAMPLEVELMAX
+	// LAMPWIPER_UPDOWN steps the up/down rheostat through the nCS and U/nD lines on the lamp's MCP23008, a transaction a
+	// step, and only knows where it is by counting steps from the bottom end stop. LAMPWIPER_DIGIPOT writes the wiper of
+	// an MCP4532 I2C digital potentiometer (0x2C plus the lamp's index, terminal B wired to the lowest power) in one
+	// transaction whatever the move, and it can't drift. wiperResync() is for where the count may be out: the up/down
+	// backend drives slack steps down into the end stop first, the digital pot just writes the level again. A step or write
+	// the bus fails on isn't counted and the move stops there, so wiperGet() is where the wiper went as far as is known.
+	// A resync's sweep down is at most LAMPRESYNCSTEPS, about 0.4s of I2C traffic, and the caller kicks the watchdog
+	// before each wiperSet() or wiperResync().
+
+	#include <stdint.h>
+
+	#define LAMPWIPER_UPDOWN 0
+	#define LAMPWIPER_DIGIPOT 1
+
+	#ifndef LAMPWIPER_BACKEND
+		#define LAMPWIPER_BACKEND LAMPWIPER_UPDOWN
+	#endif
+
+	#define LAMPRESYNCSTEPS 96 // Up/down steps that reach the bottom end stop from anywhere
+
+	// The up/down rheostat's lines on the expander
+	#define MCP23008NCS ((uint_fast8_t)0b00010000)
+	#define MCP23008UD ((uint_fast8_t)0b00100000)
+
+	void wiperInit(uint_fast8_t lampIdx); // Taken to be at the bottom, until a wiperResync() makes sure
+	void wiperSet(uint_fast8_t lampIdx, uint_fast8_t level);
+	uint_fast8_t wiperGet(uint_fast8_t lampIdx); // Where it went, which may fall short of the level set if the bus failed
+	uint_fast8_t wiperResync(uint_fast8_t lampIdx, uint_fast8_t level, uint_fast8_t slack); // From up to slack steps above the count, 0 if the bus failed on the way
+
+#if LAMPWIPER_BACKEND == LAMPWIPER_UPDOWN
+	// Provided by LampControl.c
+	uint_fast8_t lampExpanderOLAT(uint_fast8_t lampIdx); // At rest, nCS high and U/nD low
+	uint_fast8_t lampExpanderWrite(uint_fast8_t lampIdx, const uint8_t *olatSeq, uint_fast8_t nBytes); // One transaction
+#endif
+
+#endif /* LAMPWIPER_H_ */
\ No newline at end of file
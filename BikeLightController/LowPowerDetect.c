@@ -3,9 +3,13 @@
 
 #include <stdint.h>
 
+#include "Hal.h"
 #include "PinControl.h"
 #include "BikeLightController.h"
 #include "LowPowerDetect.h"
+#include "ISRProfiler.h"
+#include "EventTrace.h"
+#include "FaultLog.h"
 
 void initLowPowerDetection()
 {
@@ -29,7 +33,10 @@ uint_fast8_t lowPowerTripped()
 
 ISR(INT0_vect)
 {
-	doShutdownProcess();
+	ISRPROF_COUNT(ISRPROF_INT0);
 	fetOff();
-	for(;;);
+	doShutdownProcess();
+	TRACE_EVENT(TRACE_TRIP, TRACETRIP_LOWPOWER);
+	faultLogRecord(TRACETRIP_LOWPOWER);
+	HALT();
 }
\ No newline at end of file
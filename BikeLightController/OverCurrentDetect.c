@@ -3,8 +3,12 @@
 
 #include <stdint.h>
 
+#include "Hal.h"
 #include "PinControl.h"
 #include "OverCurrentDetect.h"
+#include "ISRProfiler.h"
+#include "EventTrace.h"
+#include "FaultLog.h"
 
 void initOverCurrentDetection()
 {
@@ -29,7 +33,10 @@ uint_fast8_t overCurrentTripped()
 
 ISR(ANALOG_COMP_vect)
 {
+	ISRPROF_COUNT(ISRPROF_ANALOGCOMP);
 	fetOff();
 	holdLampInReset();
-	for(;;);
+	TRACE_EVENT(TRACE_TRIP, TRACETRIP_OVERCURRENT);
+	faultLogRecord(TRACETRIP_OVERCURRENT);
+	HALT();
 }
\ No newline at end of file
@@ -0,0 +1,73 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include <stdint.h>
+
+#include "Clock.h"
+#include "PWMDimmer.h"
+
+// Timer-0 drives OC0B (PD5, the lamp driver's reset/enable line) in fast PWM mode at clk/256 (31.25KHz at 8MHz)
+// The end stops disconnect the compare output and drive the pin directly so that there's no residual one tick glitch
+// Timer-0 has no prescaler left to keep that rate at a reduced clock so the clock is held up while the duty is in between
+
+static struct {
+	uint_fast8_t duty;
+} pwmState = {0};
+
+void initPWMDimmer()
+{
+	TCCR0A = 0;
+	TCCR0B = 0;
+	OCR0B = 0;
+	pwmState.duty = 0;
+}
+
+void startPWMDimmer()
+{
+	PRR &= ~(1<<PRTIM0); // Power on Timer-0
+	TCNT0 = 0;
+	TCCR0A = (1<<WGM01) | (1<<WGM00); // Fast PWM, output compare left disconnected until a duty is set
+	TCCR0B = (1<<CS00); // No prescaling
+}
+
+void stopPWMDimmer()
+{
+	uint_fast8_t statReg = SREG;
+
+	cli();
+		TCCR0A &= ~(1<<COM0B1) & ~(1<<COM0B0); // Return the pin to the port
+		TCCR0B = 0; // Stop the clock
+		PRR |= (1<<PRTIM0); // Power off Timer-0
+	SREG = statReg;
+	clockRelease(CLOCKHOLD_PWM);
+}
+
+void pwmDimSet(uint_fast8_t duty)
+{
+	uint_fast8_t statReg = SREG;
+
+	if(duty == 0 || duty == PWMDIMMAX) {
+		clockRelease(CLOCKHOLD_PWM);
+	} else {
+		clockHold(CLOCKHOLD_PWM); // Before the output starts switching
+	}
+
+	cli();
+		if(duty == 0) { // Fully off
+			TCCR0A &= ~(1<<COM0B1);
+			PORTD &= ~(1<<PD5);
+		} else if(duty == PWMDIMMAX) { // Fully on
+			TCCR0A &= ~(1<<COM0B1);
+			PORTD |= (1<<PD5);
+		} else {
+			OCR0B = duty; // Double buffered by the hardware so this takes effect at the next period
+			TCCR0A |= (1<<COM0B1); // Non-inverting, high while TCNT0 <= OCR0B
+		}
+		pwmState.duty = duty;
+	SREG = statReg;
+}
+
+uint_fast8_t pwmDimGet()
+{
+	return pwmState.duty;
+}
\ No newline at end of file
@@ -0,0 +1,12 @@
+#ifndef PWMDIMMER_H_
+#define PWMDIMMER_H_
+
+	#define PWMDIMMAX ((uint_fast8_t)255)
+
+	void initPWMDimmer();
+	void startPWMDimmer();
+	void stopPWMDimmer();
+	void pwmDimSet(uint_fast8_t duty);
+	uint_fast8_t pwmDimGet();
+
+#endif /* PWMDIMMER_H_ */
\ No newline at end of file
@@ -0,0 +1,179 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "Hal.h"
+#include "PinControl.h"
+#include "LampControl.h"
+#include "PWMDimmer.h"
+#include "Clock.h"
+#include "PatternSequencer.h"
+#include "EnergyMonitor.h"
+
+#if PATTERN_ENABLE
+
+// Timer-2 runs in CTC mode at F_CPU / 1024 (128uS per tick at 8MHz) and is only powered while a pattern plays
+// Each compare match is either a pattern edge or, for steps longer than the 8-bit counter can span, an intermediate wake every 256 ticks (32.8mS)
+
+#define PATTERNTICKS(_ms) ((uint16_t)(((uint32_t)(_ms) * (F_CPU / 1024) + 500) / 1000))
+
+struct PatternStep {
+	uint8_t level; // PWM duty, or just on (non-zero) / off when built without a PWM dimming backend
+	uint16_t duration; // In Timer-2 ticks, a zero duration marks the end of the pattern which then repeats from the start
+};
+
+static const struct PatternStep dayFlash[] PROGMEM = { // Double flash once a second
+	{PWMDIMMAX, PATTERNTICKS(60)},
+	{0, PATTERNTICKS(100)},
+	{PWMDIMMAX, PATTERNTICKS(60)},
+	{0, PATTERNTICKS(780)},
+	{0, 0}
+};
+
+static const struct PatternStep beacon[] PROGMEM = { // Single short flash every two seconds
+	{PWMDIMMAX, PATTERNTICKS(150)},
+	{0, PATTERNTICKS(1850)},
+	{0, 0}
+};
+
+static struct {
+	const struct PatternStep *first; // Flash addresses
+	const struct PatternStep *next;
+	uint_fast16_t ticksLeft;
+	uint_fast8_t pattern;
+	uint_fast8_t savedLevel;
+} patState;
+
+static void setPatternLevel(uint_fast8_t level);
+static uint_fast8_t getPatternLevel();
+
+void initPatterns()
+{
+	TIMSK2 = 0;
+	TCCR2B = 0;
+	patState.pattern = PATTERNSTEADY;
+}
+
+void selectPattern(uint_fast8_t pattern)
+{
+	const struct PatternStep *first;
+
+	switch(pattern) {
+		case PATTERNDAYFLASH:
+			first = dayFlash;
+			break;
+		case PATTERNBEACON:
+			first = beacon;
+			break;
+		default:
+			first = NULL;
+			pattern = PATTERNSTEADY;
+			break;
+	}
+
+	if(patState.pattern != PATTERNSTEADY) { // Stop whatever is playing and put the output back how we found it
+		TIMSK2 = 0;
+		TCCR2B = 0;
+		FLAG_CLEAR(TIFR2, (1<<OCF2A));
+		PRR |= (1<<PRTIM2); // Power off Timer-2
+		setPatternLevel(patState.savedLevel);
+	} else {
+		patState.savedLevel = getPatternLevel();
+	}
+
+	patState.pattern = pattern;
+
+	if(first != NULL) {
+		patState.first = patState.next = first;
+		patState.ticksLeft = 0;
+
+		PRR &= ~(1<<PRTIM2); // Power on Timer-2
+		TCCR2A = (1<<WGM21); // CTC mode, no outputs
+		TCNT2 = 0;
+		OCR2A = 0; // First edge on the next tick
+		FLAG_CLEAR(TIFR2, (1<<OCF2A));
+		TIMSK2 = (1<<OCIE2A);
+		TCCR2B = clockTimer2Select(); // clk/1024 at full speed
+	}
+}
+
+uint_fast8_t nextPattern()
+{
+	uint_fast8_t pattern = patState.pattern + 1;
+
+	selectPattern(pattern < NPATTERNS ? pattern : PATTERNSTEADY);
+
+	return patState.pattern;
+}
+
+uint_fast8_t currentPattern()
+{
+	return patState.pattern;
+}
+
+uint_fast8_t testIntPattern()
+{
+	return TIFR2 & (1<<OCF2A);
+}
+
+ISR(TIMER2_COMPA_vect)
+{
+	ENERGY_ENTER(ENERGY_ISRTIMER);
+	TIMSK2 = 0; // The next match is at least a tick away, see Hal.h
+	sei();
+
+	uint_fast16_t ticksLeft = patState.ticksLeft;
+
+	if(ticksLeft == 0) { // This is an edge
+		const struct PatternStep *step = patState.next;
+		uint_fast16_t duration = pgm_read_word(&step->duration);
+
+		if(duration == 0) { // End of the pattern so go round again
+			step = patState.first;
+			duration = pgm_read_word(&step->duration);
+		}
+		setPatternLevel(pgm_read_byte(&step->level));
+		patState.next = step + 1;
+		ticksLeft = duration;
+	}
+
+	// The counter has already restarted from zero so this sets the length of the period we're now in
+	if(ticksLeft > 256) {
+		OCR2A = 255;
+		ticksLeft -= 256;
+	} else {
+		OCR2A = ticksLeft - 1;
+		ticksLeft = 0;
+	}
+
+	patState.ticksLeft = ticksLeft;
+	cli();
+	TIMSK2 = (1<<OCIE2A);
+	ENERGY_EXIT();
+}
+
+static void setPatternLevel(uint_fast8_t level)
+{
+#if LAMPDIM_BACKEND != LAMPDIM_RHEOSTAT
+	pwmDimSet(level);
+#else
+	if(level) {
+		takeLampOutOfReset();
+	} else {
+		holdLampInReset();
+	}
+#endif
+}
+
+static uint_fast8_t getPatternLevel()
+{
+#if LAMPDIM_BACKEND != LAMPDIM_RHEOSTAT
+	return pwmDimGet();
+#else
+	return PORTD & (1<<PD5);
+#endif
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,19 @@
+#ifndef PATTERNSEQUENCER_H_
+#define PATTERNSEQUENCER_H_
+
+	#ifndef PATTERN_ENABLE
+		#define PATTERN_ENABLE 0
+	#endif
+
+	#define PATTERNSTEADY 0
+	#define PATTERNDAYFLASH 1
+	#define PATTERNBEACON 2
+	#define NPATTERNS 3
+
+	void initPatterns();
+	void selectPattern(uint_fast8_t pattern);
+	uint_fast8_t nextPattern();
+	uint_fast8_t currentPattern();
+	uint_fast8_t testIntPattern();
+
+#endif /* PATTERNSEQUENCER_H_ */
\ No newline at end of file
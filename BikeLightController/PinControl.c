@@ -3,14 +3,24 @@
 #include <stdint.h>
 
 #include "PinControl.h"
+#include "LampControl.h"
+#include "EventTrace.h"
 
 void fetOff()
 {
-	PORTC &= ~(1<<PC1);
+	uint_fast8_t wasOn = PORTC & (1<<PC1);
+
+	PORTC &= ~(1<<PC1); // Cut the power before anything else
+	if(wasOn) {
+		TRACE_EVENT(TRACE_FETOFF, 0);
+	}
 }
 
 void fetOn()
 {
+	if(!(PORTC & (1<<PC1))) {
+		TRACE_EVENT(TRACE_FETON, 0);
+	}
 	PORTC |= (1<<PC1);
 }
 
@@ -21,6 +31,9 @@ void fetToggle()
 
 void holdLampInReset()
 {
+#if LAMPDIM_BACKEND != LAMPDIM_RHEOSTAT
+	TCCR0A &= ~(1<<COM0B1) & ~(1<<COM0B0); // Take the pin back from the PWM dimmer
+#endif
 	PORTD &= ~(1<<PD5);
 }
 
@@ -1,6 +1,10 @@
 #ifndef POINTERTRICKS_H_
 #define POINTERTRICKS_H_
 
-	#define FIX_POINTER(_ptr) __asm__ __volatile__("" : "=b" (_ptr) : "0" (_ptr))
+	#ifdef __AVR__
+		#define FIX_POINTER(_ptr) __asm__ __volatile__("" : "=b" (_ptr) : "0" (_ptr))
+	#else
+		#define FIX_POINTER(_ptr)
+	#endif
 
 #endif /* POINTERTRICKS_H_ */
\ No newline at end of file
@@ -0,0 +1,45 @@
+#include <avr/io.h>
+
+#include <stdint.h>
+
+#include "StackMonitor.h"
+
+#if STACKMON_ENABLE && defined(__AVR__)
+extern uint8_t __heap_start; // End of .data, .bss and .noinit, from the linker script
+
+void stackPaint() __attribute__((naked, used, section(".init3")));
+
+void stackPaint()
+{
+	uint8_t *p = &__heap_start;
+
+	while(p <= (uint8_t *)RAMEND) { // Nothing has been pushed yet, there's no call into here
+		*p++ = STACKMON_PAINT;
+	}
+}
+
+uint_fast16_t stackHeadroom()
+{
+	const uint8_t *p = &__heap_start;
+
+	while(p <= (uint8_t *)RAMEND && *p == STACKMON_PAINT) {
+		p++;
+	}
+	return p - &__heap_start;
+}
+
+uint_fast16_t stackDepth()
+{
+	return (RAMEND + 1 - (uint16_t)&__heap_start) - stackHeadroom();
+}
+#else
+uint_fast16_t stackHeadroom()
+{
+	return RAMEND + 1 - RAMSTART;
+}
+
+uint_fast16_t stackDepth()
+{
+	return 0;
+}
+#endif
\ No newline at end of file
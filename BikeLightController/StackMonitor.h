@@ -0,0 +1,27 @@
+#ifndef STACKMONITOR_H_
+#define STACKMONITOR_H_
+
+	// Stack high-water mark
+	// Before main() runs (from .init3, so the .data and .bss set up that follows can't disturb it) everything between the
+	// end of the static data (__heap_start, there's no heap) and the top of RAM is painted with STACKMON_PAINT. The stack
+	// grows down into it, so scanning up from the bottom for the first byte that's changed finds the deepest the stack
+	// has ever been. stackHeadroom() is that many bytes that have never been touched, it's a scan of up to a couple of
+	// hundred bytes so it's for once a tick rather than every loop. Static RAM per module is reported at build time by
+	// tools/RamReport from the linker map. On the host nothing is painted and all of RAM reads as headroom.
+
+	#include <stdint.h>
+
+	#ifndef STACKMON_ENABLE
+		#define STACKMON_ENABLE 0
+	#endif
+
+	#ifndef STACKMON_WARNBYTES
+		#define STACKMON_WARNBYTES 32 // Headroom below this raises TELEMFLAG_STACKLOW
+	#endif
+
+	#define STACKMON_PAINT 0xC5
+
+	uint_fast16_t stackHeadroom(); // Bytes below the deepest the stack has reached that have never been written
+	uint_fast16_t stackDepth(); // Deepest the stack has reached, in bytes below RAMEND
+
+#endif /* STACKMONITOR_H_ */
\ No newline at end of file
@@ -0,0 +1,128 @@
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+
+#include <stdint.h>
+
+#include "ADCReader.h"
+#include "Eeprom.h"
+#include "LampMemory.h"
+#include "Units.h"
+#include "StateOfCharge.h"
+
+struct OcvPoint {
+	uint16_t voltage; // ADC counts
+	uint8_t percent; // Of the capacity left
+};
+
+static const struct OcvPoint ocvTable[] PROGMEM = { // 2S Li-ion at rest, rising
+	{UNITS_VOLTAGE(6000), 0},
+	{UNITS_VOLTAGE(6600), 5},
+	{UNITS_VOLTAGE(6900), 10},
+	{UNITS_VOLTAGE(7100), 20},
+	{UNITS_VOLTAGE(7250), 30},
+	{UNITS_VOLTAGE(7350), 40},
+	{UNITS_VOLTAGE(7450), 50},
+	{UNITS_VOLTAGE(7550), 60},
+	{UNITS_VOLTAGE(7700), 70},
+	{UNITS_VOLTAGE(7850), 80},
+	{UNITS_VOLTAGE(8000), 90},
+	{UNITS_VOLTAGE(8200), 100}
+};
+
+#define NOCVPOINTS (sizeof(ocvTable) / sizeof(ocvTable[0]))
+
+static uint_fast16_t remainingQ8(uint_fast16_t restVoltage);
+
+uint_fast8_t socFromVoltage(uint_fast16_t restVoltage)
+{
+	return (remainingQ8(restVoltage) + 0x80) >> 8;
+}
+
+static uint_fast16_t remainingQ8(uint_fast16_t restVoltage) // Percent left, in 1/256ths
+{
+	uint_fast16_t v0, v1;
+	uint_fast8_t p0, p1;
+	uint_fast8_t idx;
+
+	if(restVoltage <= pgm_read_word(&ocvTable[0].voltage)) {
+		return 0;
+	}
+	for(idx = 1; idx < NOCVPOINTS; idx++) {
+		v1 = pgm_read_word(&ocvTable[idx].voltage);
+		if(restVoltage < v1) {
+			v0 = pgm_read_word(&ocvTable[idx - 1].voltage);
+			p0 = pgm_read_byte(&ocvTable[idx - 1].percent);
+			p1 = pgm_read_byte(&ocvTable[idx].percent);
+			return ((uint_fast16_t)p0 << 8) + (uint_fast16_t)(((uint_fast32_t)(p1 - p0) << 8) * (restVoltage - v0) / (v1 - v0));
+		}
+	}
+	return (uint_fast16_t)100 << 8;
+}
+
+#if SOC_ENABLE
+#define RECHARGECOUNTS UNITS_VOLTAGE(SOC_RECHARGEMV)
+
+_Static_assert(EEPROM_LAMPMEMORY + LAMPMEMORY_SLOTS * sizeof(struct LampMemoryEntry) <= EEPROM_CHARGESTATE, "the lamp memory runs into the charge state");
+_Static_assert(EEPROM_CHARGESTATE + SOC_SLOTS * sizeof(struct SocEntry) <= E2END + 1, "the charge state doesn't fit the EEPROM");
+
+static struct {
+	struct EepromRing ring;
+	struct SocEntry saved; // As in the newest slot, or being written to the one after it
+	uint_fast32_t saveStep;
+	uint_fast16_t idleTicks; // Since the last save
+	uint_fast8_t unsaved; // The count was started afresh from the table
+} socState;
+
+uint_fast32_t socSeed(uint_fast16_t restVoltage, uint_fast32_t capacity)
+{
+	uint_fast32_t used = capacity - (capacity >> 8) * remainingQ8(restVoltage) / 100;
+	struct SocEntry *saved = &socState.saved;
+
+	socState.ring.base = EEPROM_CHARGESTATE;
+	socState.ring.slots = SOC_SLOTS;
+	socState.ring.size = sizeof(struct SocEntry);
+	socState.unsaved = 1;
+	if(eepromRingInit(&socState.ring, (uint8_t*)saved) && restVoltage <= saved->restVoltage + RECHARGECOUNTS) {
+		socState.unsaved = 0; // Not recharged since, carry on
+		used = saved->used > used ? saved->used : used;
+		restVoltage = saved->restVoltage < restVoltage ? saved->restVoltage : restVoltage; // So the comparison can't creep up a boot at a time
+	}
+	saved->used = used;
+	saved->restVoltage = restVoltage;
+
+	socState.saveStep = capacity >> SOC_SAVESHIFT;
+	socState.idleTicks = SOC_SAVETICKS; // Anything started afresh is saved on the first tick
+	adcSeedAccumulatedCurrent(used);
+
+	return used;
+}
+
+void socTick()
+{
+	uint_fast32_t used;
+
+	if(socState.idleTicks < SOC_SAVETICKS) {
+		socState.idleTicks++;
+	}
+
+	if(eepromRingStep(&socState.ring, (const uint8_t*)&socState.saved)) {
+		return; // A byte a tick, see Eeprom.h
+	}
+	used = getAccumulatedCurrent();
+	if(socState.idleTicks == SOC_SAVETICKS && (socState.unsaved || used >= socState.saved.used + socState.saveStep)) {
+		socState.saved.used = used;
+		socState.unsaved = 0;
+		socState.idleTicks = 0;
+		eepromRingSave(&socState.ring, (uint8_t*)&socState.saved);
+	}
+}
+#else
+uint_fast32_t socSeed(uint_fast16_t restVoltage, uint_fast32_t capacity)
+{
+	return 0; // As from the bias update, a full pack
+}
+
+void socTick()
+{
+}
+#endif
\ No newline at end of file
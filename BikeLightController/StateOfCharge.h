@@ -0,0 +1,46 @@
+#ifndef STATEOFCHARGE_H_
+#define STATEOFCHARGE_H_
+
+	// Where the coulomb counter starts from at boot, so that the capacity trip is a budget for what's left in the pack
+	// rather than for a full one. socSeed() takes the pack voltage read before fetOn(), with nothing drawn from it, through
+	// an open circuit voltage table (2S Li-ion, interpolated between points) for the share of the capacity already used.
+	// While running socTick() keeps the count in an Eeprom.h ring along with the boot's resting voltage, saving no more
+	// often than every SOC_SAVETICKS and only once it's moved on by SOC_SAVESTEP of the capacity. If the next boot's resting
+	// voltage is no more than SOC_RECHARGEMV above the saved one the pack can't have been recharged in between, so the
+	// count carries on from the saved figure, or from the table's if that says more has been used. Otherwise the table's
+	// figure stands on its own. The resting voltage reads a little low after a hard ride, which errs towards tripping early.
+
+	#include <stdint.h>
+
+	#ifndef SOC_ENABLE
+		#define SOC_ENABLE 0 // Until Units.h's board figures, which the count rests on, are verified
+	#endif
+
+	#ifndef SOC_SLOTS
+		#define SOC_SLOTS 8 // Eight bytes of EEPROM each
+	#endif
+
+	#ifndef SOC_SAVETICKS
+		#define SOC_SAVETICKS 240 // A minute
+	#endif
+
+	#ifndef SOC_SAVESHIFT
+		#define SOC_SAVESHIFT 7 // SOC_SAVESTEP is 1/128 of the capacity
+	#endif
+
+	#ifndef SOC_RECHARGEMV
+		#define SOC_RECHARGEMV 100 // Pack voltage rise that counts as a recharge
+	#endif
+
+	struct SocEntry {
+		uint32_t used; // getAccumulatedCurrent()
+		uint16_t restVoltage; // ADC counts, the lowest any boot since the count started from the table read
+		uint8_t check; // Makes the byte sum of the entry zero
+		uint8_t seq; // Counts saves, skipping 0xFF, written last
+	};
+
+	uint_fast32_t socSeed(uint_fast16_t restVoltage, uint_fast32_t capacity); // After the bias update, returns the count it started from
+	uint_fast8_t socFromVoltage(uint_fast16_t restVoltage); // Percent of the capacity left, from the table
+	void socTick();
+
+#endif /* STATEOFCHARGE_H_ */
\ No newline at end of file
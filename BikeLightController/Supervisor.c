@@ -0,0 +1,148 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/wdt.h>
+
+#include <stdint.h>
+#include <string.h>
+
+#include "Hal.h"
+#include "PinControl.h"
+#include "LampControl.h"
+#include "EventTrace.h"
+#include "FaultLog.h"
+#include "Supervisor.h"
+
+#define SUPERVISORMAGIC0 'S'
+#define SUPERVISORMAGIC1 'V'
+
+#define WDTPERIOD ((1<<WDP2) | (1<<WDP0)) // 500ms
+#define WDTQUICK 0 // 16ms, the reset that follows a caught hang
+
+struct SupervisorRecord supervisorRecord __attribute__((section(".noinit"))); // Has to survive the reset
+
+#if SUPERVISOR_ENABLE
+void supervisorExpired(uint16_t pc, uint16_t sp) __attribute__((noreturn, used));
+
+uint_fast8_t supervisorBoot(uint_fast8_t resetSource)
+{
+	uint_fast8_t valid = supervisorRecord.magic[0] == SUPERVISORMAGIC0 && supervisorRecord.magic[1] == SUPERVISORMAGIC1;
+
+	if(!(resetSource & (1<<WDRF)) || !valid) {
+		memset(&supervisorRecord, 0, sizeof(supervisorRecord));
+		supervisorRecord.magic[0] = SUPERVISORMAGIC0;
+		supervisorRecord.magic[1] = SUPERVISORMAGIC1;
+		return resetSource & (1<<WDRF) ? SUPERVISOR_SHUTDOWN : SUPERVISOR_COLD; // Can't tell, so as it always was
+	}
+
+	if(supervisorRecord.cause == SUPERVISORCAUSE_SHUTDOWN) {
+		return SUPERVISOR_SHUTDOWN;
+	}
+
+	if(supervisorRecord.cause == SUPERVISORCAUSE_RUNNING) { // The interrupt never ran, nothing to restore
+		supervisorRecord.pc = supervisorRecord.sp = 0;
+		supervisorRecord.lampLevel = supervisorRecord.lampOn = supervisorRecord.lampValid = 0;
+	}
+	if(++supervisorRecord.restarts > SUPERVISOR_MAXRESTARTS) { // Keeps hanging, treat it as a fault
+		supervisorRecord.cause = SUPERVISORCAUSE_SHUTDOWN;
+		return SUPERVISOR_SHUTDOWN;
+	}
+
+	return SUPERVISOR_RESTART;
+}
+
+void supervisorStart()
+{
+	uint_fast8_t statReg = SREG;
+
+	supervisorRecord.cause = SUPERVISORCAUSE_RUNNING;
+	supervisorRecord.stableTicks = 0;
+
+	cli();
+		wdt_reset();
+		WDTCSR = (1<<WDCE) | (1<<WDE);
+		WDTCSR = (1<<WDIE) | (1<<WDE) | WDTPERIOD; // Interrupt first then reset
+	SREG = statReg;
+}
+
+void supervisorShutdown()
+{
+	uint_fast8_t statReg = SREG;
+
+	supervisorRecord.cause = SUPERVISORCAUSE_SHUTDOWN;
+
+	if(WDTCSR & (1<<WDE)) { // The spin that follows is meant, so reset without the interrupt
+		cli();
+			wdt_reset();
+			WDTCSR = (1<<WDCE) | (1<<WDE);
+			WDTCSR = (1<<WDE) | WDTPERIOD;
+		SREG = statReg;
+	}
+}
+
+void supervisorTick()
+{
+	if(supervisorRecord.restarts && ++supervisorRecord.stableTicks >= SUPERVISORSTABLETICKS) {
+		supervisorRecord.restarts = 0;
+	}
+}
+
+void supervisorExpired(uint16_t pc, uint16_t sp)
+{
+	fetOff(); // Safe state first
+	holdLampInReset();
+
+	supervisorRecord.cause = SUPERVISORCAUSE_HANG;
+	supervisorRecord.pc = pc << 1; // Word address to byte address, as in the listing
+	supervisorRecord.sp = sp;
+	supervisorRecord.lampLevel = lampGetLevel();
+	supervisorRecord.lampOn = lampIsOn();
+	supervisorRecord.lampValid = 1;
+
+	TRACE_EVENT(TRACE_TRIP, TRACETRIP_HANG);
+	faultLogRecord(TRACETRIP_HANG);
+
+	// The hardware has dropped back to reset only, make it a quick one
+	wdt_reset();
+	WDTCSR = (1<<WDCE) | (1<<WDE);
+	WDTCSR = (1<<WDE) | WDTQUICK;
+	HALT_SPIN();
+}
+
+#ifdef __AVR__
+ISR(WDT_vect, ISR_NAKED)
+{
+	// Never returns, so the return address can come off the stack (high byte first) as the first argument
+	asm volatile(
+		"pop r25" "\n\t"
+		"pop r24" "\n\t"
+		"in r22, __SP_L__" "\n\t"
+		"in r23, __SP_H__" "\n\t"
+		"clr __zero_reg__" "\n\t"
+		"rjmp supervisorExpired" "\n\t"
+	);
+}
+#else
+ISR(WDT_vect)
+{
+	supervisorExpired(0, 0); // Nothing to find on the host
+}
+#endif
+#else
+uint_fast8_t supervisorBoot(uint_fast8_t resetSource)
+{
+	return resetSource & (1<<WDRF) ? SUPERVISOR_SHUTDOWN : SUPERVISOR_COLD;
+}
+
+void supervisorStart()
+{
+	wdt_enable(WDTO_500MS);
+}
+
+void supervisorShutdown()
+{
+}
+
+void supervisorTick()
+{
+}
+#endif
\ No newline at end of file
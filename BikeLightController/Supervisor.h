@@ -0,0 +1,50 @@
+#ifndef SUPERVISOR_H_
+#define SUPERVISOR_H_
+
+	// Watchdog supervisor
+	// The watchdog runs in interrupt and reset mode. A missed kick first takes WDT_vect, which cuts the lamp power, notes
+	// where the program was and what the lamp was doing in supervisorRecord (.noinit) and then forces a quick reset.
+	// HALT() marks a deliberate shutdown and switches the watchdog to reset only before it spins, so at boot a safety
+	// shutdown stays dark as before while a hang (caught by the interrupt or not) starts up again with the lamp as it
+	// was, up to SUPERVISOR_MAXRESTARTS times before it's treated as a shutdown too.
+
+	#ifndef SUPERVISOR_ENABLE
+		#define SUPERVISOR_ENABLE 0
+	#endif
+
+	#ifndef SUPERVISOR_MAXRESTARTS
+		#define SUPERVISOR_MAXRESTARTS 3 // Hangs in a row
+	#endif
+
+	#define SUPERVISORSTABLETICKS 40 // Ten seconds of running clears the restart count
+
+	// What supervisorBoot() found
+	#define SUPERVISOR_COLD 0 // Power on, brown-out or external reset
+	#define SUPERVISOR_SHUTDOWN 1 // Watchdog reset that followed a deliberate shutdown, stay dark
+	#define SUPERVISOR_RESTART 2 // Watchdog reset that followed a hang, start again quickly
+
+	// supervisorRecord.cause
+	#define SUPERVISORCAUSE_RUNNING 0 // Nothing caught, a reset from here is a hang with interrupts off
+	#define SUPERVISORCAUSE_SHUTDOWN 1
+	#define SUPERVISORCAUSE_HANG 2 // Caught by the interrupt
+
+	struct SupervisorRecord {
+		uint8_t magic[2];
+		uint8_t cause;
+		uint8_t restarts; // Consecutive hangs
+		uint16_t pc; // Byte address the hang was interrupted at
+		uint16_t sp; // Stack pointer there
+		uint8_t lampLevel;
+		uint8_t lampOn;
+		uint8_t lampValid; // The interrupt recorded the two above, otherwise where the rheostat is isn't known
+		uint16_t stableTicks;
+	};
+
+	extern struct SupervisorRecord supervisorRecord;
+
+	uint_fast8_t supervisorBoot(uint_fast8_t resetSource);
+	void supervisorStart();
+	void supervisorShutdown();
+	void supervisorTick();
+
+#endif /* SUPERVISOR_H_ */
\ No newline at end of file
@@ -0,0 +1,147 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include <stdint.h>
+#include <string.h>
+
+#include "Hal.h"
+#include "Clock.h"
+#include "Telemetry.h"
+#include "EnergyMonitor.h"
+
+#if TELEMETRY_ENABLE
+#define UBRRVALUE (((F_CPU + 8UL * TELEMETRY_BAUD) / (16UL * TELEMETRY_BAUD)) - 1) // Rounded, 12 for 38400 at 8MHz (0.2% fast)
+#define RINGMASK (TELEMETRY_RINGLENGTH - 1)
+
+static struct {
+	uint8_t ring[TELEMETRY_RINGLENGTH];
+	volatile uint8_t head; // Only ever written by the main loop
+	volatile uint8_t tail; // Only ever written by the interrupt
+	uint8_t seq;
+	uint16_t dropped;
+} telemState;
+
+void initTelemetry()
+{
+	memset(&telemState, 0, sizeof(telemState));
+
+	PRR &= ~(1<<PRUSART0); // Power on the USART
+	UBRR0 = UBRRVALUE;
+	UCSR0C = (1<<UCSZ01) | (1<<UCSZ00); // Asynchronous, 8 data bits, no parity, one stop bit
+	UCSR0B = (1<<TXEN0); // Transmitter only, its interrupt is enabled while there's anything queued
+}
+
+uint_fast8_t telemetrySend(uint_fast8_t type, const uint8_t *payload, uint_fast8_t length)
+{
+	uint8_t head = telemState.head;
+	uint8_t space = (telemState.tail - head - 1) & RINGMASK;
+	uint8_t sum = type + length;
+
+	if(space < length + TELEMETRYOVERHEAD) { // The link can't keep up
+		if(telemState.dropped != 0xFFFF) {
+			telemState.dropped++;
+		}
+		return 0;
+	}
+
+	telemState.ring[head] = TELEMETRYSYNC;
+	head = (head + 1) & RINGMASK;
+	telemState.ring[head] = type;
+	head = (head + 1) & RINGMASK;
+	telemState.ring[head] = length;
+	head = (head + 1) & RINGMASK;
+	for(; length != 0; length--) {
+		sum += *payload;
+		telemState.ring[head] = *payload++;
+		head = (head + 1) & RINGMASK;
+	}
+	telemState.ring[head] = -sum;
+	head = (head + 1) & RINGMASK;
+
+	telemState.head = head; // The interrupt only sees the frame once it's complete
+	clockHold(CLOCKHOLD_USART); // The baud rate is only right at full speed, released once the ring has drained and the last bit is out
+	UCSR0B |= (1<<UDRIE0);
+
+	return 1;
+}
+
+uint_fast8_t telemetrySendStatus(uint_fast16_t current, uint_fast16_t voltage, uint_fast32_t charge, uint_fast8_t level, uint_fast8_t flags)
+{
+	uint8_t frame[TELEMETRYSTATUSLENGTH];
+
+	frame[0] = telemState.seq++; // Counts attempts so a gap shows where frames were dropped
+	frame[1] = telemState.dropped;
+	frame[2] = telemState.dropped >> 8;
+	frame[3] = current;
+	frame[4] = current >> 8;
+	frame[5] = voltage;
+	frame[6] = voltage >> 8;
+	frame[7] = charge;
+	frame[8] = charge >> 8;
+	frame[9] = charge >> 16;
+	frame[10] = charge >> 24;
+	frame[11] = level;
+	frame[12] = flags;
+
+	return telemetrySend(TELEMETRY_STATUS, frame, TELEMETRYSTATUSLENGTH);
+}
+
+uint_fast16_t telemetryDropped()
+{
+	return telemState.dropped; // Only changed by the main loop
+}
+
+uint_fast8_t telemetryFree()
+{
+	return (telemState.tail - telemState.head - 1) & RINGMASK;
+}
+
+ISR(USART_UDRE_vect)
+{
+	ENERGY_ENTER(ENERGY_ISRUSART);
+	uint8_t tail = telemState.tail;
+
+	UDR0 = telemState.ring[tail];
+	FLAG_CLEAR(UCSR0A, (1<<TXC0)); // Not complete until this one is out
+	tail = (tail + 1) & RINGMASK;
+	telemState.tail = tail;
+	if(tail == telemState.head) { // Drained, wait for the last byte to leave the shift register
+		UCSR0B = (UCSR0B & ~(1<<UDRIE0)) | (1<<TXCIE0);
+	}
+	ENERGY_EXIT();
+}
+
+ISR(USART_TX_vect)
+{
+	ENERGY_ENTER(ENERGY_ISRUSART);
+	UCSR0B &= ~(1<<TXCIE0);
+	if(telemState.tail == telemState.head) { // Nothing queued since
+		clockRelease(CLOCKHOLD_USART);
+	}
+	ENERGY_EXIT();
+}
+#else
+void initTelemetry()
+{
+}
+
+uint_fast8_t telemetrySend(uint_fast8_t type, const uint8_t *payload, uint_fast8_t length)
+{
+	return 0;
+}
+
+uint_fast8_t telemetrySendStatus(uint_fast16_t current, uint_fast16_t voltage, uint_fast32_t charge, uint_fast8_t level, uint_fast8_t flags)
+{
+	return 0;
+}
+
+uint_fast16_t telemetryDropped()
+{
+	return 0;
+}
+
+uint_fast8_t telemetryFree()
+{
+	return 0;
+}
+#endif
\ No newline at end of file
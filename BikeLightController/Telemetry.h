@@ -0,0 +1,46 @@
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+
+	// Transmit only telemetry on USART0 (TXD, PD1), 8N1
+	// Frames are queued whole into a ring that the data register empty interrupt drains, a frame that doesn't fit is
+	// dropped and counted rather than waited for. On the wire each frame is:
+	//  TELEMETRYSYNC, type, payload length, payload..., check
+	// where check makes the byte sum of everything after the sync zero. Multi-byte payload fields are little endian.
+
+	#ifndef TELEMETRY_ENABLE
+		#define TELEMETRY_ENABLE 0
+	#endif
+
+	#ifndef TELEMETRY_BAUD
+		#define TELEMETRY_BAUD 38400UL
+	#endif
+
+	#ifndef TELEMETRY_RINGLENGTH
+		#define TELEMETRY_RINGLENGTH 32 // Bytes, a power of two no larger than 256
+	#endif
+
+	#define TELEMETRYSYNC 0xA5
+	#define TELEMETRYOVERHEAD 4 // Sync, type, length and check
+
+	// Frame types
+	#define TELEMETRY_STATUS 1 // Sequence, frames dropped (2), current (2), voltage (2), accumulated charge (4), level, flags
+	#define TELEMETRY_FAULT 2 // A fault log entry, time (4), accumulated charge (4), current (2), voltage (2), level, reason, sequence
+	#define TELEMETRY_CURVE 3 // LAMPVERIFY_CALIBRATE's lamp current reading, level, trusted, current mA (2), hi-res current (2)
+
+	#define TELEMETRYSTATUSLENGTH 13
+	#define TELEMETRYFAULTLENGTH 15
+	#define TELEMETRYCURVELENGTH 6
+
+	// Status flags, the low three bits are the TRACEWARN_... flags from EventTrace.h
+	#define TELEMFLAG_OVERCURRENT 0x10 // Comparator output tripped
+	#define TELEMFLAG_LOWPOWER 0x20 // Low power signal asserted
+	#define TELEMFLAG_STACKLOW 0x40 // Stack headroom under STACKMON_WARNBYTES
+	#define TELEMFLAG_LAMPON 0x80
+
+	void initTelemetry();
+	uint_fast8_t telemetrySend(uint_fast8_t type, const uint8_t *payload, uint_fast8_t length);
+	uint_fast8_t telemetrySendStatus(uint_fast16_t current, uint_fast16_t voltage, uint_fast32_t charge, uint_fast8_t level, uint_fast8_t flags);
+	uint_fast16_t telemetryDropped();
+	uint_fast8_t telemetryFree();
+
+#endif /* TELEMETRY_H_ */
\ No newline at end of file
@@ -4,21 +4,33 @@
 
 #include <stdint.h>
 
+#include "Hal.h"
 #include "ADCReader.h"
 #include "TimerServices.h"
+#include "Benchmark.h"
+#include "ISRProfiler.h"
+#include "EnergyMonitor.h"
+#include "Units.h"
 
-// Timer-1 period is 256.000mS
+#if F_CPU % 4000
+	#error "F_CPU must be a multiple of 4KHz for a whole number of Timer-1 counts in 256mS"
+#endif
 
 static struct TimerState {
 	volatile uint_fast32_t t0Overflow;
+	volatile uint_fast32_t tBase; // getTicks() at the start of this period
+	volatile uint_fast8_t tSeq; // Moves with each overflow so a reader can tell it was overtaken
+	uint_fast32_t skipped; // Cycles not yet added back
 } tState = {0};
 
+static inline uint_fast16_t readTimer1(volatile uint_fast32_t *periodCount, uint_fast32_t *periodVal);
+
 void initTimers()
 {
 	// Use Timer-1 as a generic time keeping device
 	TCCR1A = (1<<WGM11);
-	TCCR1B = (1<<WGM13) | (1<<WGM12) | (1<<CS12) | (1<<CS10);
-	ICR1 = 1999;	// Period .256 seconds
+	TCCR1B = (1<<WGM13) | (1<<WGM12) | clockTimer1Select(); // clk/1024 at full speed
+	ICR1 = TIMER1TOP;	// Period .256 seconds
 }
 
 void startTimers()
@@ -32,8 +44,9 @@ void startTimers()
 
 	// Ensure all timer states are reset
 	TCNT1 = 0;
-	TIFR1 |= (1<<TOV1);
+	FLAG_CLEAR(TIFR1, (1<<TOV1));
 	tState.t0Overflow = 0;
+	tState.tBase = 0;
 
 	// And enable interrupts
 	TIMSK1 = (1<<TOIE1); // Enable timer overflow interrupt at 3.90625Hz (period of 256ms)
@@ -80,20 +93,29 @@ uint_fast32_t getTime()
 {
 	uint_fast32_t tOverflows;
 	uint_fast16_t tTicks;
-	uint_fast8_t tIntReg;
-	uint_fast8_t statReg = SREG;
 
-	cli();
-		tOverflows = tState.t0Overflow;
-		tTicks = TCNT1;
-		tIntReg = TIFR1;
-	SREG = statReg;
+	BENCH_BEGIN(BENCH_GETTIME);
 
-	if((tIntReg & (1<<TOV1)) && (tTicks < 1999)) { // Account for any missing interrupts (and we've not crossed the overflow boundary)
-		tOverflows++;
-	}
+	tTicks = readTimer1(&tState.t0Overflow, &tOverflows);
+	tOverflows = (tOverflows << 8) + unitsTimer1MS(tTicks); // 0.128mS per count at 8MHz
+
+	BENCH_END(BENCH_GETTIME);
+
+	return tOverflows;
+}
+
+uint_fast32_t getTicks()
+{
+	uint_fast32_t tBase;
+	uint_fast16_t tTicks;
+
+	BENCH_BEGIN(BENCH_GETTICKS);
+
+	tTicks = readTimer1(&tState.tBase, &tBase);
+
+	BENCH_END(BENCH_GETTICKS);
 
-	return ((tOverflows << 8) + ((((tTicks + (tTicks>>1))>>6) + tTicks + 4)>>3));
+	return tBase + tTicks;
 }
 
 uint_fast32_t getTickNumber()
@@ -108,10 +130,41 @@ uint_fast32_t getTickNumber()
 	return lastTick;
 }
 
+void timerSkip(uint_fast32_t cycles)
+{
+	uint_fast8_t statReg = SREG;
+	uint_fast16_t tThen, tNow;
+	uint_fast16_t counts;
+
+	tState.skipped += cycles;
+	counts = tState.skipped >> 10; // F_CPU / 1024
+	if(counts == 0) {
+		return;
+	}
+
+	tThen = TCNT1;
+	for(;;) { // Line the write up on a count so that none is lost between reading and writing TCNT1
+		do {
+			tNow = TCNT1;
+		} while(tThen == tNow);
+		cli();
+		if(TCNT1 == tNow) {
+			break;
+		}
+		SREG = statReg;
+		tThen = TCNT1;
+	}
+		if(tNow + counts < TIMER1TOP) { // Otherwise leave them until after the overflow rather than step over it
+			TCNT1 = tNow + counts;
+			tState.skipped -= (uint_fast32_t)counts << 10;
+		}
+	SREG = statReg;
+}
+
 uint_fast16_t noIntTimerStart()
 {
 	TCNT1 = 0;
-	TIFR1 |= (1<<TOV1);
+	FLAG_CLEAR(TIFR1, (1<<TOV1));
 	return 0;
 }
 
@@ -154,7 +207,31 @@ void noIntTone(uint_fast8_t freq, uint_fast8_t output)
 	} while(!noIntTimerEnded());
 }
 
+static inline uint_fast16_t readTimer1(volatile uint_fast32_t *periodCount, uint_fast32_t *periodVal)
+{
+	uint_fast8_t tSeq;
+	uint_fast16_t tTicks;
+
+	do { // Interrupts stay on, an overflow taken part way through changes tSeq and the read is done again
+		tSeq = tState.tSeq;
+		*periodVal = *periodCount;
+		tTicks = TCNT1;
+		tTicks = tTicks < TIMER1TOP ? tTicks + 1 : 0; // Fast PWM sets TOV1 as the count reaches TOP, so TOP is the first count of the next period
+		if((TIFR1 & (1<<TOV1)) && tTicks < (TIMER1TOP >> 1)) { // Overflowed with the interrupt still to be taken (interrupts off), and not just after the count was read
+			tTicks += TIMER1TOP + 1;
+		}
+	} while(tSeq != tState.tSeq);
+
+	return tTicks;
+}
+
 ISR(TIMER1_OVF_vect)
 {
+	ISRPROF_ENTERPERIODIC(ISRPROF_TIMER1OVF, ((TIMER1TOP + 1) * 1024) >> clockShift());
+	ENERGY_ENTER(ENERGY_ISRTIMER); // Also what keeps every stretch the energy monitor sees within a period
 	tState.t0Overflow++;
+	tState.tBase += TIMER1TOP + 1;
+	tState.tSeq++;
+	ENERGY_EXIT();
+	ISRPROF_EXIT(ISRPROF_TIMER1OVF);
 }
\ No newline at end of file
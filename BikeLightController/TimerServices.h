@@ -1,6 +1,20 @@
 #ifndef TIMERSERVICES_H_
 #define TIMERSERVICES_H_
 
+	#include "Clock.h"
+
+	// Timer-1 counts at F_CPU / 1024 whatever the clock is scaled to (see Clock.h), over a period of 256.000mS. It runs
+	// fast PWM with ICR1 as TOP, which sets TOV1 as the count reaches TOP rather than as it wraps, so the period is read
+	// as running from TOP to TOP - 1 and the overflow interrupt is taken at its start.
+	// getTicks() is the time base for intervals, the raw count since startTimers() (128uS at 8MHz, wrapping after six
+	// days). It reads without disabling interrupts, going round again if an overflow is taken under it, and does no
+	// scaling, so intervals are kept in counts and compared against TIMER1TICKS() constants. getTime() is the same count
+	// in milliseconds, for the event trace and fault log where a record is stamped rather than on the hot path.
+	// tools/SimBench.c sets the two's cycles against each other (BENCH_GETTICKS and BENCH_GETTIME), though it hasn't been
+	// run under simavr yet so there are no figures for either.
+	#define TIMER1TOP (F_CPU / 4000 - 1) // 1999 at 8MHz
+	#define TIMER1TICKS(_ms) ((uint_fast32_t)(((uint32_t)(_ms) * (F_CPU / 1024) + 500) / 1000)) // Counts in _ms, for noIntWait() and getTicks() intervals
+
 	void initTimers();
 	void startTimers();
 	void stopTimers();
@@ -8,7 +22,9 @@
 	void msWait(uint_fast32_t duration);
 	void tickWait();
 	uint_fast32_t getTime();
+	uint_fast32_t getTicks();
 	uint_fast32_t getTickNumber();
+	void timerSkip(uint_fast32_t cycles); // F_CPU cycles the I/O clock was stopped for, added back to Timer-1
 
 	uint_fast16_t noIntTimerStart();
 	uint_fast8_t noIntTimerEnded();
@@ -0,0 +1,77 @@
+#ifndef UNITS_H_
+#define UNITS_H_
+
+	// Board description and the conversions between ADC counts, Timer-1 counts and engineering units
+	// Everything here is worked out by the compiler from the board's sense resistor, voltage divider and ADC reference
+	// along with F_CPU and the free running ADC rate. Tables are written in mA and mV with UNITS_CURRENT() and
+	// UNITS_VOLTAGE(), which fold to raw counts. The safety limits in BikeLightController.c are written the same way but
+	// each is pinned to the raw count it always was, so that a change to the figures below can't move them. The inline
+	// conversions the other way multiply by a fixed point scale and shift, there's no division at run time.
+	// tools/UnitsTest.c checks each scale against the exact floating point figure on the host.
+
+	#include <stdint.h>
+
+	#include "Clock.h"
+
+	// The board, override any of these with -D for a different one. The shunt and divider are nominal rather than read off
+	// the schematic, picked so that the raw limits come to round figures: 20 counts is 2.15A and 600 counts 5.99V. They
+	// can't all be right, at them the capacity limit's 1574074 counts is 9.77mAh rather than anything near a pack's.
+	#ifndef BOARD_VREF_MV
+		#define BOARD_VREF_MV 1100 // Internal reference, REFS1 and REFS0
+	#endif
+
+	#ifndef BOARD_SHUNT_MILLIOHM
+		#define BOARD_SHUNT_MILLIOHM 10 // Current sense resistor, ADC7
+	#endif
+
+	#ifndef BOARD_SENSEGAIN
+		#define BOARD_SENSEGAIN 1 // Amplifier between the sense resistor and ADC7, if any
+	#endif
+
+	#ifndef BOARD_DIVIDER_HIGH
+		#define BOARD_DIVIDER_HIGH 68000 // Supply voltage divider to ADC3, ohms
+	#endif
+
+	#ifndef BOARD_DIVIDER_LOW
+		#define BOARD_DIVIDER_LOW 8200
+	#endif
+
+	#define UNITS_ADCCOUNTS 1024 // Ten bits full scale
+	#define UNITS_ADCCONVCYCLES (13 * 128) // F_CPU cycles per free running conversion, 13 ADC clocks at F_CPU / 128
+	#define UNITS_ACCPERCOUNT 2 // getAccumulatedCurrent() adds twice the reading for each current conversion, every other one
+
+	// Figures to raw counts, rounded to the nearest, for constant arguments only
+	#define UNITS_CURRENT(_mA) ((uint_fast16_t)(((uint64_t)(_mA) * BOARD_SHUNT_MILLIOHM * BOARD_SENSEGAIN * UNITS_ADCCOUNTS + \
+		UNITS_CURRENTDIV / 2) / UNITS_CURRENTDIV))
+	#define UNITS_VOLTAGE(_mV) ((uint_fast16_t)(((uint64_t)(_mV) * BOARD_DIVIDER_LOW * UNITS_ADCCOUNTS + UNITS_VOLTAGEDIV / 2) / \
+		UNITS_VOLTAGEDIV))
+	#define UNITS_CHARGE(_mAh) ((uint_fast32_t)(((uint64_t)(_mAh) * 3600 * BOARD_SHUNT_MILLIOHM * BOARD_SENSEGAIN * \
+		UNITS_ADCCOUNTS * UNITS_ACCPERCOUNT * (F_CPU / 2) + UNITS_CHARGEDIV / 2) / UNITS_CHARGEDIV))
+
+	#define UNITS_CURRENTDIV ((uint64_t)BOARD_VREF_MV * 1000) // mA x mOhm is uV
+	#define UNITS_VOLTAGEDIV ((uint64_t)BOARD_VREF_MV * (BOARD_DIVIDER_HIGH + BOARD_DIVIDER_LOW))
+	#define UNITS_CHARGEDIV (UNITS_CURRENTDIV * UNITS_ADCCONVCYCLES) // Current conversions at F_CPU / 2 / UNITS_ADCCONVCYCLES
+
+	// Fixed point scales for the conversions at run time
+	#define UNITS_MAPERCOUNT_Q8 ((uint_fast32_t)((((uint64_t)BOARD_VREF_MV * 1000 << 8) + UNITS_ADCCOUNTS * BOARD_SHUNT_MILLIOHM * \
+		BOARD_SENSEGAIN / 2) / (UNITS_ADCCOUNTS * BOARD_SHUNT_MILLIOHM * BOARD_SENSEGAIN)))
+	#define UNITS_MVPERCOUNT_Q8 ((uint_fast32_t)((((uint64_t)BOARD_VREF_MV * (BOARD_DIVIDER_HIGH + BOARD_DIVIDER_LOW) << 8) + \
+		(uint64_t)UNITS_ADCCOUNTS * BOARD_DIVIDER_LOW / 2) / ((uint64_t)UNITS_ADCCOUNTS * BOARD_DIVIDER_LOW)))
+	#define UNITS_MSPERTIMER1_Q16 ((uint_fast32_t)(((1024000ULL << 16) + F_CPU / 2) / F_CPU)) // Timer-1 at F_CPU / 1024
+
+	static inline uint_fast16_t unitsCurrentMA(uint_fast16_t counts)
+	{
+		return ((uint_fast32_t)counts * UNITS_MAPERCOUNT_Q8 + 0x80) >> 8;
+	}
+
+	static inline uint_fast16_t unitsVoltageMV(uint_fast16_t counts)
+	{
+		return ((uint_fast32_t)counts * UNITS_MVPERCOUNT_Q8 + 0x80) >> 8;
+	}
+
+	static inline uint_fast16_t unitsTimer1MS(uint_fast16_t counts) // Counts into the current Timer-1 period, rounded
+	{
+		return ((uint32_t)counts * UNITS_MSPERTIMER1_Q16 + 0x8000) >> 16;
+	}
+
+#endif /* UNITS_H_ */
\ No newline at end of file
@@ -0,0 +1,1262 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <compat/twi.h>
+
+#include <stdint.h>
+#include <string.h>
+#include <setjmp.h>
+
+#include "HostPeripherals.h"
+
+#define HOSTPOLLCYCLES 4 // Charged for each poll of TCNT1 or SREG, roughly the cost of the load and test around it
+#define HOSTWDTCYCLES 8 // Charged for each watchdog kick, stands in for the rest of the loop it sits in
+#define HOSTMAXDISPATCH 16 // Back to back ISRs allowed per service before time has to move on
+#define HOSTUDRNONE 0xFFFF // UDR0 before a data register empty interrupt, anything else afterwards was written by it
+#define HOSTEEATOMICCYCLES (F_CPU * 34 / 10000) // Erase and write, 3.4ms
+#define HOSTEESPLITCYCLES (F_CPU * 18 / 10000) // Erase only or write only, 1.8ms
+#define HOSTLAZYCYCLES 64 // Short advances are batched up to this many cycles, which bounds the added interrupt latency
+#define HOSTISRENTRYCYCLES 40 // Response, prologue and, for the nested handlers, up to the sei(), SimBench's nested entry once measured
+// The rest of each handler that returns, with interrupts off unless it nests (see Hal.h)
+#define HOSTTIMER2BODYCYCLES 80
+#define HOSTTIMER1BODYCYCLES 16
+#define HOSTUSARTBODYCYCLES 24
+#define HOSTADCBODYCYCLES 200
+#define HOSTTWIBODYCYCLES 60
+
+// TWI bus actions, each takes its bit times from the TWCR write that started it and then sets TWINT
+#define TWINONE 0
+#define TWISTART 1
+#define TWIRESTART 2
+#define TWISLA 3 // The address and direction in TWDR
+#define TWITX 4 // Master sending TWDR
+#define TWIRX 5 // Master receiving into TWDR
+#define TWIOTHERSLA 6 // The other master's start and address
+#define TWISRX 7 // Slave receiving from the other master
+#define TWISTX 8 // Slave sending TWDR to it
+#define TWISTOP 9 // The other master's stop
+#define TWIMSTOP 10 // The firmware's, TWSTO stays set until it's on the bus
+
+#define TWIIDLE 0 // Bus free
+#define TWIMASTER 1 // The firmware's transaction
+#define TWISLAVE 2 // The other master's
+
+// The register file
+volatile uint8_t DDRB, PORTB, DDRC, PORTC, DDRD, PORTD;
+volatile uint8_t TIFR0, TIFR1, TIFR2, PCIFR, EIFR, EIMSK;
+volatile uint8_t GPIOR0, GPIOR1, GPIOR2;
+volatile uint8_t GTCCR;
+volatile uint8_t TCCR0A, TCCR0B, TCNT0, OCR0A, OCR0B;
+volatile uint8_t SPCR, SPSR, SPDR;
+volatile uint8_t ACSR, SMCR, MCUSR, MCUCR, SPMCSR;
+volatile uint8_t WDTCSR, CLKPR, PRR, OSCCAL;
+volatile uint8_t PCICR, EICRA, PCMSK0, PCMSK1, PCMSK2;
+volatile uint8_t TIMSK0, TIMSK1, TIMSK2;
+volatile uint8_t ADCSRA, ADCSRB, ADMUX, DIDR0, DIDR1;
+volatile uint8_t TCCR1A, TCCR1B, TCCR1C;
+volatile uint8_t TCCR2A, TCCR2B, TCNT2, OCR2A, OCR2B, ASSR;
+volatile uint8_t TWBR, TWSR, TWAR, TWDR, TWAMR; // TWCR is kept in the TWI model
+volatile uint8_t UCSR0A, UCSR0B, UCSR0C;
+volatile uint16_t ADC, EEAR, ICR1, OCR1A, OCR1B, UBRR0, UDR0, SP;
+
+// Weak so that modules left out of the build (or compiled out) simply never get dispatched
+void INT0_vect(void) __attribute__((weak));
+void WDT_vect(void) __attribute__((weak));
+void TIMER2_COMPA_vect(void) __attribute__((weak));
+void TIMER1_OVF_vect(void) __attribute__((weak));
+void USART_UDRE_vect(void) __attribute__((weak));
+void USART_TX_vect(void) __attribute__((weak));
+void ADC_vect(void) __attribute__((weak));
+void ANALOG_COMP_vect(void) __attribute__((weak));
+void TWI_vect(void) __attribute__((weak));
+
+struct HostHooks hostHooks;
+
+static struct {
+	uint64_t cycles;
+	uint64_t stopAt;
+	uint64_t haltCycle;
+	uint64_t lastKick;
+	uint64_t hangAt; // Cycle from which the main line stops kicking the watchdog, zero for never
+	uint32_t lazyCycles; // Not yet stepped through the peripherals
+	uint32_t untilEvent; // From the last step to the next peripheral event
+	uint32_t timer0Acc;
+	uint32_t timer1Acc;
+	uint32_t timer2Acc;
+	uint32_t adcRemaining; // Cycles left in the conversion in progress
+	uint32_t usartRemaining; // Cycles until the transmitter can take another byte
+	uint16_t tcnt1;
+	uint16_t tcnt1Seen;
+	uint8_t tcnt1Repeats; // Consecutive polls that saw the same count
+	uint8_t sreg;
+	uint8_t adcBusy;
+	uint8_t adcWarm; // Converted since it was enabled, so conversions take 13 ADC clocks rather than 25
+	uint8_t adcMux; // Latched at the start of each conversion, as the hardware does
+	uint8_t running; // Inside hostRun(), register reads made by a harness outside it leave time alone
+	uint8_t inIsr;
+	uint8_t sleeping;
+	uint8_t seenSei; // Since the reset, the boot runs with interrupts off until it's set up
+	uint32_t dispatched;
+	uint32_t isrBody; // Still to count for the handler under way, unless it nests
+	uint32_t masked; // CPU cycles since interrupts were last seen on
+	uint64_t raisedAt[2]; // HOSTSAFETY_..., when the enabled interrupt was raised, zero once taken
+	uint32_t heldUp[2]; // And the handlers' cycles counted while it was waiting
+	struct HostPin {
+		volatile uint8_t *port;
+		volatile uint8_t *ddr;
+		uint8_t inputs; // Externally driven levels
+		uint8_t handed; // What the last read returned
+		uint8_t scratch; // Where the firmware's reads and writes land
+	} pin[3];
+	struct {
+		uint8_t twcr; // As the module has it
+		uint8_t handed; // What the last access returned
+		uint8_t scratch; // Where the firmware's reads and writes land
+		uint8_t mode; // TWIIDLE...
+		uint8_t action; // TWINONE...
+		uint8_t ack; // To send after the byte being received, or the firmware's TWEA as it sends one
+		uint8_t data; // The other master's byte on its way
+		uint8_t acked; // Bytes of the other master's transaction acked
+		uint8_t startWaiting; // TWSTA set with the bus taken
+		uint8_t scl; // Level driven through PORTC with the module off
+		uint32_t remaining; // Cycles until the action completes
+	} twi;
+	jmp_buf exitPoint;
+} host;
+
+// Outside host so that they carry on across hostReset()
+static struct HostClockStats clockStats;
+static struct HostLatencyStats latencyStats;
+static uint8_t clockShiftSeen;
+static struct {
+	uint64_t start[HOSTBENCHIDS];
+	uint8_t open[HOSTBENCHIDS];
+	struct HostBenchStats stats[HOSTBENCHIDS];
+} bench;
+
+// Outside host so that the contents survive hostReset()
+static struct {
+	uint8_t mem[E2END + 1];
+	uint8_t formatted;
+	uint8_t eecr;
+	uint8_t eedr;
+	uint8_t addr; // Latched as programming starts
+	uint8_t data;
+	uint8_t mode; // EEPM1:0
+	uint32_t remaining; // Cycles left programming, EEPE stays set until they run out
+} eeprom;
+
+static void advance(uint32_t nCycles);
+static void skip(uint32_t nCycles);
+static void isrCycles(uint32_t nCycles);
+static void maskedEnd(void);
+static void service(void);
+static void step(uint32_t nCycles);
+static uint32_t nextEvent(void);
+static uint32_t wdtTimeout(void);
+static uint8_t cpuShift(void);
+static uint8_t timer1Mode(void);
+static uint8_t timer1TovAtTop(void);
+static uint16_t timer1Top(void);
+static uint32_t timer0Prescale(void);
+static uint32_t timer1Prescale(void);
+static uint32_t timer2Prescale(void);
+static uint32_t adcPrescale(void);
+static uint8_t adcTimer0Triggered(void);
+static uint32_t usartByteCycles(void);
+static void syncPins(void);
+static void eepromFormat(void);
+static void eepromStart(void);
+static void eepromComplete(void);
+static uint8_t pinLevels(struct HostPin *pin);
+static void syncTwi(void);
+static void twiWrite(uint8_t value);
+static uint8_t twiSlaveWrite(uint8_t value);
+static void twiMasterWrite(uint8_t value);
+static void twiComplete(void);
+static void twiIdle(void);
+static void twiAction(uint8_t action, uint8_t nBits);
+static void twiStatus(uint8_t status);
+static void twiAbandon(void);
+static void twiPins(void);
+
+void hostReset(uint8_t resetSource)
+{
+	uint64_t cycles = host.cycles;
+	uint64_t stopAt = host.stopAt;
+	uint64_t hangAt = host.hangAt;
+
+	DDRB = PORTB = DDRC = PORTC = DDRD = PORTD = 0;
+	TIFR0 = TIFR1 = TIFR2 = PCIFR = EIFR = EIMSK = 0;
+	GPIOR0 = GPIOR1 = GPIOR2 = 0;
+	GTCCR = 0;
+	eeprom.eecr = eeprom.eedr = 0;
+	eeprom.remaining = 0; // Whatever was being programmed is left as it was
+	TCCR0A = TCCR0B = TCNT0 = OCR0A = OCR0B = 0;
+	ACSR = (1<<ACO); // Over current comparator not tripped
+	SMCR = MCUCR = 0;
+	MCUSR = resetSource;
+	WDTCSR = CLKPR = PRR = 0;
+	PCICR = EICRA = PCMSK0 = PCMSK1 = PCMSK2 = 0;
+	TIMSK0 = TIMSK1 = TIMSK2 = 0;
+	ADCSRA = ADCSRB = ADMUX = DIDR0 = DIDR1 = 0;
+	TCCR1A = TCCR1B = TCCR1C = 0;
+	TCCR2A = TCCR2B = TCNT2 = OCR2A = OCR2B = 0;
+	TWBR = TWDR = TWAMR = 0;
+	TWSR = 0xF8;
+	TWAR = 0xFE;
+	UCSR0A = (1<<UDRE0);
+	UCSR0B = 0;
+	UCSR0C = (1<<UCSZ01) | (1<<UCSZ00);
+	UDR0 = 0;
+	ADC = EEAR = ICR1 = OCR1A = OCR1B = UBRR0 = 0;
+	SP = RAMEND;
+
+	memset(&host, 0, sizeof(host));
+	memset(bench.open, 0, sizeof(bench.open));
+	host.cycles = host.lastKick = cycles;
+	host.stopAt = stopAt;
+	host.hangAt = hangAt;
+	host.pin[0] = (struct HostPin){&PORTB, &DDRB, 0xFF, 0xFF, 0xFF};
+	host.pin[1] = (struct HostPin){&PORTC, &DDRC, 0xFF, 0xFF, 0xFF};
+	host.pin[2] = (struct HostPin){&PORTD, &DDRD, 0xFF, 0xFF, 0xFF}; // PD2 high, low power not signalled
+	host.twi.scl = 1;
+}
+
+int hostRun(int (*entry)(void))
+{
+	int rVal = setjmp(host.exitPoint);
+
+	if(rVal == 0) {
+		host.running = 1;
+		entry();
+	}
+	host.running = 0;
+	host.inIsr = 0;
+	host.sleeping = 0;
+
+	return rVal;
+}
+
+void hostStopAt(uint64_t cycle)
+{
+	host.stopAt = cycle;
+}
+
+void hostHangAt(uint64_t cycle)
+{
+	host.hangAt = cycle;
+}
+
+uint64_t hostCycles(void)
+{
+	return host.cycles + host.lazyCycles;
+}
+
+uint64_t hostHaltCycle(void)
+{
+	return host.haltCycle;
+}
+
+void hostClockStats(struct HostClockStats *stats)
+{
+	*stats = clockStats;
+}
+
+void hostLatencyStats(struct HostLatencyStats *stats)
+{
+	*stats = latencyStats;
+}
+
+void hostBenchStats(uint8_t id, struct HostBenchStats *stats)
+{
+	*stats = bench.stats[id % HOSTBENCHIDS];
+}
+
+void hostBenchMark(uint8_t marker)
+{
+	uint8_t id = (marker >> 1) % HOSTBENCHIDS;
+	uint64_t elapsed;
+
+	if(!(marker & 1)) {
+		bench.start[id] = hostCycles();
+		bench.open[id] = 1;
+	} else if(bench.open[id]) { // Not one a reset cut short
+		elapsed = hostCycles() - bench.start[id];
+		bench.open[id] = 0;
+		bench.stats[id].count++;
+		bench.stats[id].total += elapsed;
+		bench.stats[id].max = elapsed > bench.stats[id].max ? elapsed : bench.stats[id].max;
+	}
+}
+
+void hostAdvanceCycles(uint32_t nCycles)
+{
+	// What's charged for instructions makes up the stretches with interrupts off, the skips that stand in for busy waits
+	// don't. Only stretches the firmware comes back from count, the one HALT() spins in never ends.
+	if(host.sreg & 0x80) {
+		maskedEnd();
+	} else if(host.seenSei) {
+		host.masked += nCycles;
+	}
+	advance(nCycles << cpuShift());
+}
+
+static void advance(uint32_t nCycles)
+{
+	if(host.lazyCycles + nCycles < HOSTLAZYCYCLES && host.lazyCycles + nCycles < host.untilEvent) {
+		host.lazyCycles += nCycles;
+		return;
+	}
+	nCycles += host.lazyCycles;
+	host.lazyCycles = 0;
+
+	service();
+	while(nCycles != 0) {
+		uint32_t nStep = nextEvent();
+
+		if(nStep > nCycles) {
+			nStep = nCycles;
+		}
+		step(nStep);
+		nCycles -= nStep;
+		service();
+	}
+	host.untilEvent = nextEvent();
+}
+
+static void skip(uint32_t nCycles) // As advance() but stops once a handler has run
+{
+	uint32_t dispatched = host.dispatched;
+
+	nCycles += host.lazyCycles;
+	host.lazyCycles = 0;
+
+	service();
+	while(nCycles != 0 && dispatched == host.dispatched) {
+		uint32_t nStep = nextEvent();
+
+		if(nStep > nCycles) {
+			nStep = nCycles;
+		}
+		step(nStep);
+		nCycles -= nStep;
+		service();
+	}
+	host.untilEvent = nextEvent();
+}
+
+void hostSetOverCurrent(uint8_t tripped)
+{
+	uint8_t wasLow = !(ACSR & (1<<ACO));
+
+	if(tripped) {
+		ACSR &= (uint8_t)~(1<<ACO);
+	} else {
+		ACSR |= (1<<ACO);
+	}
+
+	if(!(ACSR & (1<<ACD))) {
+		uint8_t mode = ACSR & ((1<<ACIS1) | (1<<ACIS0));
+		uint8_t fell = tripped && !wasLow;
+		uint8_t rose = !tripped && wasLow;
+
+		if((mode == 0 && (fell || rose)) || (mode == (1<<ACIS1) && fell) || (mode == ((1<<ACIS1) | (1<<ACIS0)) && rose)) {
+			if((ACSR & (1<<ACIE)) && !(ACSR & (1<<ACI))) {
+				host.raisedAt[HOSTSAFETY_OVERCURRENT] = hostCycles();
+				host.heldUp[HOSTSAFETY_OVERCURRENT] = 0;
+			}
+			ACSR |= (1<<ACI);
+		}
+	}
+}
+
+void hostSetLowPower(uint8_t tripped)
+{
+	uint8_t wasLow = !(host.pin[2].inputs & (1<<PD2));
+	uint8_t wasRaised = (EICRA & ((1<<ISC01) | (1<<ISC00))) ? EIFR & (1<<INTF0) : wasLow;
+
+	if(tripped) {
+		host.pin[2].inputs &= (uint8_t)~(1<<PD2);
+	} else {
+		host.pin[2].inputs |= (1<<PD2);
+	}
+
+	switch(EICRA & ((1<<ISC01) | (1<<ISC00))) {
+		case (1<<ISC00): // Any change
+			if(tripped != wasLow) {
+				EIFR |= (1<<INTF0);
+			}
+			break;
+		case (1<<ISC01): // Falling edge
+			if(tripped && !wasLow) {
+				EIFR |= (1<<INTF0);
+			}
+			break;
+		case (1<<ISC01) | (1<<ISC00): // Rising edge
+			if(!tripped && wasLow) {
+				EIFR |= (1<<INTF0);
+			}
+			break;
+		default: // Low level, no flag
+			break;
+	}
+
+	if(!wasRaised && ((EICRA & ((1<<ISC01) | (1<<ISC00))) ? EIFR & (1<<INTF0) : tripped) && (EIMSK & (1<<INT0))) {
+		host.raisedAt[HOSTSAFETY_LOWPOWER] = hostCycles();
+		host.heldUp[HOSTSAFETY_LOWPOWER] = 0;
+	}
+}
+
+volatile uint8_t *hostPin(volatile uint8_t *port)
+{
+	struct HostPin *pin = host.pin + (port == &PORTB ? 0 : port == &PORTC ? 1 : 2);
+
+	syncPins();
+	pin->handed = pin->scratch = pinLevels(pin);
+
+	return &pin->scratch;
+}
+
+volatile uint16_t *hostTCNT1(void)
+{
+	if(host.running && !host.inIsr) {
+		uint32_t prescale = timer1Prescale();
+		uint32_t toTick = prescale - host.timer1Acc;
+
+		// Busy waiting on the counter so skip to its next count, or to the first handler on the way as it may have set what
+		// the loop waits for, though with interrupts off only if nothing else would happen on the way. Back to back reads
+		// under cli() (getTime() called in quick succession) aren't a busy wait and skipping there could lose an interrupt
+		// that the hardware would have taken
+		if(host.tcnt1Repeats >= 2 && prescale && !(PRR & (1<<PRTIM1)) && ((host.sreg & 0x80) || host.lazyCycles + toTick < nextEvent())) {
+			skip(toTick);
+		} else {
+			hostAdvanceCycles(HOSTPOLLCYCLES);
+		}
+		host.tcnt1Repeats = host.tcnt1 == host.tcnt1Seen ? host.tcnt1Repeats + 1 : 0;
+		host.tcnt1Seen = host.tcnt1;
+	}
+
+	return &host.tcnt1;
+}
+
+volatile uint8_t *hostTWCR(void)
+{
+	syncTwi();
+	host.twi.handed = host.twi.scratch = host.twi.twcr;
+
+	return &host.twi.scratch;
+}
+
+volatile uint8_t *hostEECR(void)
+{
+	eepromStart();
+	if(eeprom.remaining && host.running) { // Busy waiting on EEPE, skip to the end of the programming
+		advance(eeprom.remaining);
+	}
+
+	return &eeprom.eecr;
+}
+
+volatile uint8_t *hostEEDR(void)
+{
+	eepromStart();
+
+	return &eeprom.eedr;
+}
+
+uint8_t *hostEeprom(void)
+{
+	eepromFormat();
+
+	return eeprom.mem;
+}
+
+volatile uint8_t *hostSREG(void)
+{
+	if(host.running && !host.inIsr) {
+		hostAdvanceCycles(HOSTPOLLCYCLES);
+	}
+
+	return &host.sreg;
+}
+
+void hostSei(void)
+{
+	host.sreg |= 0x80; // As on the AVR the next instruction (typically the sleep) runs before any interrupt is taken
+	host.seenSei = 1;
+	if(host.inIsr) { // A nested handler, the rest of it doesn't hold anything off
+		host.isrBody = 0;
+		maskedEnd();
+	}
+}
+
+void hostSleep(void)
+{
+	uint32_t dispatched = host.dispatched;
+
+	if(!(SMCR & (1<<SE))) {
+		return;
+	}
+
+	if((SMCR & ((1<<SM2) | (1<<SM1) | (1<<SM0))) == (1<<SM0) && (ADCSRA & (1<<ADEN)) && !(ADCSRA & (1<<ADSC))) {
+		ADCSRA |= (1<<ADSC); // Entering ADC noise reduction starts a conversion
+	}
+
+	host.sleeping = 1;
+	do {
+		advance(nextEvent());
+	} while(dispatched == host.dispatched);
+	host.sleeping = 0;
+	clockStats.wakes++;
+}
+
+void hostWdtReset(void)
+{
+	if(host.running && !host.inIsr && host.hangAt != 0 && host.cycles >= host.hangAt) { // Stuck here, interrupts carry on
+		host.hangAt = 0;
+		for(;;) {
+			step(nextEvent());
+			service();
+		}
+	}
+
+	host.lastKick = host.cycles;
+	if(host.running && !host.inIsr) {
+		hostAdvanceCycles(HOSTWDTCYCLES);
+	}
+}
+
+void hostHalt(void)
+{
+	if(host.haltCycle == 0) {
+		host.haltCycle = host.cycles;
+	}
+
+	for(;;) { // Spin, with any interrupts still enabled running, until the watchdog or the end of the simulation
+		step(nextEvent());
+		service();
+	}
+}
+
+static void service(void)
+{
+	syncPins();
+	syncTwi();
+	twiPins();
+	twiIdle();
+
+	if(host.stopAt != 0 && host.cycles >= host.stopAt) {
+		longjmp(host.exitPoint, HOSTEXIT_TIMEUP);
+	}
+	if((WDTCSR & ((1<<WDE) | (1<<WDIE))) && (host.cycles - host.lastKick) >= wdtTimeout()) {
+		if((WDTCSR & (1<<WDIE)) && !(WDTCSR & (1<<WDIF))) { // Interrupt first, a reset needs another timeout on top
+			WDTCSR |= (1<<WDIF);
+			host.lastKick = host.cycles;
+		} else if(WDTCSR & (1<<WDE)) {
+			MCUSR |= (1<<WDRF);
+			longjmp(host.exitPoint, HOSTEXIT_WATCHDOG);
+		} else {
+			host.lastKick = host.cycles;
+		}
+	}
+
+	for(uint8_t nDispatch = 0; nDispatch < HOSTMAXDISPATCH && (host.sreg & 0x80) && !host.inIsr; nDispatch++) {
+		void (*vector)(void) = NULL;
+		uint32_t bodyCycles = 0; // The safety handlers and the watchdog's never return
+
+		// In vector table (priority) order
+		if((EIMSK & (1<<INT0)) && INT0_vect) {
+			if((EICRA & ((1<<ISC01) | (1<<ISC00))) == 0) {
+				if(!(host.pin[2].inputs & (1<<PD2))) {
+					vector = INT0_vect;
+				}
+			} else if(EIFR & (1<<INTF0)) {
+				EIFR &= (uint8_t)~(1<<INTF0);
+				vector = INT0_vect;
+			}
+		}
+		if(!vector && (WDTCSR & (1<<WDIE)) && (WDTCSR & (1<<WDIF)) && WDT_vect) {
+			WDTCSR &= (uint8_t)~((WDTCSR & (1<<WDE)) ? ((1<<WDIF) | (1<<WDIE)) : (1<<WDIF)); // Back to reset only in interrupt and reset mode
+			vector = WDT_vect;
+		}
+		if(!vector && (TIMSK2 & (1<<OCIE2A)) && (TIFR2 & (1<<OCF2A)) && TIMER2_COMPA_vect) {
+			TIFR2 &= (uint8_t)~(1<<OCF2A);
+			vector = TIMER2_COMPA_vect;
+			bodyCycles = HOSTTIMER2BODYCYCLES;
+		}
+		if(!vector && (TIMSK1 & (1<<TOIE1)) && (TIFR1 & (1<<TOV1)) && TIMER1_OVF_vect) {
+			TIFR1 &= (uint8_t)~(1<<TOV1);
+			vector = TIMER1_OVF_vect;
+			bodyCycles = HOSTTIMER1BODYCYCLES;
+		}
+		if(!vector && (UCSR0B & (1<<UDRIE0)) && (UCSR0A & (1<<UDRE0)) && USART_UDRE_vect) {
+			UDR0 = HOSTUDRNONE;
+			vector = USART_UDRE_vect;
+			bodyCycles = HOSTUSARTBODYCYCLES;
+		}
+		if(!vector && (UCSR0B & (1<<TXCIE0)) && (UCSR0A & (1<<TXC0)) && USART_TX_vect) {
+			UCSR0A &= (uint8_t)~(1<<TXC0);
+			vector = USART_TX_vect;
+			bodyCycles = HOSTUSARTBODYCYCLES;
+		}
+		if(!vector && (ADCSRA & (1<<ADIE)) && (ADCSRA & (1<<ADIF)) && ADC_vect) {
+			ADCSRA &= (uint8_t)~(1<<ADIF);
+			vector = ADC_vect;
+			bodyCycles = HOSTADCBODYCYCLES;
+		}
+		if(!vector && (ACSR & (1<<ACIE)) && (ACSR & (1<<ACI)) && ANALOG_COMP_vect) {
+			ACSR &= (uint8_t)~(1<<ACI);
+			vector = ANALOG_COMP_vect;
+		}
+		if(!vector && (host.twi.twcr & (1<<TWIE)) && (host.twi.twcr & (1<<TWINT)) && TWI_vect) { // TWINT is left to the handler
+			vector = TWI_vect;
+			bodyCycles = HOSTTWIBODYCYCLES;
+		}
+
+		if(!vector) {
+			break;
+		}
+
+		if(vector == INT0_vect || vector == ANALOG_COMP_vect) {
+			uint8_t safety = vector == INT0_vect ? HOSTSAFETY_LOWPOWER : HOSTSAFETY_OVERCURRENT;
+
+			if(host.raisedAt[safety]) {
+				uint32_t latency = (uint32_t)((hostCycles() - host.raisedAt[safety]) >> cpuShift()) + host.heldUp[safety];
+
+				latencyStats.taken[safety]++;
+				latencyStats.maxLatency[safety] = latency > latencyStats.maxLatency[safety] ? latency : latencyStats.maxLatency[safety];
+				host.raisedAt[safety] = 0;
+			}
+		}
+
+		maskedEnd(); // Back to back handlers are separate stretches, anything pending is taken in order in between
+		host.inIsr = 1;
+		host.sreg &= (uint8_t)~0x80;
+		isrCycles(HOSTISRENTRYCYCLES);
+		host.isrBody = bodyCycles;
+			vector();
+		syncTwi(); // Its last write to TWCR
+		isrCycles(host.isrBody); // Zero if it nested
+		host.sreg |= 0x80;
+		maskedEnd();
+		host.inIsr = 0;
+		host.dispatched++;
+
+		if(vector == USART_UDRE_vect && UDR0 != HOSTUDRNONE) { // Transmitter busy for a byte time, ignoring its second buffer
+			UCSR0A &= (uint8_t)~(1<<UDRE0);
+			host.usartRemaining = usartByteCycles();
+			if(hostHooks.usartTx) {
+				hostHooks.usartTx(UDR0);
+			}
+		}
+	}
+}
+
+// Handlers run in no time, their cycles are only counted against the stretch with interrupts off and any safety
+// interrupt kept waiting
+static void isrCycles(uint32_t nCycles)
+{
+	host.masked += nCycles;
+	for(uint8_t safety = 0; safety < 2; safety++) {
+		if(host.raisedAt[safety]) {
+			host.heldUp[safety] += nCycles;
+		}
+	}
+}
+
+static void maskedEnd(void)
+{
+	latencyStats.maxMasked = host.masked > latencyStats.maxMasked ? host.masked : latencyStats.maxMasked;
+	host.masked = 0;
+}
+
+static void step(uint32_t nCycles)
+{
+	uint8_t clkIO = !host.sleeping || (SMCR & ((1<<SM2) | (1<<SM1) | (1<<SM0))) == 0; // Only idle sleep keeps the I/O clock
+	uint8_t shift = cpuShift();
+	uint8_t adcTrigger = 0;
+	uint32_t prescale;
+
+	host.cycles += nCycles;
+
+	// Clock statistics
+	if(host.sleeping) {
+		clockStats.asleep[shift != 0] += nCycles;
+	} else {
+		clockStats.awake[shift != 0] += nCycles;
+	}
+	clockStats.cpuClocks += host.sleeping ? 0 : nCycles >> shift;
+	clockStats.ioClocks += clkIO ? nCycles >> shift : 0;
+	if(shift != clockShiftSeen) {
+		clockShiftSeen = shift;
+		clockStats.switches++;
+	}
+
+	// Timer-0/1 prescaler
+	if(GTCCR & (1<<PSRSYNC)) { // Prescaler reset, cleared by the hardware unless held by TSM
+		host.timer0Acc = host.timer1Acc = 0;
+		if(!(GTCCR & (1<<TSM))) {
+			GTCCR &= (uint8_t)~(1<<PSRSYNC);
+		}
+	}
+	// Timer-0, CTC on OCR0A or counting to 0xFF, only its flags are modelled
+	prescale = timer0Prescale();
+	if(clkIO && prescale && !(PRR & (1<<PRTIM0))) {
+		uint32_t counts;
+		uint32_t tNew;
+		uint8_t ctc = (TCCR0A & ((1<<WGM01) | (1<<WGM00))) == (1<<WGM01);
+
+		host.timer0Acc += nCycles;
+		counts = host.timer0Acc / prescale;
+		host.timer0Acc %= prescale;
+
+		tNew = TCNT0 + counts;
+		if(ctc && TCNT0 <= OCR0A && tNew > OCR0A) {
+			tNew = (tNew - OCR0A - 1) % ((uint32_t)OCR0A + 1);
+			adcTrigger = !(TIFR0 & (1<<OCF0A)); // The ADC triggers on the flag's rising edge
+			TIFR0 |= (1<<OCF0A);
+		} else if(tNew > 0xFF) { // A clk/1 PWM can wrap many times in a step
+			tNew &= 0xFF;
+			TIFR0 |= (1<<TOV0);
+		}
+		TCNT0 = tNew;
+	}
+
+	// Timer-1, normal or fast PWM with ICR1 as TOP, the latter setting TOV1 as it reaches TOP rather than as it wraps
+	prescale = timer1Prescale();
+	if(clkIO && prescale && !(PRR & (1<<PRTIM1))) {
+		uint16_t top = timer1Top();
+		uint8_t tovAtTop = timer1TovAtTop();
+		uint32_t counts;
+		uint32_t tNew;
+
+		host.timer1Acc += nCycles;
+		counts = host.timer1Acc / prescale;
+		host.timer1Acc %= prescale;
+
+		tNew = host.tcnt1 + counts;
+		if(tovAtTop && host.tcnt1 < top && tNew >= top) {
+			TIFR1 |= (1<<TOV1);
+		}
+		if(tNew > top) {
+			tNew -= (uint32_t)top + 1;
+			if(!tovAtTop || tNew >= top) {
+				TIFR1 |= (1<<TOV1);
+			}
+		}
+		host.tcnt1 = tNew;
+	}
+
+	// Timer-2, CTC on OCR2A or normal mode
+	prescale = timer2Prescale();
+	if(prescale && !(PRR & (1<<PRTIM2))) {
+		uint32_t counts;
+		uint32_t tNew;
+		uint8_t ctc = (TCCR2A & ((1<<WGM21) | (1<<WGM20))) == (1<<WGM21);
+
+		host.timer2Acc += nCycles;
+		counts = host.timer2Acc / prescale;
+		host.timer2Acc %= prescale;
+
+		tNew = TCNT2 + counts;
+		if(ctc && TCNT2 <= OCR2A && tNew > OCR2A) {
+			tNew -= (uint32_t)OCR2A + 1;
+			TIFR2 |= (1<<OCF2A);
+		} else if(tNew > 0xFF) {
+			tNew -= 0x100;
+			TIFR2 |= (1<<TOV2);
+		}
+		TCNT2 = tNew;
+	}
+
+	// The ADC, single, free running or Timer-0 triggered conversions
+	if((ADCSRA & (1<<ADEN)) && !(PRR & (1<<PRADC)) && (ADCSRA & (1<<ADSC))) {
+		if(!host.adcBusy) { // Starting a conversion, the first after enabling takes 25 ADC clocks rather than 13
+			host.adcBusy = 1;
+			host.adcRemaining = (host.adcWarm ? 13 : 25) * (uint32_t)adcPrescale();
+			host.adcWarm = 1;
+			host.adcMux = ADMUX;
+		}
+		host.adcRemaining -= nCycles < host.adcRemaining ? nCycles : host.adcRemaining;
+		if(host.adcRemaining == 0) {
+			host.adcRemaining = 13 * (uint32_t)adcPrescale();
+			ADC = hostHooks.adcInput ? (hostHooks.adcInput(host.adcMux) & 0x3FF) : 0;
+			ADCSRA |= (1<<ADIF);
+			if((ADCSRA & (1<<ADATE)) && (ADCSRB & ((1<<ADTS2) | (1<<ADTS1) | (1<<ADTS0))) == 0) { // Free running, the next conversion starts straight away on whatever ADMUX is now
+				host.adcMux = ADMUX;
+			} else {
+				ADCSRA &= (uint8_t)~(1<<ADSC);
+				host.adcBusy = 0;
+			}
+		}
+	} else {
+		host.adcBusy = 0;
+		host.adcWarm &= (ADCSRA & (1<<ADEN)) && !(PRR & (1<<PRADC));
+	}
+	if(adcTrigger && adcTimer0Triggered() && !host.adcBusy) { // Converting from the end of this step
+		ADCSRA |= (1<<ADSC);
+	}
+
+	// EEPROM programming, started by the write that set EEPE
+	eepromStart();
+	if(eeprom.remaining) {
+		eeprom.remaining -= nCycles < eeprom.remaining ? nCycles : eeprom.remaining;
+		if(eeprom.remaining == 0) {
+			eepromComplete();
+		}
+	}
+
+	// TWI, the bus action under way
+	if(host.twi.remaining) {
+		host.twi.remaining -= nCycles < host.twi.remaining ? nCycles : host.twi.remaining;
+		if(host.twi.remaining == 0) {
+			twiComplete();
+		}
+	}
+
+	// USART transmitter, only the data register empty flag is modelled
+	if(host.usartRemaining) {
+		host.usartRemaining -= nCycles < host.usartRemaining ? nCycles : host.usartRemaining;
+		if(host.usartRemaining == 0) {
+			UCSR0A |= (1<<UDRE0) | (1<<TXC0);
+		}
+	}
+}
+
+static uint32_t nextEvent(void)
+{
+	uint32_t nCycles = 0xFFFFFFFF;
+	uint32_t tCycles;
+	uint32_t prescale;
+
+	prescale = timer0Prescale();
+	if(prescale && !(PRR & (1<<PRTIM0)) && adcTimer0Triggered() && TCNT0 <= OCR0A) { // Only when it's pacing the ADC
+		tCycles = (uint32_t)(OCR0A - TCNT0) * prescale + (prescale > host.timer0Acc ? prescale - host.timer0Acc : 1);
+		nCycles = tCycles < nCycles ? tCycles : nCycles;
+	}
+
+	prescale = timer1Prescale();
+	if(prescale && !(PRR & (1<<PRTIM1))) {
+		uint16_t top = timer1Top() - (timer1TovAtTop() && host.tcnt1 < timer1Top()); // To the count that sets TOV1
+
+		tCycles = (host.tcnt1 <= top ? (uint32_t)(top - host.tcnt1) : 0) * prescale + (prescale > host.timer1Acc ? prescale - host.timer1Acc : 1);
+		nCycles = tCycles < nCycles ? tCycles : nCycles;
+	}
+
+	prescale = timer2Prescale();
+	if(prescale && !(PRR & (1<<PRTIM2))) {
+		uint8_t top = (TCCR2A & ((1<<WGM21) | (1<<WGM20))) == (1<<WGM21) && TCNT2 <= OCR2A ? OCR2A : 0xFF;
+
+		tCycles = (uint32_t)(top - TCNT2) * prescale + (prescale > host.timer2Acc ? prescale - host.timer2Acc : 1);
+		nCycles = tCycles < nCycles ? tCycles : nCycles;
+	}
+
+	if((ADCSRA & (1<<ADEN)) && !(PRR & (1<<PRADC)) && (ADCSRA & (1<<ADSC))) {
+		tCycles = host.adcBusy ? host.adcRemaining : (host.adcWarm ? 13 : 25) * (uint32_t)adcPrescale();
+		nCycles = tCycles < nCycles ? tCycles : nCycles;
+	}
+
+	if(host.usartRemaining) {
+		nCycles = host.usartRemaining < nCycles ? host.usartRemaining : nCycles;
+	}
+
+	if(host.twi.remaining) {
+		nCycles = host.twi.remaining < nCycles ? host.twi.remaining : nCycles;
+	}
+
+	if(eeprom.remaining) {
+		nCycles = eeprom.remaining < nCycles ? eeprom.remaining : nCycles;
+	}
+
+	if(WDTCSR & ((1<<WDE) | (1<<WDIE))) {
+		uint64_t kickAge = host.cycles - host.lastKick;
+
+		tCycles = kickAge < wdtTimeout() ? (uint32_t)(wdtTimeout() - kickAge) : 1;
+		nCycles = tCycles < nCycles ? tCycles : nCycles;
+	}
+
+	if(host.stopAt != 0) {
+		tCycles = host.stopAt > host.cycles ? (host.stopAt - host.cycles < 0xFFFFFFFF ? (uint32_t)(host.stopAt - host.cycles) : 0xFFFFFFFF) : 1;
+		nCycles = tCycles < nCycles ? tCycles : nCycles;
+	}
+
+	return nCycles ? nCycles : 1;
+}
+
+static uint32_t wdtTimeout(void)
+{
+	uint8_t wdp = (WDTCSR & 0x07) | ((WDTCSR & (1<<WDP3)) ? 0x08 : 0);
+
+	return (uint32_t)((2048ULL << wdp) * F_CPU / 128000); // 2K cycles of the 128KHz watchdog oscillator upwards
+}
+
+static uint8_t cpuShift(void)
+{
+	return CLKPR & ((1<<CLKPS3) | (1<<CLKPS2) | (1<<CLKPS1) | (1<<CLKPS0)); // Everything below is in cycles of the undivided clock
+}
+
+static uint8_t timer1Mode(void)
+{
+	return (TCCR1A & ((1<<WGM11) | (1<<WGM10))) | ((TCCR1B & ((1<<WGM13) | (1<<WGM12))) >> 1);
+}
+
+static uint8_t timer1TovAtTop(void)
+{
+	return timer1Mode() == 14 || timer1Mode() == 15;
+}
+
+static uint16_t timer1Top(void)
+{
+	switch(timer1Mode()) {
+		case 12: // CTC, ICR1
+		case 14: // Fast PWM, ICR1
+			return ICR1;
+		case 4: // CTC, OCR1A
+		case 15: // Fast PWM, OCR1A
+			return OCR1A;
+		default:
+			return 0xFFFF;
+	}
+}
+
+static uint32_t timer0Prescale(void)
+{
+	static const uint16_t prescale[8] = {0, 1, 8, 64, 256, 1024, 0, 0};
+
+	return (uint32_t)prescale[TCCR0B & ((1<<CS02) | (1<<CS01) | (1<<CS00))] << cpuShift();
+}
+
+static uint32_t timer1Prescale(void)
+{
+	static const uint16_t prescale[8] = {0, 1, 8, 64, 256, 1024, 0, 0};
+
+	return (uint32_t)prescale[TCCR1B & ((1<<CS12) | (1<<CS11) | (1<<CS10))] << cpuShift();
+}
+
+static uint32_t timer2Prescale(void)
+{
+	static const uint16_t prescale[8] = {0, 1, 8, 32, 64, 128, 256, 1024};
+
+	return (uint32_t)prescale[TCCR2B & ((1<<CS22) | (1<<CS21) | (1<<CS20))] << cpuShift();
+}
+
+static uint32_t adcPrescale(void)
+{
+	uint8_t adps = ADCSRA & ((1<<ADPS2) | (1<<ADPS1) | (1<<ADPS0));
+
+	return (uint32_t)(adps ? 1<<adps : 2) << cpuShift();
+}
+
+static uint8_t adcTimer0Triggered(void)
+{
+	return (ADCSRA & (1<<ADEN)) && (ADCSRA & (1<<ADATE)) &&
+		(ADCSRB & ((1<<ADTS2) | (1<<ADTS1) | (1<<ADTS0))) == ((1<<ADTS1) | (1<<ADTS0)) && // Compare match A
+		(TCCR0A & ((1<<WGM01) | (1<<WGM00))) == (1<<WGM01);
+}
+
+static uint32_t usartByteCycles(void)
+{
+	uint32_t bitCycles = (((UCSR0A & (1<<U2X0)) ? 8UL : 16UL) * (UBRR0 + 1)) << cpuShift();
+
+	return bitCycles * ((UCSR0C & (1<<USBS0)) ? 11 : 10); // Start, eight data and the stop bits
+}
+
+static void syncPins(void)
+{
+	for(uint8_t idx = 0; idx < 3; idx++) {
+		struct HostPin *pin = host.pin + idx;
+
+		if(pin->scratch != pin->handed) { // Written since it was last read, ones toggle the PORT bits
+			*pin->port ^= pin->scratch;
+			pin->handed = pin->scratch = pinLevels(pin);
+		}
+	}
+}
+
+static uint8_t pinLevels(struct HostPin *pin)
+{
+	uint8_t levels = (*pin->port & *pin->ddr) | (pin->inputs & ~*pin->ddr);
+
+	if(pin == host.pin + 1 && hostTwiSdaHeld()) { // Whatever drives it, as on the open drain bus
+		levels &= (uint8_t)~(1<<PC4);
+	}
+
+	return levels;
+}
+
+static void eepromFormat(void)
+{
+	if(!eeprom.formatted) {
+		memset(eeprom.mem, 0xFF, sizeof(eeprom.mem));
+		eeprom.formatted = 1;
+	}
+}
+
+static void eepromStart(void)
+{
+	eepromFormat();
+
+	if(eeprom.eecr & (1<<EERE)) { // Reads complete straight away
+		eeprom.eecr &= (uint8_t)~(1<<EERE);
+		eeprom.eedr = eeprom.mem[EEAR & E2END];
+	}
+	if((eeprom.eecr & (1<<EEPE)) && eeprom.remaining == 0) {
+		eeprom.addr = EEAR & E2END;
+		eeprom.data = eeprom.eedr;
+		eeprom.mode = (eeprom.eecr >> EEPM0) & 0x03;
+		eeprom.remaining = eeprom.mode == 0 ? HOSTEEATOMICCYCLES : HOSTEESPLITCYCLES;
+		eeprom.eecr &= (uint8_t)~(1<<EEMPE);
+	}
+}
+
+static void eepromComplete(void)
+{
+	switch(eeprom.mode) {
+		case 0: // Erase and write
+			eeprom.mem[eeprom.addr] = eeprom.data;
+			break;
+		case 1: // Erase only
+			eeprom.mem[eeprom.addr] = 0xFF;
+			break;
+		default: // Write only, can only clear bits
+			eeprom.mem[eeprom.addr] &= eeprom.data;
+			break;
+	}
+	eeprom.eecr &= (uint8_t)~(1<<EEPE);
+}
+
+static void syncTwi(void)
+{
+	if(host.twi.scratch != host.twi.handed) { // Written since it was last read
+		twiWrite(host.twi.scratch);
+		host.twi.handed = host.twi.scratch = host.twi.twcr;
+	}
+}
+
+static void twiWrite(uint8_t value)
+{
+	uint8_t started;
+
+	if(!(value & (1<<TWEN))) { // Module off, whatever was under way is dropped and the pins go back to the port
+		twiAbandon();
+		host.twi.twcr = value & (uint8_t)~(1<<TWINT);
+		return;
+	}
+
+	host.twi.twcr = (value & (uint8_t)~(1<<TWINT)) | (host.twi.twcr & (1<<TWINT)); // Writing a one to TWINT clears it
+	if(host.twi.action == TWIMSTOP) { // Only the module clears it
+		host.twi.twcr |= (1<<TWSTO);
+	}
+	if(!(value & (1<<TWINT))) {
+		return;
+	}
+	host.twi.twcr &= (uint8_t)~(1<<TWINT);
+
+	if(host.twi.action != TWINONE) { // Mid byte, only a start can be queued behind it
+		host.twi.startWaiting = (value & (1<<TWSTA)) != 0;
+		return;
+	}
+	if(host.twi.mode == TWISLAVE && twiSlaveWrite(value)) {
+		host.twi.startWaiting = (value & (1<<TWSTA)) != 0;
+		return;
+	}
+
+	if((value & (1<<TWSTO)) && host.twi.mode == TWIMASTER) {
+		uint8_t status = TW_STATUS;
+
+		hostTwiStop(status == TW_MT_SLA_NACK || status == TW_MR_SLA_NACK ? 2 : status == TW_MT_DATA_NACK ? 3 : 0);
+		twiStatus(TW_NO_INFO);
+		twiAction(TWIMSTOP, 1);
+		host.twi.startWaiting = (value & (1<<TWSTA)) != 0; // Goes once the bus is free
+		return;
+	}
+	host.twi.twcr &= (uint8_t)~(1<<TWSTO); // Not master, it only releases the lines
+
+	started = 0;
+	if(value & (1<<TWSTA)) {
+		if(host.twi.mode == TWIMASTER) { // Repeated start, the transaction so far has ended
+			uint8_t status = TW_STATUS;
+
+			hostTwiStop(status == TW_MT_SLA_NACK || status == TW_MR_SLA_NACK ? 2 : status == TW_MT_DATA_NACK ? 3 : 0);
+			twiAction(TWIRESTART, 1);
+			started = 1;
+		} else if(host.twi.mode == TWIIDLE && !hostTwiSdaHeld()) {
+			host.twi.mode = TWIMASTER;
+			twiAction(TWISTART, 1);
+			started = 1;
+		}
+	}
+	host.twi.startWaiting = (value & (1<<TWSTA)) && !started; // Dropped by any write without TWSTA
+	if(!started && host.twi.mode == TWIMASTER) {
+		twiMasterWrite(value);
+	}
+}
+
+static uint8_t twiSlaveWrite(uint8_t value) // Returns zero once the other master's transaction has ended
+{
+	switch(TW_STATUS) {
+		case TW_SR_SLA_ACK:
+		case TW_SR_DATA_ACK:
+			host.twi.ack = (value & (1<<TWEA)) != 0;
+			if(hostTwiOtherWrite(&host.twi.data)) {
+				twiAction(TWISRX, 9);
+			} else {
+				twiAction(TWISTOP, 1);
+			}
+			return 1;
+		case TW_SR_DATA_NACK: // It stops after a NACK
+			twiAction(TWISTOP, 1);
+			return 1;
+		case TW_ST_SLA_ACK:
+		case TW_ST_DATA_ACK:
+			host.twi.ack = (value & (1<<TWEA)) != 0;
+			host.twi.data = TWDR;
+			twiAction(TWISTX, 9);
+			return 1;
+		default: // TW_SR_STOP, TW_ST_DATA_NACK or TW_ST_LAST_DATA, no longer addressed
+			hostTwiOtherEnd(host.twi.acked);
+			host.twi.mode = TWIIDLE;
+			twiStatus(TW_NO_INFO);
+			return 0;
+	}
+}
+
+static void twiMasterWrite(uint8_t value)
+{
+	switch(TW_STATUS) {
+		case TW_START:
+		case TW_REP_START:
+			twiAction(TWISLA, 9);
+			break;
+		case TW_MT_SLA_ACK:
+		case TW_MT_DATA_ACK:
+			twiAction(TWITX, 9);
+			break;
+		case TW_MR_SLA_ACK:
+		case TW_MR_DATA_ACK:
+			host.twi.ack = (value & (1<<TWEA)) != 0;
+			twiAction(TWIRX, 9);
+			break;
+		default: // After a NACK only a stop or a start moves it on
+			break;
+	}
+}
+
+static void twiComplete(void)
+{
+	uint8_t action = host.twi.action;
+	uint8_t ack;
+
+	host.twi.action = TWINONE;
+	switch(action) {
+		case TWISTART:
+			twiStatus(TW_START);
+			break;
+		case TWIRESTART:
+			twiStatus(TW_REP_START);
+			break;
+		case TWISLA:
+			ack = hostTwiAddress(TWDR);
+			if(TWDR & TW_READ) {
+				twiStatus(ack ? TW_MR_SLA_ACK : TW_MR_SLA_NACK);
+			} else {
+				twiStatus(ack ? TW_MT_SLA_ACK : TW_MT_SLA_NACK);
+			}
+			break;
+		case TWITX:
+			twiStatus(hostTwiWrite(TWDR) ? TW_MT_DATA_ACK : TW_MT_DATA_NACK);
+			break;
+		case TWIRX:
+			TWDR = hostTwiRead(host.twi.ack);
+			twiStatus(host.twi.ack ? TW_MR_DATA_ACK : TW_MR_DATA_NACK);
+			break;
+		case TWIOTHERSLA:
+			if((host.twi.twcr & (1<<TWEN)) && (host.twi.twcr & (1<<TWEA)) && (TWAR >> 1) == (host.twi.data >> 1)) {
+				twiStatus(host.twi.data & TW_READ ? TW_ST_SLA_ACK : TW_SR_SLA_ACK);
+			} else { // Someone else's, which the model has nobody answer
+				hostTwiOtherEnd(0);
+				host.twi.mode = TWIIDLE;
+				twiIdle();
+				return;
+			}
+			break;
+		case TWISRX:
+			TWDR = host.twi.data;
+			host.twi.acked += host.twi.ack;
+			twiStatus(host.twi.ack ? TW_SR_DATA_ACK : TW_SR_DATA_NACK);
+			break;
+		case TWISTX:
+			host.twi.acked++;
+			if(!hostTwiOtherRead(host.twi.data)) {
+				twiStatus(TW_ST_DATA_NACK);
+			} else {
+				twiStatus(host.twi.ack ? TW_ST_DATA_ACK : TW_ST_LAST_DATA);
+			}
+			break;
+		case TWISTOP:
+			twiStatus(TW_SR_STOP);
+			break;
+		case TWIMSTOP: // Sets no TWINT
+			host.twi.twcr &= (uint8_t)~(1<<TWSTO);
+			host.twi.mode = TWIIDLE;
+			twiIdle();
+			return;
+		default:
+			return;
+	}
+	host.twi.twcr |= (1<<TWINT);
+}
+
+static void twiIdle(void) // With the bus free a start that was waiting goes ahead, then anything the other master has queued
+{
+	if(host.twi.mode != TWIIDLE || host.twi.action != TWINONE || !(host.twi.twcr & (1<<TWEN)) || hostTwiSdaHeld()) {
+		return;
+	}
+	if(host.twi.startWaiting) {
+		host.twi.startWaiting = 0;
+		host.twi.mode = TWIMASTER;
+		twiAction(TWISTART, 1);
+	} else if(hostTwiOtherStart(&host.twi.data)) {
+		host.twi.mode = TWISLAVE;
+		host.twi.acked = 0;
+		twiAction(TWIOTHERSLA, 10);
+	}
+}
+
+static void twiAction(uint8_t action, uint8_t nBits)
+{
+	uint32_t sclCycles = 16 + 2 * (uint32_t)TWBR * (1 << (2 * (TWSR & ((1<<TWPS1) | (1<<TWPS0)))));
+
+	host.twi.action = action;
+	host.twi.remaining = (nBits * sclCycles) << cpuShift();
+	host.untilEvent = 0; // So that time isn't batched up past it
+}
+
+static void twiStatus(uint8_t status)
+{
+	TWSR = (TWSR & ((1<<TWPS1) | (1<<TWPS0))) | status;
+}
+
+static void twiAbandon(void)
+{
+	if(host.twi.mode == TWIMASTER || host.twi.startWaiting) {
+		hostTwiStop(5);
+	} else if(host.twi.mode == TWISLAVE) {
+		hostTwiOtherEnd(host.twi.acked);
+	}
+	host.twi.mode = TWIIDLE;
+	host.twi.action = TWINONE;
+	host.twi.remaining = 0;
+	host.twi.startWaiting = 0;
+	twiStatus(TW_NO_INFO);
+}
+
+static void twiPins(void) // twi.c's recovery clocking SCL
+{
+	uint8_t scl = !((DDRC & (1<<PC5)) && !(PORTC & (1<<PC5)));
+
+	if(!(host.twi.twcr & (1<<TWEN)) && scl && !host.twi.scl) {
+		hostTwiSclClock();
+	}
+	host.twi.scl = scl;
+}
\ No newline at end of file
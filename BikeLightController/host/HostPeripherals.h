@@ -0,0 +1,134 @@
+#ifndef HOSTPERIPHERALS_H_
+#define HOSTPERIPHERALS_H_
+
+	// Simulated ATmega48 peripherals so that the firmware modules can be built and run natively on a PC
+	//
+	// The headers under host/ stand in for the avr-libc ones: the register names become plain variables apart from
+	// the few whose reads have side effects (PINx, TCNT1 and SREG), which go through accessors. Time only moves when the
+	// firmware touches one of those, kicks the watchdog or sleeps, or when a harness calls hostAdvanceCycles(). As time
+	// moves Timer-1, Timer-2, the free running ADC, the USART transmitter, EEPROM programming and the watchdog are stepped and any enabled interrupts are dispatched
+	// by calling the firmware's ISR functions directly. Time is kept in cycles of F_CPU, CLKPR scales the CPU cycles charged
+	// through hostAdvanceCycles() and the peripheral clocks up to that, the watchdog and EEPROM timings have their own.
+	// Handlers still run in no time but are counted a nominal entry and, unless they nest with a sei(), the rest of their
+	// cycles towards the longest stretch with interrupts off and the latencies of the two safety interrupts. Those are
+	// kept for checking against the budgets in Hal.h.
+	//
+	// The TWI module is modelled at the register level so that twi.c itself runs on it, master, slave (TWI_SLAVE) and the
+	// deadlines and recovery alike. Each bus action takes its bit times at the rate TWBR/TWSR give and HostTwi.c answers
+	// for the devices on the bus: the MCP23008s (and the up/down rheostat hanging off each), the MCP4532s and another
+	// master that the harness has address the firmware's slave. TWCR goes through an accessor, a write is taken up at the
+	// next access or as time moves on, so one that leaves it as the last access found it goes unseen (twi.c never relies
+	// on that). A stop holds TWSTO for a bit time, which twi.c waits out on the main line. What it doesn't reach: a stop
+	// always completes, so twi.c's deadline on TWSTO never runs out. The bus only sticks at a start, with the first
+	// expander holding SDA until SCL is clocked with the module off. Another master never starts alongside the firmware's
+	// own start, so arbitration is never lost part way through a byte (0x38, 0x68, 0xB0) and a start waiting on the bus
+	// is addressed as a plain slave (0x60, 0xA8), and bus errors aren't raised.
+	//
+	// A harness is built from the firmware directory with every module, compiling BikeLightController.c with
+	// -Dmain=firmwareMain so that the harness can run it through hostRun(firmwareMain).
+
+	#include <stdint.h>
+
+	#include "../Clock.h" // F_CPU
+
+	#define HOSTEXIT_TIMEUP 1 // hostStopAt() time reached
+	#define HOSTEXIT_WATCHDOG 2 // The watchdog reset (the firmware may have hit HALT() first, see hostHaltCycle())
+
+	#define HOSTRHEOSTATSTEPS 32
+	#define HOSTMAXEXPANDERS 8 // Lamps, one for each MCP23008 address
+
+	struct HostHooks {
+		uint16_t (*adcInput)(uint8_t admux); // Result for a conversion of the channel selected in ADMUX
+		// Each of the firmware's master transactions as it ends, status as twi_writeTo() returns it (2 address NACK, 3 data
+		// NACK, 5 abandoned by turning the module off) and an address of 0xFF for a start that never got the bus
+		void (*twiTransaction)(uint8_t address, uint8_t isRead, const uint8_t *data, uint8_t length, uint8_t status);
+		// And each of the other master's (see hostTwiSlaveWrite()), length is the bytes acked or read, zero if not addressed
+		void (*twiSlaveTransaction)(uint8_t address, uint8_t isRead, const uint8_t *data, uint8_t length);
+		void (*rheostatStep)(uint8_t position);
+		void (*usartTx)(uint8_t data); // Each byte as the USART starts shifting it out
+	};
+
+	extern struct HostHooks hostHooks;
+
+	struct HostClockStats { // Since the simulation started, across resets
+		uint64_t awake[2]; // Cycles of F_CPU running, at full and reduced clock
+		uint64_t asleep[2];
+		uint64_t cpuClocks; // Clock edges the CPU ran on
+		uint64_t ioClocks; // And the I/O clock, which idle sleep keeps
+		uint32_t switches; // CLKPR changes
+		uint32_t wakes; // Out of sleep
+	};
+
+	#define HOSTSAFETY_OVERCURRENT 0 // ANALOG_COMP
+	#define HOSTSAFETY_LOWPOWER 1 // INT0
+
+	struct HostLatencyStats { // Since the simulation started, across resets, in CPU cycles
+		uint32_t maxMasked; // Longest stretch with interrupts off, other than the boot's and the one HALT() spins in
+		uint32_t taken[2]; // HOSTSAFETY_..., handlers entered with the interrupt enabled as it was raised
+		uint32_t maxLatency[2]; // From it being raised to the handler being entered
+	};
+
+	#define HOSTBENCHIDS 16 // Section ids that fit a GPIOR0 marker alongside its begin/end bit, see Benchmark.h
+
+	struct HostBenchStats { // Since the simulation started, across resets
+		uint32_t count; // Sections completed
+		uint64_t total; // Cycles of F_CPU in them
+		uint64_t max;
+	};
+
+	// Harness interface
+	void hostReset(uint8_t resetSource); // Power-on state with MCUSR set to resetSource
+	int hostRun(int (*entry)(void)); // Run entry until the simulation exits, returns HOSTEXIT_...
+	void hostStopAt(uint64_t cycle);
+	void hostHangAt(uint64_t cycle); // The next watchdog kick from then on never returns, as if the main line had hung
+	uint64_t hostCycles(void);
+	uint64_t hostHaltCycle(void); // Cycle at which the firmware last hit HALT(), zero if it hasn't
+	void hostClockStats(struct HostClockStats *stats);
+	void hostBenchStats(uint8_t id, struct HostBenchStats *stats);
+	void hostLatencyStats(struct HostLatencyStats *stats);
+	void hostAdvanceCycles(uint32_t nCycles); // CPU cycles, at whatever CLKPR divides the clock down to
+	void hostSetOverCurrent(uint8_t tripped);
+	void hostSetLowPower(uint8_t tripped);
+	void hostSetExpanders(uint8_t count); // MCP23008s answering from 0x20 up, one to begin with
+	void hostStickBus(uint64_t cycle); // The first expander holds SDA low from then until SCL is clocked to free it
+	// The rest are the first expander's, the others' buttons are left alone and their rheostats don't call rheostatStep
+	void hostBrownOutExpander(void); // The first expander resets to its power-on registers without touching the bus
+	void hostSetButtons(uint8_t pressed); // MCP23008 GP1..GP3 held low for each bit set in pressed (bit positions as GPIO)
+	uint8_t hostRheostatPosition(void);
+	void hostSlipRheostat(int8_t steps); // The wiper moves without being stepped, as a glitch on nCS would have it
+	uint8_t hostExpanderOLAT(void);
+	uint8_t hostExpanderIOCON(void);
+	uint8_t *hostEeprom(void); // E2END + 1 bytes, kept across hostReset() and erased (0xFF) to begin with
+	// Another master on the bus addressing the firmware's slave (TWI_SLAVE). Each is queued to start as soon as the bus is
+	// free and ends through twiSlaveTransaction, returns zero if the last one hasn't ended yet.
+	uint8_t hostTwiSlaveWrite(uint8_t address, const uint8_t *data, uint8_t length); // Register pointer then data
+	uint8_t hostTwiSlaveRead(uint8_t address, uint8_t length); // From the current pointer
+
+	// Firmware side, reached through the stand-in avr-libc headers and Hal.h
+	volatile uint8_t *hostPin(volatile uint8_t *port);
+	volatile uint16_t *hostTCNT1(void);
+	volatile uint8_t *hostEECR(void);
+	volatile uint8_t *hostEEDR(void);
+	volatile uint8_t *hostSREG(void);
+	volatile uint8_t *hostTWCR(void);
+	void hostSei(void);
+	void hostSleep(void);
+	void hostWdtReset(void);
+	void hostBenchMark(uint8_t marker); // BENCH_BEGIN() and BENCH_END()
+	void hostHalt(void) __attribute__((noreturn));
+
+	// Between the TWI module (HostPeripherals.c) and the devices on the bus (HostTwi.c)
+	#define HOSTTWIOTHERLENGTH 16 // Longest transaction the other master makes
+
+	uint8_t hostTwiAddress(uint8_t sla); // The firmware addressing a device, returns the ack
+	uint8_t hostTwiWrite(uint8_t data); // Returns the ack
+	uint8_t hostTwiRead(uint8_t ack);
+	void hostTwiStop(uint8_t status); // The transaction has ended, see twiTransaction
+	uint8_t hostTwiSdaHeld(void);
+	void hostTwiSclClock(void); // A rising edge of SCL driven through PORTC with the module off
+	uint8_t hostTwiOtherStart(uint8_t *sla); // The other master's next transaction, returns zero if there isn't one
+	uint8_t hostTwiOtherWrite(uint8_t *data); // Its next byte, returns zero when it has none left and stops
+	uint8_t hostTwiOtherRead(uint8_t data); // Returns whether it acks for another
+	void hostTwiOtherEnd(uint8_t length);
+
+#endif /* HOSTPERIPHERALS_H_ */
\ No newline at end of file
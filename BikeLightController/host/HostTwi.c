@@ -0,0 +1,392 @@
+#include <avr/io.h>
+
+#include <stdint.h>
+#include <string.h>
+
+#include "HostPeripherals.h"
+
+// The devices on the bus, HostPeripherals.c runs the TWI module and twi.c drives it: MCP23008s from 0x20 up (one
+// unless hostSetExpanders() says otherwise), each with an up/down rheostat wired to GP4 (nCS) and GP5 (U/nD). The same
+// rheostat answers as an MCP4532 digital pot at 0x2C up for the LAMPWIPER_DIGIPOT build, its 129 wiper positions
+// scaled to the up/down rheostat's. hostStickBus() has the first expander hold SDA low from a given time, as if a glitch
+// had caught it part way through a byte, so the next start never gets the bus. It lets go once twi.c's recovery has
+// clocked SCL a few times, back at its power-on registers. The other master queues one transaction at a time for the
+// firmware's slave, HostPeripherals.c starts it when the bus is free.
+
+#define EXPANDERADDR 0x20 // The first, any others follow on from it
+#define DIGIPOTADDR 0x2C
+#define DIGIPOTFULLSCALE 128
+#define HOSTTWISTUCKCLOCKS 4 // SCL clocks for the stuck expander to finish its byte and let go of SDA
+#define HOSTTWILOGLENGTH 16 // Bytes of each transaction passed to twiTransaction, the rest go uncounted
+
+#define IODIR 0x00
+#define IPOL 0x01
+#define GPINTEN 0x02
+#define DEFVAL 0x03
+#define INTCON 0x04
+#define IOCON 0x05
+#define GPPU 0x06
+#define INTF 0x07
+#define INTCAP 0x08
+#define GPIO 0x09
+#define OLAT 0x0A
+#define NREGS 11
+
+#define RHEOSTATNCS 0x10
+#define RHEOSTATUD 0x20
+
+static struct Expander {
+	uint8_t reg[NREGS];
+	uint8_t pointer;
+	uint8_t pressed; // Inputs held low
+	uint8_t lastGpio;
+	uint8_t intLatched;
+	uint8_t rheostat; // Position as the firmware counts it, 0 is the lowest power
+	uint8_t countDown; // Direction latched on the falling edge of nCS
+	uint8_t command; // The MCP4532's, the first byte of a write
+} expander[HOSTMAXEXPANDERS] = {[0 ... HOSTMAXEXPANDERS - 1] = {{0xFF, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}, 0, 0, 0xFF, 0, 0, 0, 0}};
+
+static const uint8_t powerOnRegs[NREGS] = {0xFF, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+static uint8_t nExpanders = 1;
+
+static struct {
+	uint64_t stickAt; // Zero once it has happened
+	uint8_t held; // SDA, by the first expander
+	uint8_t clocks; // Since it was held
+	// The firmware's transaction under way
+	struct Expander *mcp; // Addressed as an MCP23008
+	struct Expander *digipot; // Or as an MCP4532
+	uint8_t address; // 0xFF until it's sent
+	uint8_t isRead;
+	uint8_t nWritten;
+	uint8_t log[HOSTTWILOGLENGTH];
+	uint8_t logLength;
+} bus = {.address = 0xFF};
+
+static struct {
+	uint8_t sla;
+	uint8_t data[HOSTTWIOTHERLENGTH];
+	uint8_t length; // To write, or to read
+	uint8_t idx;
+	uint8_t queued;
+	uint8_t started;
+} other;
+
+static struct Expander *expanderAt(uint8_t address);
+static uint8_t gpioLevels(struct Expander *mcp);
+static void updateInterrupt(struct Expander *mcp);
+static void writeOLAT(struct Expander *mcp, uint8_t newVal);
+static uint8_t writeExpander(struct Expander *mcp, uint8_t data);
+static uint8_t writeDigipot(struct Expander *mcp, uint8_t data);
+static void moveRheostat(struct Expander *mcp, uint8_t position);
+static void logByte(uint8_t data);
+
+uint8_t hostTwiAddress(uint8_t sla)
+{
+	bus.address = sla >> 1;
+	bus.isRead = sla & 1;
+	bus.nWritten = 0;
+	bus.logLength = 0;
+	bus.mcp = expanderAt(bus.address);
+	bus.digipot = !bus.mcp && !bus.isRead && bus.address >= DIGIPOTADDR && bus.address < DIGIPOTADDR + nExpanders ?
+		expander + (bus.address - DIGIPOTADDR) : NULL; // Only its writes are modelled
+
+	if(bus.mcp && bus.isRead) {
+		updateInterrupt(bus.mcp);
+	}
+
+	return bus.mcp || bus.digipot;
+}
+
+uint8_t hostTwiWrite(uint8_t data)
+{
+	uint8_t ack = 0;
+
+	logByte(data);
+	if(bus.mcp) {
+		ack = writeExpander(bus.mcp, data);
+	} else if(bus.digipot) {
+		ack = writeDigipot(bus.digipot, data);
+	}
+	bus.nWritten++;
+
+	return ack;
+}
+
+uint8_t hostTwiRead(uint8_t ack)
+{
+	struct Expander *mcp = bus.mcp;
+	uint8_t regAddr;
+	uint8_t data;
+
+	if(!mcp) {
+		return 0xFF; // Nobody driving SDA
+	}
+
+	regAddr = mcp->pointer;
+	if(regAddr == GPIO) {
+		data = gpioLevels(mcp);
+	} else {
+		data = mcp->reg[regAddr];
+	}
+	if(regAddr == GPIO || regAddr == INTCAP) { // Either read clears the interrupt
+		mcp->intLatched = 0;
+		mcp->reg[INTF] = 0;
+		mcp->lastGpio = gpioLevels(mcp);
+	}
+	if(!(mcp->reg[IOCON] & 0x20)) { // Sequential operation unless SEQOP is set
+		mcp->pointer = mcp->pointer < OLAT ? mcp->pointer + 1 : 0;
+	}
+	logByte(data);
+
+	return data;
+}
+
+void hostTwiStop(uint8_t status)
+{
+	if(hostHooks.twiTransaction) {
+		hostHooks.twiTransaction(bus.address, bus.isRead, bus.log, bus.logLength, status);
+	}
+	bus.address = 0xFF;
+	bus.isRead = 0;
+	bus.logLength = 0;
+	bus.mcp = bus.digipot = NULL;
+}
+
+uint8_t hostTwiSdaHeld(void)
+{
+	if(bus.stickAt && hostCycles() >= bus.stickAt) {
+		bus.stickAt = 0;
+		bus.held = 1;
+		bus.clocks = 0;
+	}
+
+	return bus.held;
+}
+
+void hostTwiSclClock(void)
+{
+	if(bus.held && ++bus.clocks >= HOSTTWISTUCKCLOCKS) {
+		bus.held = 0;
+		memcpy(expander[0].reg, powerOnRegs, sizeof(powerOnRegs)); // Glitched, which is why it held on to SDA
+		expander[0].pointer = 0;
+		expander[0].intLatched = 0;
+	}
+}
+
+uint8_t hostTwiOtherStart(uint8_t *sla)
+{
+	if(!other.queued || other.started) {
+		return 0;
+	}
+	other.started = 1;
+	other.idx = 0;
+	*sla = other.sla;
+
+	return 1;
+}
+
+uint8_t hostTwiOtherWrite(uint8_t *data)
+{
+	if(other.idx >= other.length) {
+		return 0;
+	}
+	*data = other.data[other.idx++];
+
+	return 1;
+}
+
+uint8_t hostTwiOtherRead(uint8_t data)
+{
+	other.data[other.idx++] = data;
+
+	return other.idx < other.length;
+}
+
+void hostTwiOtherEnd(uint8_t length)
+{
+	other.queued = other.started = 0;
+	if(hostHooks.twiSlaveTransaction) {
+		hostHooks.twiSlaveTransaction(other.sla >> 1, other.sla & 1, other.data, length);
+	}
+}
+
+uint8_t hostTwiSlaveWrite(uint8_t address, const uint8_t *data, uint8_t length)
+{
+	if(other.queued || length == 0 || length > HOSTTWIOTHERLENGTH) {
+		return 0;
+	}
+	other.sla = address << 1;
+	memcpy(other.data, data, length);
+	other.length = length;
+	other.queued = 1;
+
+	return 1;
+}
+
+uint8_t hostTwiSlaveRead(uint8_t address, uint8_t length)
+{
+	if(other.queued || length == 0 || length > HOSTTWIOTHERLENGTH) {
+		return 0;
+	}
+	other.sla = (address << 1) | 1;
+	other.length = length;
+	other.queued = 1;
+
+	return 1;
+}
+
+void hostSetExpanders(uint8_t count)
+{
+	nExpanders = count < 1 ? 1 : count > HOSTMAXEXPANDERS ? HOSTMAXEXPANDERS : count;
+}
+
+void hostStickBus(uint64_t cycle)
+{
+	bus.stickAt = cycle;
+}
+
+void hostBrownOutExpander(void)
+{
+	memcpy(expander[0].reg, powerOnRegs, sizeof(powerOnRegs));
+	expander[0].pointer = 0;
+	expander[0].intLatched = 0;
+}
+
+void hostSetButtons(uint8_t pressed)
+{
+	expander[0].pressed = pressed;
+}
+
+uint8_t hostRheostatPosition(void)
+{
+	return expander[0].rheostat;
+}
+
+void hostSlipRheostat(int8_t steps)
+{
+	int position = expander[0].rheostat + steps;
+
+	moveRheostat(expander, position < 0 ? 0 : position > HOSTRHEOSTATSTEPS - 1 ? HOSTRHEOSTATSTEPS - 1 : position);
+}
+
+uint8_t hostExpanderOLAT(void)
+{
+	return expander[0].reg[OLAT];
+}
+
+uint8_t hostExpanderIOCON(void)
+{
+	return expander[0].reg[IOCON];
+}
+
+static struct Expander *expanderAt(uint8_t address)
+{
+	return address >= EXPANDERADDR && address < EXPANDERADDR + nExpanders ? expander + (address - EXPANDERADDR) : NULL;
+}
+
+static uint8_t gpioLevels(struct Expander *mcp)
+{
+	uint8_t inputs = (uint8_t)~mcp->pressed; // Pulled up unless a button holds them low
+
+	return ((mcp->reg[OLAT] & ~mcp->reg[IODIR]) | (inputs & mcp->reg[IODIR])) ^ (mcp->reg[IPOL] & mcp->reg[IODIR]);
+}
+
+static void updateInterrupt(struct Expander *mcp)
+{
+	uint8_t gpio = gpioLevels(mcp);
+	uint8_t flags;
+
+	if(mcp->intLatched) {
+		return;
+	}
+
+	// Compare against DEFVAL where INTCON is set, otherwise interrupt on change
+	flags = mcp->reg[INTCON] & (gpio ^ mcp->reg[DEFVAL]);
+	flags |= ~mcp->reg[INTCON] & (gpio ^ mcp->lastGpio);
+	flags &= mcp->reg[GPINTEN] & mcp->reg[IODIR];
+
+	if(flags) {
+		mcp->intLatched = 1;
+		mcp->reg[INTF] = flags;
+		mcp->reg[INTCAP] = gpio;
+	}
+}
+
+static void writeOLAT(struct Expander *mcp, uint8_t newVal)
+{
+	uint8_t oldVal = mcp->reg[OLAT];
+
+	mcp->reg[OLAT] = newVal;
+
+	if((oldVal & RHEOSTATNCS) && !(newVal & RHEOSTATNCS)) { // nCS falling, U/nD high selects a step down
+		mcp->countDown = (newVal & RHEOSTATUD) != 0;
+	} else if(!(newVal & RHEOSTATNCS) && !(oldVal & RHEOSTATUD) && (newVal & RHEOSTATUD)) { // U/nD rising with nCS low steps
+		if(mcp->countDown) {
+			moveRheostat(mcp, mcp->rheostat > 0 ? mcp->rheostat - 1 : 0);
+		} else {
+			moveRheostat(mcp, mcp->rheostat < (HOSTRHEOSTATSTEPS - 1) ? mcp->rheostat + 1 : mcp->rheostat);
+		}
+	}
+}
+
+static uint8_t writeExpander(struct Expander *mcp, uint8_t data)
+{
+	if(bus.nWritten == 0) {
+		mcp->pointer = data < NREGS ? data : 0;
+		return 1;
+	}
+
+	switch(mcp->pointer) {
+		case INTF:
+		case INTCAP:
+			break; // Read only
+		case GPIO:
+		case OLAT:
+			writeOLAT(mcp, data);
+			break;
+		default:
+			mcp->reg[mcp->pointer] = data;
+			break;
+	}
+	if(!(mcp->reg[IOCON] & 0x20)) {
+		mcp->pointer = mcp->pointer < OLAT ? mcp->pointer + 1 : 0;
+	}
+
+	return 1;
+}
+
+static uint8_t writeDigipot(struct Expander *mcp, uint8_t data)
+{
+	uint16_t wiper;
+
+	if(bus.nWritten == 0) { // Only the volatile wiper 0 write command is modelled
+		mcp->command = data;
+		return (data & 0xFE) == 0x00;
+	}
+	if(bus.nWritten > 1) {
+		return 0;
+	}
+
+	wiper = ((uint16_t)(mcp->command & 0x01) << 8) | data;
+	wiper = wiper < DIGIPOTFULLSCALE ? wiper : DIGIPOTFULLSCALE;
+	moveRheostat(mcp, (wiper * (HOSTRHEOSTATSTEPS - 1) + DIGIPOTFULLSCALE / 2) / DIGIPOTFULLSCALE);
+
+	return 1;
+}
+
+static void moveRheostat(struct Expander *mcp, uint8_t position)
+{
+	mcp->rheostat = position; // Called for every step or write, at an end stop or not
+	if(hostHooks.rheostatStep && mcp == expander) { // The first lamp's
+		hostHooks.rheostatStep(mcp->rheostat);
+	}
+}
+
+static void logByte(uint8_t data)
+{
+	if(bus.logLength < HOSTTWILOGLENGTH) {
+		bus.log[bus.logLength++] = data;
+	}
+}
\ No newline at end of file
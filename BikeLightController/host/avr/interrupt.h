@@ -0,0 +1,13 @@
+#ifndef HOST_AVR_INTERRUPT_H_
+#define HOST_AVR_INTERRUPT_H_
+
+	#include <avr/io.h>
+
+	#define ISR_BLOCK
+	#define ISR_NOBLOCK
+	#define ISR(_vector, ...) void _vector(void); void _vector(void) // Called directly by the host dispatcher
+
+	#define sei() hostSei()
+	#define cli() (*hostSREG() &= (uint8_t)~0x80)
+
+#endif /* HOST_AVR_INTERRUPT_H_ */
\ No newline at end of file
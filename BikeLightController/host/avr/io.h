@@ -0,0 +1,269 @@
+#ifndef HOST_AVR_IO_H_
+#define HOST_AVR_IO_H_
+
+	// Stand-in for the avr-libc header when building for the host, the register set is the ATmega48's
+
+	#include <stdint.h>
+
+	#include "HostPeripherals.h"
+
+	#define _BV(bit) (1 << (bit))
+
+	#define HOSTREG8(_name) extern volatile uint8_t _name
+	#define HOSTREG16(_name) extern volatile uint16_t _name
+
+	HOSTREG8(DDRB); HOSTREG8(PORTB);
+	HOSTREG8(DDRC); HOSTREG8(PORTC);
+	HOSTREG8(DDRD); HOSTREG8(PORTD);
+	HOSTREG8(TIFR0); HOSTREG8(TIFR1); HOSTREG8(TIFR2);
+	HOSTREG8(PCIFR); HOSTREG8(EIFR); HOSTREG8(EIMSK);
+	HOSTREG8(GPIOR0); HOSTREG8(GPIOR1); HOSTREG8(GPIOR2);
+	HOSTREG16(EEAR);
+	HOSTREG8(GTCCR);
+	HOSTREG8(TCCR0A); HOSTREG8(TCCR0B); HOSTREG8(TCNT0); HOSTREG8(OCR0A); HOSTREG8(OCR0B);
+	HOSTREG8(SPCR); HOSTREG8(SPSR); HOSTREG8(SPDR);
+	HOSTREG8(ACSR); HOSTREG8(SMCR); HOSTREG8(MCUSR); HOSTREG8(MCUCR); HOSTREG8(SPMCSR);
+	HOSTREG8(WDTCSR); HOSTREG8(CLKPR); HOSTREG8(PRR); HOSTREG8(OSCCAL);
+	HOSTREG8(PCICR); HOSTREG8(EICRA); HOSTREG8(PCMSK0); HOSTREG8(PCMSK1); HOSTREG8(PCMSK2);
+	HOSTREG8(TIMSK0); HOSTREG8(TIMSK1); HOSTREG8(TIMSK2);
+	HOSTREG16(ADC); HOSTREG8(ADCSRA); HOSTREG8(ADCSRB); HOSTREG8(ADMUX); HOSTREG8(DIDR0); HOSTREG8(DIDR1);
+	HOSTREG8(TCCR1A); HOSTREG8(TCCR1B); HOSTREG8(TCCR1C);
+	HOSTREG16(ICR1); HOSTREG16(OCR1A); HOSTREG16(OCR1B);
+	HOSTREG8(TCCR2A); HOSTREG8(TCCR2B); HOSTREG8(TCNT2); HOSTREG8(OCR2A); HOSTREG8(OCR2B); HOSTREG8(ASSR);
+	HOSTREG8(TWBR); HOSTREG8(TWSR); HOSTREG8(TWAR); HOSTREG8(TWDR); HOSTREG8(TWAMR);
+	HOSTREG8(UCSR0A); HOSTREG8(UCSR0B); HOSTREG8(UCSR0C); HOSTREG16(UBRR0);
+	HOSTREG16(UDR0); // Wider than the hardware so the host can tell when a byte has been written
+	HOSTREG16(SP);
+
+	// Reads of these have side effects
+	#define PINB (*hostPin(&PORTB)) // Writing a one toggles the PORT bit
+	#define PINC (*hostPin(&PORTC))
+	#define PIND (*hostPin(&PORTD))
+	#define TCNT1 (*hostTCNT1()) // Polling the counter lets simulated time move on
+	#define SREG (*hostSREG()) // As does the SREG save before each critical section
+	#define EECR (*hostEECR()) // Polling EEPE lets the programming time pass
+	#define EEDR (*hostEEDR()) // Picks up the byte a read strobe (EERE) asked for
+	#define TWCR (*hostTWCR()) // Writes are taken up at the next access, see HostPeripherals.h
+
+	#define ADCL (*((volatile uint8_t *)&ADC))
+	#define ADCH (*((volatile uint8_t *)&ADC + 1))
+	#define EEARL (*((volatile uint8_t *)&EEAR))
+	#define EEARH (*((volatile uint8_t *)&EEAR + 1))
+	#define UBRR0L (*((volatile uint8_t *)&UBRR0))
+	#define UBRR0H (*((volatile uint8_t *)&UBRR0 + 1))
+	#define SPL (*((volatile uint8_t *)&SP))
+	#define SPH (*((volatile uint8_t *)&SP + 1))
+
+	#define RAMSTART 0x100
+	#define RAMEND 0x2FF
+	#define E2END 0xFF
+	#define FLASHEND 0xFFF
+
+	#define PB0 0
+	#define PB1 1
+	#define PB2 2
+	#define PB3 3
+	#define PB4 4
+	#define PB5 5
+	#define PB6 6
+	#define PB7 7
+	#define PC0 0
+	#define PC1 1
+	#define PC2 2
+	#define PC3 3
+	#define PC4 4
+	#define PC5 5
+	#define PC6 6
+	#define PD0 0
+	#define PD1 1
+	#define PD2 2
+	#define PD3 3
+	#define PD4 4
+	#define PD5 5
+	#define PD6 6
+	#define PD7 7
+
+	#define TOV0 0
+	#define OCF0A 1
+	#define OCF0B 2
+	#define TOV1 0
+	#define OCF1A 1
+	#define OCF1B 2
+	#define ICF1 5
+	#define TOV2 0
+	#define OCF2A 1
+	#define OCF2B 2
+
+	#define INTF0 0
+	#define INTF1 1
+	#define INT0 0
+	#define INT1 1
+	#define ISC00 0
+	#define ISC01 1
+	#define ISC10 2
+	#define ISC11 3
+
+	#define EERE 0
+	#define EEPE 1
+	#define EEMPE 2
+	#define EERIE 3
+	#define EEPM0 4
+	#define EEPM1 5
+
+	#define WGM00 0
+	#define WGM01 1
+	#define COM0B0 4
+	#define COM0B1 5
+	#define COM0A0 6
+	#define COM0A1 7
+	#define CS00 0
+	#define CS01 1
+	#define CS02 2
+	#define WGM02 3
+	#define TOIE0 0
+	#define OCIE0A 1
+	#define OCIE0B 2
+
+	#define ACIS0 0
+	#define ACIS1 1
+	#define ACIC 2
+	#define ACIE 3
+	#define ACI 4
+	#define ACO 5
+	#define ACBG 6
+	#define ACD 7
+
+	#define SE 0
+	#define SM0 1
+	#define SM1 2
+	#define SM2 3
+
+	#define PORF 0
+	#define EXTRF 1
+	#define BORF 2
+	#define WDRF 3
+
+	#define WDP0 0
+	#define WDP1 1
+	#define WDP2 2
+	#define WDE 3
+	#define WDCE 4
+	#define WDP3 5
+	#define WDIE 6
+	#define WDIF 7
+
+	#define PSRSYNC 0
+	#define PSRASY 1
+	#define TSM 7
+
+	#define CLKPS0 0
+	#define CLKPS1 1
+	#define CLKPS2 2
+	#define CLKPS3 3
+	#define CLKPCE 7
+
+	#define PRADC 0
+	#define PRUSART0 1
+	#define PRSPI 2
+	#define PRTIM1 3
+	#define PRTIM0 5
+	#define PRTIM2 6
+	#define PRTWI 7
+
+	#define ADPS0 0
+	#define ADPS1 1
+	#define ADPS2 2
+	#define ADIE 3
+	#define ADIF 4
+	#define ADATE 5
+	#define ADSC 6
+	#define ADEN 7
+	#define ADTS0 0
+	#define ADTS1 1
+	#define ADTS2 2
+	#define ACME 6
+	#define MUX0 0
+	#define MUX1 1
+	#define MUX2 2
+	#define MUX3 3
+	#define ADLAR 5
+	#define REFS0 6
+	#define REFS1 7
+	#define ADC0D 0
+	#define ADC1D 1
+	#define ADC2D 2
+	#define ADC3D 3
+	#define ADC4D 4
+	#define ADC5D 5
+	#define AIN0D 0
+	#define AIN1D 1
+
+	#define WGM10 0
+	#define WGM11 1
+	#define COM1B0 4
+	#define COM1B1 5
+	#define COM1A0 6
+	#define COM1A1 7
+	#define CS10 0
+	#define CS11 1
+	#define CS12 2
+	#define WGM12 3
+	#define WGM13 4
+	#define ICES1 6
+	#define ICNC1 7
+	#define TOIE1 0
+	#define OCIE1A 1
+	#define OCIE1B 2
+	#define ICIE1 5
+
+	#define WGM20 0
+	#define WGM21 1
+	#define COM2B0 4
+	#define COM2B1 5
+	#define COM2A0 6
+	#define COM2A1 7
+	#define CS20 0
+	#define CS21 1
+	#define CS22 2
+	#define WGM22 3
+	#define TOIE2 0
+	#define OCIE2A 1
+	#define OCIE2B 2
+
+	#define TWPS0 0
+	#define TWPS1 1
+	#define TWGCE 0
+	#define TWIE 0
+	#define TWEN 2
+	#define TWWC 3
+	#define TWSTO 4
+	#define TWSTA 5
+	#define TWEA 6
+	#define TWINT 7
+
+	#define MPCM0 0
+	#define U2X0 1
+	#define UPE0 2
+	#define DOR0 3
+	#define FE0 4
+	#define UDRE0 5
+	#define TXC0 6
+	#define RXC0 7
+	#define TXB80 0
+	#define RXB80 1
+	#define UCSZ02 2
+	#define TXEN0 3
+	#define RXEN0 4
+	#define UDRIE0 5
+	#define TXCIE0 6
+	#define RXCIE0 7
+	#define UCPOL0 0
+	#define UCSZ00 1
+	#define UCSZ01 2
+	#define USBS0 3
+	#define UPM00 4
+	#define UPM01 5
+	#define UMSEL00 6
+	#define UMSEL01 7
+
+#endif /* HOST_AVR_IO_H_ */
\ No newline at end of file
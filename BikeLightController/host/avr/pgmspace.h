@@ -0,0 +1,12 @@
+#ifndef HOST_AVR_PGMSPACE_H_
+#define HOST_AVR_PGMSPACE_H_
+
+	#include <stdint.h>
+
+	#define PROGMEM
+	#define PSTR(_s) (_s)
+	#define pgm_read_byte(_addr) (*(const uint8_t *)(_addr))
+	#define pgm_read_word(_addr) (*(const uint16_t *)(_addr))
+	#define pgm_read_dword(_addr) (*(const uint32_t *)(_addr))
+
+#endif /* HOST_AVR_PGMSPACE_H_ */
\ No newline at end of file
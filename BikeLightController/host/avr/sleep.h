@@ -0,0 +1,17 @@
+#ifndef HOST_AVR_SLEEP_H_
+#define HOST_AVR_SLEEP_H_
+
+	#include <avr/io.h>
+
+	#define SLEEP_MODE_IDLE (0)
+	#define SLEEP_MODE_ADC (1<<SM0)
+	#define SLEEP_MODE_PWR_DOWN (1<<SM1)
+	#define SLEEP_MODE_PWR_SAVE ((1<<SM0) | (1<<SM1))
+	#define SLEEP_MODE_STANDBY ((1<<SM1) | (1<<SM2))
+
+	#define set_sleep_mode(_mode) (SMCR = (uint8_t)((SMCR & ~((1<<SM0) | (1<<SM1) | (1<<SM2))) | (_mode)))
+	#define sleep_enable() (SMCR |= (1<<SE))
+	#define sleep_disable() (SMCR &= (uint8_t)~(1<<SE))
+	#define sleep_cpu() hostSleep()
+
+#endif /* HOST_AVR_SLEEP_H_ */
\ No newline at end of file
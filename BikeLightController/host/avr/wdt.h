@@ -0,0 +1,21 @@
+#ifndef HOST_AVR_WDT_H_
+#define HOST_AVR_WDT_H_
+
+	#include <avr/io.h>
+
+	#define WDTO_15MS 0
+	#define WDTO_30MS 1
+	#define WDTO_60MS 2
+	#define WDTO_120MS 3
+	#define WDTO_250MS 4
+	#define WDTO_500MS 5
+	#define WDTO_1S 6
+	#define WDTO_2S 7
+	#define WDTO_4S 8
+	#define WDTO_8S 9
+
+	#define wdt_reset() hostWdtReset()
+	#define wdt_enable(_timeout) (WDTCSR = (uint8_t)((1<<WDE) | ((_timeout) & 0x07) | (((_timeout) & 0x08) ? (1<<WDP3) : 0)))
+	#define wdt_disable() (WDTCSR = 0)
+
+#endif /* HOST_AVR_WDT_H_ */
\ No newline at end of file
@@ -27,6 +27,11 @@
 #include <compat/twi.h>
 
 #include "twi.h"
+#include "Clock.h"
+#include "TimerServices.h"
+#include "Benchmark.h"
+#include "ISRProfiler.h"
+#include "EnergyMonitor.h"
 
 #define TWI_READY 0
 #define TWI_MRX   1
@@ -34,6 +39,11 @@
 #define TWI_SRX   3
 #define TWI_STX   4
 
+#define TWI_SDA PC4
+#define TWI_SCL PC5
+#define TWI_TIMEOUT_TICKS TIMER1TICKS(TWI_TIMEOUT_MS)
+#define TWI_ERROR_TIMEOUT 0xFE  // twi_error for a wait that ran out
+
 static volatile uint8_t twi_state;
 static volatile uint8_t twi_slarw;
 static volatile uint8_t twi_sendStop;			// should the transaction end with a stop
@@ -41,13 +51,33 @@ static volatile uint8_t twi_inRepStart;			// in the middle of a repeated start
 
 static volatile uint8_t twi_error;
 
+static struct twi_counters twi_count;
+
 static uint8_t twi_masterBuffer[TWI_BUFFER_LENGTH];
 static volatile uint8_t twi_masterBufferIndex;
 static volatile uint8_t twi_masterBufferLength;
 
+#if TWI_SLAVE
+static const uint8_t * volatile twi_slaveImage;	// register image the main loop last published
+static volatile uint8_t twi_slaveImageLength;
+static const uint8_t *twi_slaveTxImage;			// image latched for the read in progress
+static uint8_t twi_slaveTxLength;
+static uint8_t twi_slavePointer;				// register pointer, auto-increments
+
+static uint8_t twi_slaveRxBuffer[TWI_SLAVERX_LENGTH];
+static uint8_t twi_slaveRxIndex;
+static volatile uint8_t twi_slaveRxLength;		// length of the last complete write, zero once collected
+#endif
+
+static uint8_t twi_claim(uint8_t);
+static uint8_t twi_wait(uint8_t);
 static void twi_reply(uint8_t);
 static void twi_stop(void);
 static void twi_releaseBus(void);
+static void twi_recover(void);
+static void twi_pinLow(uint8_t);
+static void twi_pinRelease(uint8_t);
+static void twi_halfBit(void);
 
 /* 
  * Function twi_init
@@ -65,7 +95,7 @@ void twi_init(void)
 	// initialize twi prescaler and bit rate
   
 	TWSR &= ~(1<<TWPS0) & ~(1<<TWPS1);
-	TWBR = ((8000000 / TWI_FREQ) - 16) / 2;
+	TWBR = clockTWIBitRate(); // ((F_CPU / TWI_FREQ) - 16) / 2 at full speed, see Clock.h
 
 	/* twi bit rate formula from atmega128 manual pg 204
 	SCL Frequency = CPU Clock Frequency / (16 + (2 * TWBR))
@@ -84,17 +114,17 @@ void twi_init(void)
  *          data: pointer to byte array
  *          length: number of bytes to read into array
  *          sendStop: Boolean indicating whether to send a stop at the end
- * Output   number of bytes read
+ * Output   number of bytes read, zero if the bus timed out
  */
 uint8_t twi_readFrom(uint8_t address, uint8_t* data, uint8_t length, uint8_t sendStop)
 {
 	uint8_t i;
+	uint8_t tries = TWI_ARB_TRIES;
+	uint8_t statReg;
 
+retry:
 	// wait until twi is ready, become master receiver
-	while(TWI_READY != twi_state) {
-		continue;
-	}
-	twi_state = TWI_MRX;
+	statReg = twi_claim(TWI_MRX);
 	twi_sendStop = sendStop;
 	// reset error state (0xFF.. no error occured)
 	twi_error = 0xFF;
@@ -126,10 +156,16 @@ uint8_t twi_readFrom(uint8_t address, uint8_t* data, uint8_t length, uint8_t sen
 		// send start condition
 		TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWEA) | _BV(TWINT) | _BV(TWSTA);
 	}		
+	SREG = statReg; // a master addressing us from here on shows up as lost arbitration
 
-	// wait for read operation to complete
-	while(TWI_MRX == twi_state) {
-		continue;
+	// wait for read operation to complete, nothing was read if it had to be abandoned
+	if(!twi_wait(TWI_MRX)) {
+		return 0;
+	}
+
+	// lost the bus to another master (which may be talking to us), go again once it's done
+	if((TW_MR_ARB_LOST == twi_error) && --tries) {
+		goto retry;
 	}
 
 	if (twi_masterBufferIndex < length) {
@@ -158,16 +194,17 @@ uint8_t twi_readFrom(uint8_t address, uint8_t* data, uint8_t length, uint8_t sen
  *          2 .. address send, NACK received
  *          3 .. data send, NACK received
  *          4 .. other twi error (lost bus arbitration, bus error, ..)
+ *          5 .. timed out, the bus has been recovered
  */
 uint8_t twi_writeTo(uint8_t address, uint8_t* data, uint8_t length, uint8_t wait, uint8_t sendStop)
 {
 	uint8_t i;
+	uint8_t tries = TWI_ARB_TRIES;
+	uint8_t statReg;
 
+retry:
 	// wait until twi is ready, become master transmitter
-	while(TWI_READY != twi_state){
-		continue;
-	}
-	twi_state = TWI_MTX;
+	statReg = twi_claim(TWI_MTX);
 	twi_sendStop = sendStop;
 	// reset error state (0xFF.. no error occured)
 	twi_error = 0xFF;
@@ -202,10 +239,16 @@ uint8_t twi_writeTo(uint8_t address, uint8_t* data, uint8_t length, uint8_t wait
 		// send start condition
 		TWCR = _BV(TWINT) | _BV(TWEA) | _BV(TWEN) | _BV(TWIE) | _BV(TWSTA);	// enable INTs
 	}		
+	SREG = statReg; // a master addressing us from here on shows up as lost arbitration
 
 	// wait for write operation to complete
-	while(wait && (TWI_MTX == twi_state)){
-		continue;
+	if(wait && !twi_wait(TWI_MTX)){
+		return 5;	// error: timed out, the bus has been recovered
+	}
+
+	// lost the bus to another master (which may be talking to us), go again once it's done
+	if(wait && (TW_MT_ARB_LOST == twi_error) && --tries) {
+		goto retry;
 	}
   
 	if (twi_error == 0xFF) {
@@ -219,6 +262,143 @@ uint8_t twi_writeTo(uint8_t address, uint8_t* data, uint8_t length, uint8_t wait
 	}		
 }
 
+/* 
+ * Function twi_idle
+ * Desc     tells whether a transaction is under way, as master or slave
+ * Input    none
+ * Output   1 if the bus is ours to leave alone, 0 otherwise
+ */
+uint8_t twi_idle(void)
+{
+	return TWI_READY == twi_state && !(TWCR & _BV(TWSTO));
+}
+
+/* 
+ * Function twi_getCounters
+ * Desc     copies out the error and recovery counts, they wrap
+ * Input    counters: where to put them
+ * Output   none
+ */
+void twi_getCounters(struct twi_counters* counters)
+{
+	uint8_t statReg = SREG;
+	cli();
+		*counters = twi_count;
+	SREG = statReg;
+}
+
+#if TWI_SLAVE
+/* 
+ * Function twi_setAddress
+ * Desc     sets the address we answer to as a slave
+ * Input    address: 7bit i2c device address
+ * Output   none
+ */
+void twi_setAddress(uint8_t address)
+{
+	// set twi slave address (skip over TWGCE bit)
+	TWAR = address << 1;
+}
+
+/* 
+ * Function twi_setSlaveImage
+ * Desc     publishes the registers served to a master reading from us,
+ *          a read already under way finishes from the previous image
+ * Input    image: register contents, must stay untouched until the
+ *                 image after next is published
+ *          length: number of registers
+ * Output   none
+ */
+void twi_setSlaveImage(const uint8_t* image, uint8_t length)
+{
+	uint8_t statReg = SREG;
+	cli();
+		twi_slaveImage = image;
+		twi_slaveImageLength = length;
+	SREG = statReg;
+}
+
+/* 
+ * Function twi_slaveWritten
+ * Desc     collects the last write made to us by a master
+ * Input    data: pointer to TWI_SLAVERX_LENGTH bytes, the register
+ *                pointer followed by the bytes written from it
+ * Output   number of bytes copied, zero if nothing new was written
+ */
+uint8_t twi_slaveWritten(uint8_t* data)
+{
+	uint8_t i;
+	uint8_t length;
+	uint8_t statReg = SREG;
+
+	cli();
+		length = twi_slaveRxLength;
+		for(i = 0; i < length; ++i){
+			data[i] = twi_slaveRxBuffer[i];
+		}
+		twi_slaveRxLength = 0;
+	SREG = statReg;
+
+	return length;
+}
+#endif
+
+/* 
+ * Function twi_claim
+ * Desc     waits until twi is ready and takes it, returning with interrupts
+ *          off so that nothing can address us before the start is queued
+ * Input    state: master state to enter
+ * Output   SREG to restore once the start has been queued
+ */
+static uint8_t twi_claim(uint8_t state)
+{
+	uint8_t statReg = SREG;
+	uint32_t tStart = getTicks();
+	ENERGY_ENTER(ENERGY_WAITTWI);
+
+	for(;;){
+		while(TWI_READY != twi_state || (TWCR & _BV(TWSTO))){ // the last stop may still be going out
+			if((getTicks() - tStart) > TWI_TIMEOUT_TICKS){
+				twi_recover();
+			}
+		}
+		cli();
+		if(TWI_READY == twi_state){
+			twi_state = state;
+			ENERGY_EXIT();
+			return statReg;
+		}
+		SREG = statReg;
+	}
+}
+
+/* 
+ * Function twi_wait
+ * Desc     waits for the master transaction under way to finish, or its
+ *          deadline to pass, in which case the bus is recovered
+ * Input    state: master state the transaction runs in
+ * Output   1 if the transaction finished, 0 if it timed out
+ */
+static uint8_t twi_wait(uint8_t state)
+{
+	uint32_t tStart = getTicks();
+	uint8_t done = 1;
+	ENERGY_ENTER(ENERGY_WAITTWI);
+
+	// the interrupt only queues the stop, it's waited for here
+	while(state == twi_state || (TWCR & _BV(TWSTO))){
+		if((getTicks() - tStart) > TWI_TIMEOUT_TICKS){
+			done = 0;
+			break;
+		}
+	}
+	if(!done){
+		twi_recover();
+	}
+	ENERGY_EXIT();
+	return done;
+}
+
 /* 
  * Function twi_reply
  * Desc     sends byte or readys receive line
@@ -246,11 +426,10 @@ void twi_stop(void)
 	// send stop condition
 	TWCR = _BV(TWEN) | _BV(TWIE) | _BV(TWEA) | _BV(TWINT) | _BV(TWSTO);
 
-	// wait for stop condition to be exectued on bus
-	// TWINT is not set after a stop condition!
-	while(TWCR & _BV(TWSTO)){
-		continue;
-	}
+	// TWINT is not set after a stop condition, TWSTO clears once it's on
+	// the bus. Called from the interrupt, so it isn't waited for here:
+	// twi_wait() and twi_claim() wait on TWSTO (and recover the bus if it
+	// never clears) before the main line goes on or starts again
 
 	// update twi state
 	twi_state = TWI_READY;
@@ -271,8 +450,108 @@ void twi_releaseBus(void)
 	twi_state = TWI_READY;
 }
 
+/* 
+ * Function twi_recover
+ * Desc     frees a stuck bus and restarts the twi module, clocking SCL
+ *          until a slave caught part way through a byte lets go of SDA
+ *          and then sending a start and a stop to reset the slaves
+ * Input    none
+ * Output   none
+ */
+static void twi_recover(void)
+{
+	uint8_t statReg = SREG;
+	uint8_t clocks;
+
+	cli();
+	// module off, the pins go back to the port and its pull-ups
+	TWCR = 0;
+	twi_state = TWI_READY;
+	twi_inRepStart = 0;
+	twi_error = TWI_ERROR_TIMEOUT;
+	twi_count.timeouts++;
+	SREG = statReg;
+
+	twi_pinRelease(TWI_SDA);
+	twi_pinRelease(TWI_SCL);
+	twi_halfBit();
+	if(!(PINC & _BV(TWI_SDA))){
+		twi_count.freed++;
+	}
+	for(clocks = 0; clocks < TWI_RECOVERY_CLOCKS && !(PINC & _BV(TWI_SDA)); ++clocks){
+		twi_pinLow(TWI_SCL);
+		twi_halfBit();
+		twi_pinRelease(TWI_SCL);
+		twi_halfBit();
+	}
+	// start then stop, sda moving while scl is high
+	twi_pinLow(TWI_SDA);
+	twi_halfBit();
+	twi_pinRelease(TWI_SDA);
+	twi_halfBit();
+
+	twi_init();
+}
+
+/* 
+ * Function twi_pinLow
+ * Desc     drives a bus line low while the module is off
+ * Input    pin: PORTC bit
+ * Output   none
+ */
+static void twi_pinLow(uint8_t pin)
+{
+	uint8_t statReg = SREG;
+
+	cli(); // PORTC is shared with the fet driver
+	PORTC &= ~_BV(pin);
+	DDRC |= _BV(pin);
+	SREG = statReg;
+}
+
+/* 
+ * Function twi_pinRelease
+ * Desc     lets a bus line float up to its pull-up while the module is off
+ * Input    pin: PORTC bit
+ * Output   none
+ */
+static void twi_pinRelease(uint8_t pin)
+{
+	uint8_t statReg = SREG;
+
+	cli();
+	DDRC &= ~_BV(pin);
+	PORTC |= _BV(pin);
+	SREG = statReg;
+}
+
+/* 
+ * Function twi_halfBit
+ * Desc     waits at least one Timer-1 count (128uS at 8MHz), much slower
+ *          than the bus runs but a slave that's stuck won't mind
+ * Input    none
+ * Output   none
+ */
+static void twi_halfBit(void)
+{
+	uint32_t tStart = getTicks();
+
+	while((getTicks() - tStart) < 2){
+		continue;
+	}
+}
+
 ISR(TWI_vect)
 {
+  BENCH_BEGIN(BENCH_TWIISR);
+  ISRPROF_ENTER(ISRPROF_TWI);
+  ENERGY_ENTER(ENERGY_ISRTWI);
+  // let the others in, see Hal.h. TWINT stays set (and the interrupt pending) until the reply
+  // below, so mask it without clearing TWINT. The bus can't make another step in
+  // less than a bit time once it's cleared.
+  TWCR = TWCR & ~(_BV(TWIE) | _BV(TWINT));
+  sei();
+  ISRPROF_UNMASK(ISRPROF_TWI);
   switch(TW_STATUS){
     // All Master
     case TW_START:     // sent start condition
@@ -347,13 +626,100 @@ ISR(TWI_vect)
       break;
     // TW_MR_ARB_LOST handled by TW_MT_ARB_LOST case
 
+#if TWI_SLAVE
+    // Slave Receiver
+    case TW_SR_SLA_ACK:            // addressed, returned ack
+    case TW_SR_ARB_LOST_SLA_ACK:   // lost arbitration, returned ack
+      // a start of our own still waiting for the bus is dropped, the master
+      // functions see the lost arbitration and retry once we're done
+      if(TWI_READY != twi_state){
+        twi_error = TW_MT_ARB_LOST;
+      }
+      // enter slave receiver mode, anything written and not yet collected is lost
+      twi_state = TWI_SRX;
+      twi_slaveRxIndex = 0;
+      twi_slaveRxLength = 0;
+      twi_reply(1);
+      break;
+    case TW_SR_DATA_ACK:       // data received, returned ack
+      // the first byte is the register pointer
+      if(0 == twi_slaveRxIndex){
+        twi_slavePointer = TWDR;
+      }
+      // if there is still room in the rx buffer
+      if(twi_slaveRxIndex < TWI_SLAVERX_LENGTH){
+        // put byte in buffer and ack
+        twi_slaveRxBuffer[twi_slaveRxIndex++] = TWDR;
+        twi_reply(1);
+      }else{
+        // otherwise nack
+        twi_reply(0);
+      }
+      break;
+    case TW_SR_STOP: // stop or repeated start condition received
+      // hand the write over to the main loop if anything followed the pointer
+      if(twi_slaveRxIndex > 1){
+        twi_slaveRxLength = twi_slaveRxIndex;
+      }
+      // ack future responses and leave slave receiver state
+      twi_releaseBus();
+      break;
+    case TW_SR_DATA_NACK:       // data received, returned nack
+      // nack back at master
+      twi_reply(0);
+      break;
+
+    // Slave Transmitter
+    case TW_ST_SLA_ACK:          // addressed, returned ack
+    case TW_ST_ARB_LOST_SLA_ACK: // arbitration lost, returned ack
+      if(TWI_READY != twi_state){
+        twi_error = TW_MT_ARB_LOST;
+      }
+      // enter slave transmitter mode, the whole read comes from one image
+      twi_state = TWI_STX;
+      twi_slaveTxImage = twi_slaveImage;
+      twi_slaveTxLength = twi_slaveImageLength;
+      // transmit first byte from image, fall
+    case TW_ST_DATA_ACK: // byte sent, ack returned
+      // copy data to output register, reads beyond the image return 0xFF
+      if(twi_slavePointer < twi_slaveTxLength){
+        TWDR = twi_slaveTxImage[twi_slavePointer++];
+      }else{
+        TWDR = 0xFF;
+      }
+      // if there is more to send, ack, otherwise nack
+      if(twi_slavePointer < twi_slaveTxLength){
+        twi_reply(1);
+      }else{
+        twi_reply(0);
+      }
+      break;
+    case TW_ST_DATA_NACK: // received nack, we are done 
+    case TW_ST_LAST_DATA: // received ack, but we are done already!
+      // ack future responses
+      twi_reply(1);
+      // leave slave transmitter state
+      twi_state = TWI_READY;
+      break;
+#endif
+
     // All
     case TW_NO_INFO:   // no state information
       break;
     case TW_BUS_ERROR: // bus error, illegal stop/start
       twi_error = TW_BUS_ERROR;
+      twi_count.busErrors++;
       twi_stop();
       break;
   }
+  cli();
+  // unmask unless holding a repeated start back for the next transaction,
+  // or sending a stop, which was written with TWIE and mustn't be written again
+  if(!twi_inRepStart && !(TWCR & _BV(TWSTO))){
+    TWCR = (TWCR & ~_BV(TWINT)) | _BV(TWIE);
+  }
+  ENERGY_EXIT();
+  ISRPROF_EXIT(ISRPROF_TWI);
+  BENCH_END(BENCH_TWIISR);
 }
 
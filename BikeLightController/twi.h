@@ -24,11 +24,40 @@
 		#define TWI_FREQ 16000L
 	#endif
 
-	#define TWI_BUFFER_LENGTH 2
+	#ifndef TWI_SLAVE
+		#define TWI_SLAVE 0 // Also answer as a register mapped slave, see HeadUnitLink.h
+	#endif
+
+	#define TWI_BUFFER_LENGTH 6 // Register pointer and a whole rheostat step's worth of OLAT writes
+	#define TWI_SLAVERX_LENGTH 3 // Register pointer and the bytes written from it
+	#define TWI_ARB_TRIES 4 // Attempts at a master transaction that keeps losing the bus to another master
+
+	// Every wait on the bus has a deadline. One that runs out (a slave holding SDA, a glitch that left the module
+	// waiting on an interrupt that never comes) turns the module off, clocks SCL until SDA is let go, sends a stop and
+	// starts the module again. twi_writeTo() then returns 5 and twi_readFrom() nothing, and the caller puts back
+	// whatever state the slaves may have lost (see testLampState()).
+	#ifndef TWI_TIMEOUT_MS
+		#define TWI_TIMEOUT_MS 20 // A 13 byte head unit read at 16KHz is 7.4mS
+	#endif
+
+	#define TWI_RECOVERY_CLOCKS 9 // Enough for a slave part way through a byte to finish it and see a NACK
+
+	struct twi_counters {
+		uint16_t timeouts; // waits that ran out, each followed by a recovery
+		uint16_t freed; // recoveries that found SDA held low and had to clock it free
+		uint16_t busErrors; // illegal starts or stops seen by the module
+	};
 
 	void twi_init(void);
 	uint8_t twi_readFrom(uint8_t, uint8_t*, uint8_t, uint8_t);
 	uint8_t twi_writeTo(uint8_t, uint8_t*, uint8_t, uint8_t, uint8_t);
+	uint8_t twi_idle(void);
+	void twi_getCounters(struct twi_counters*);
+#if TWI_SLAVE
+	void twi_setAddress(uint8_t);
+	void twi_setSlaveImage(const uint8_t*, uint8_t);
+	uint8_t twi_slaveWritten(uint8_t*);
+#endif
 
 #endif
 
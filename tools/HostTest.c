@@ -0,0 +1,285 @@
+// Host test: runs the unmodified firmware, twi.c included, through scenarios on the host peripheral model and checks
+// the I2C paths end to end
+//
+// "timebase" runs TimerServices.c on its own, reading getTicks() and getTime() back to back across the Timer-1 periods
+// and checking that neither goes backwards and getTicks() moves on by no more than the counts elapsed, over TOP and the
+// overflow interrupt in particular. Then each scenario boots from power on with an erased EEPROM, a steady 8.2V supply and no lamp current, and turns the lamp
+// on with the up and on/off buttons. twi.c's counters aren't cleared by a reset on the host, so each scenario checks by
+// how much they moved. "lamp" checks that the expanders come up and the lamp goes on with no transaction
+// failing other than the scan's address NACKs. "stuck" then has the first expander hold SDA, for twi.c's deadline to run
+// out, its recovery to clock the bus free and the lamp to be put back. "overcurrent" trips the comparator with the lamp
+// on, for the FET to be off at HALT() and the interrupt taken within its Hal.h budget while twi.c's handler nests.
+// "brownout" resets the first expander with the lamp on and no bus timeout, for the IOCON read back to find it in
+// sequential mode and put it back, the lamp on again.
+// Built with -DTWI_SLAVE=1, "headunit" has another master write a level to the firmware's slave and then keep the bus
+// busy reading it back, each read racing the firmware's own transactions for the bus so that twi.c's lost arbitration
+// retry runs. Every check is listed, the longest stretch with interrupts off is checked across them all at the end, and
+// built with BENCHMARK_ENABLE the TWI handler's entries are counted too. Exits with 1 if anything failed.
+//
+// Build from this directory, adding any -D flags the firmware is to be configured with:
+//  cc -std=gnu99 -O2 -DF_CPU=8000000UL -I../BikeLightController -I../BikeLightController/host -o HostTest HostTest.c
+//   $(ls ../BikeLightController/*.c | grep -v /BikeLightController.c) ../BikeLightController/host/*.c
+//
+// Usage: HostTest
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#define main firmwareMain
+#include "BikeLightController.c"
+#undef main
+
+#include "HostPeripherals.h"
+
+#define LAMPBIT 0x80 // MCP23008 GP7
+#define BUTTONONOFF 0x02
+#define BUTTONUP 0x04
+#define SUPPLYCOUNTS 825 // 8.2V
+#define HEADUNITLEVEL 3
+
+struct Scenario {
+	const char *name;
+	double runTo; // Seconds from power on
+	double stickAt; // Zero for never
+	double overCurrentAt;
+	double headUnitAt;
+	double brownOutAt;
+};
+
+static const struct Scenario scenarios[] = {
+	{"lamp", 7.0, 0, 0, 0, 0},
+	{"stuck", 8.0, 6.5, 0, 0, 0},
+	{"overcurrent", 8.0, 0, 6.5, 0, 0},
+	{"brownout", 9.0, 0, 0, 0, 6.5},
+#if TWI_SLAVE
+	{"headunit", 9.0, 0, 0, 6.0, 0},
+#endif
+};
+
+static struct {
+	const struct Scenario *scenario;
+	uint64_t base; // Cycle the scenario started at
+	int failures;
+	struct { // Cleared for each scenario
+		// Firmware transactions
+		unsigned long nTwi;
+		unsigned long nBad; // Failed other than by the scan's address NACKs or the stuck bus
+		unsigned long nAbandoned;
+		uint8_t lastStatus;
+		// The other master's
+		unsigned long nOther;
+		unsigned long nOtherShort;
+		unsigned long nLevelReads; // Reads of the level, from a second after it was written
+		unsigned long nLevelWrong;
+		int brownedOut;
+		// The time base's
+		unsigned long nReads;
+		unsigned long nBackwards;
+		unsigned long nJumps; // getTicks() on by more than the counts between the reads
+		unsigned long nPeriods;
+	} run;
+} test;
+
+static double simTime(void)
+{
+	return (double)(hostCycles() - test.base) / F_CPU;
+}
+
+static void check(const char *what, int ok)
+{
+	printf("%-14s %-48s %s\n", test.scenario->name, what, ok ? "ok" : "FAIL");
+	test.failures += !ok;
+}
+
+static uint16_t adcInput(uint8_t admux)
+{
+	double t = simTime();
+	uint8_t buttons = 0;
+
+	if(t >= 5.0 && t < 5.1) {
+		buttons = BUTTONUP;
+	} else if(t >= 5.5 && t < 5.6) {
+		buttons = BUTTONONOFF;
+	}
+	hostSetButtons(buttons);
+
+	if(test.scenario->brownOutAt && t >= test.scenario->brownOutAt && !test.run.brownedOut) {
+		hostBrownOutExpander();
+		test.run.brownedOut = 1;
+	}
+	if(test.scenario->overCurrentAt && t >= test.scenario->overCurrentAt) {
+		hostSetOverCurrent(1);
+	}
+	if(test.scenario->headUnitAt && t >= test.scenario->headUnitAt) { // Each as soon as the last has ended
+		static const uint8_t pointer = HEADUNITREG_LEVEL;
+		uint8_t write[2] = {HEADUNITREG_LEVEL, HEADUNITLEVEL};
+
+		if(test.run.nOther == 0) {
+			test.run.nOther += hostTwiSlaveWrite(HEADUNIT_ADDRESS, write, sizeof(write));
+		} else if(t >= test.scenario->headUnitAt + 0.5) { // Once the main loop has taken the level, a new write would lose it
+			if(test.run.nOther % 2) {
+				test.run.nOther += hostTwiSlaveWrite(HEADUNIT_ADDRESS, &pointer, 1);
+			} else {
+				test.run.nOther += hostTwiSlaveRead(HEADUNIT_ADDRESS, HEADUNITREG_I2CTIMEOUTS + 1 - HEADUNITREG_LEVEL);
+			}
+		}
+	}
+
+	return (admux & 0x07) == 0x07 ? 0 : SUPPLYCOUNTS;
+}
+
+static void twiTransaction(uint8_t address, uint8_t isRead, const uint8_t *data, uint8_t length, uint8_t status)
+{
+	test.run.nTwi++;
+	test.run.lastStatus = status;
+	if(status == 5) {
+		test.run.nAbandoned++;
+	} else if(status != 0 && !(status == 2 && address != 0x20)) {
+		test.run.nBad++;
+	}
+}
+
+static void twiSlaveTransaction(uint8_t address, uint8_t isRead, const uint8_t *data, uint8_t length)
+{
+	if(isRead) {
+		if(length != HEADUNITREG_I2CTIMEOUTS + 1 - HEADUNITREG_LEVEL) {
+			test.run.nOtherShort++;
+		} else if(simTime() > test.scenario->headUnitAt + 1.0) { // The image is rebuilt each tick
+			test.run.nLevelReads++;
+			test.run.nLevelWrong += data[0] != HEADUNITLEVEL;
+		}
+	} else if(length != (test.run.nOther == 1 ? 2 : 1)) {
+		test.run.nOtherShort++;
+	}
+}
+
+static int timeBaseMain(void)
+{
+	uint_fast32_t lastTicks, lastTime;
+	uint64_t lastBefore, before;
+
+	initTimers();
+	startTimers();
+	sei();
+	lastBefore = hostCycles();
+	lastTicks = getTicks();
+	lastTime = getTime();
+	for(;;) {
+		uint_fast32_t ticks, time;
+
+		before = hostCycles();
+		ticks = getTicks();
+		time = getTime();
+		test.run.nReads++;
+		test.run.nBackwards += ticks < lastTicks || time < lastTime;
+		test.run.nJumps += ticks - lastTicks > (hostCycles() - lastBefore) / 1024 + 1;
+		test.run.nPeriods += ticks / (TIMER1TOP + 1) != lastTicks / (TIMER1TOP + 1);
+		lastTicks = ticks;
+		lastTime = time;
+		lastBefore = before;
+	}
+
+	return 0;
+}
+
+static void runTimeBase(void)
+{
+	int exitCode;
+
+	memset(&test.run, 0, sizeof(test.run));
+	test.scenario = &(struct Scenario){"timebase"};
+	hostReset(1<<PORF);
+	hostStopAt(hostCycles() + 3 * F_CPU);
+	exitCode = hostRun(timeBaseMain);
+
+	check("ran to the end", exitCode == HOSTEXIT_TIMEUP);
+	check("getTicks() and getTime() never go backwards", test.run.nReads > 0 && test.run.nBackwards == 0);
+	check("getTicks() never runs ahead of Timer-1", test.run.nJumps == 0);
+	check("read across TOP and the overflow", test.run.nPeriods >= 10);
+}
+
+static void runScenario(const struct Scenario *scenario)
+{
+	struct twi_counters twiBefore, twiCount;
+	struct HostLatencyStats latencyStats;
+	uint32_t takenBefore;
+	int exitCode;
+
+	memset(&test.run, 0, sizeof(test.run));
+	test.scenario = scenario;
+	test.base = hostCycles();
+	memset(hostEeprom(), 0xFF, E2END + 1); // No lamp memory, fault log or charge state
+	hostSetButtons(0);
+	hostSetOverCurrent(0);
+	hostStickBus(scenario->stickAt ? test.base + (uint64_t)(scenario->stickAt * F_CPU) : 0);
+	hostLatencyStats(&latencyStats);
+	takenBefore = latencyStats.taken[HOSTSAFETY_OVERCURRENT];
+	twi_getCounters(&twiBefore);
+
+	hostReset(1<<PORF);
+	hostStopAt(test.base + (uint64_t)(scenario->runTo * F_CPU));
+	exitCode = hostRun(firmwareMain);
+	twi_getCounters(&twiCount);
+	twiCount.timeouts -= twiBefore.timeouts;
+	twiCount.freed -= twiBefore.freed;
+	twiCount.busErrors -= twiBefore.busErrors;
+
+	check("transactions, none failed", test.run.nTwi > 0 && test.run.nBad == 0);
+	if(scenario->overCurrentAt) {
+		hostLatencyStats(&latencyStats);
+		check("tripped, HALT() and the watchdog reset", exitCode == HOSTEXIT_WATCHDOG && hostHaltCycle() > test.base);
+		check("FET off", !(PORTC & (1<<PC1)));
+		check("over current taken within budget", latencyStats.taken[HOSTSAFETY_OVERCURRENT] == takenBefore + 1 &&
+			latencyStats.maxLatency[HOSTSAFETY_OVERCURRENT] <= ISRLATENCY_ANALOGCOMP);
+		return;
+	}
+
+	check("ran to the end", exitCode == HOSTEXIT_TIMEUP);
+	check("lamp on", (hostExpanderOLAT() & LAMPBIT) && lampGetLevel() > 0);
+	if(scenario->brownOutAt) {
+		check("expander restored after its reset", test.run.brownedOut && hostExpanderIOCON() == 0x20);
+	}
+	if(scenario->stickAt) {
+		check("one timeout, the bus clocked free", twiCount.timeouts == 1 && twiCount.freed == 1 && test.run.nAbandoned == 1);
+		check("transactions since succeed", test.run.lastStatus == 0);
+	} else {
+		check("no timeouts", twiCount.timeouts == 0 && twiCount.freed == 0 && test.run.nAbandoned == 0);
+	}
+	check("no bus errors", twiCount.busErrors == 0);
+	if(scenario->headUnitAt) {
+		check("head unit transactions acked in full", test.run.nOther > 2 && test.run.nOtherShort == 0);
+		check("head unit level written", lampGetLevel() == HEADUNITLEVEL);
+		check("head unit level read back", test.run.nLevelReads > 0 && test.run.nLevelWrong == 0);
+	}
+}
+
+int main(void)
+{
+	struct HostLatencyStats latencyStats;
+
+	hostHooks.adcInput = adcInput;
+	hostHooks.twiTransaction = twiTransaction;
+	hostHooks.twiSlaveTransaction = twiSlaveTransaction;
+
+	runTimeBase(); // First, before the firmware leaves the clock scaled
+	for(unsigned idx = 0; idx < sizeof(scenarios) / sizeof(scenarios[0]); idx++) {
+		runScenario(scenarios + idx);
+	}
+
+	hostLatencyStats(&latencyStats);
+	test.scenario = &(struct Scenario){"all"};
+	check("interrupts held off within budget", latencyStats.maxMasked <= ISRHOLD_MAX);
+#if BENCHMARK_ENABLE
+	{
+		struct HostBenchStats benchStats;
+
+		hostBenchStats(BENCH_TWIISR, &benchStats);
+		check("TWI handler entered", benchStats.count > 0);
+		printf("# TWI handler %lu times\n", (unsigned long)benchStats.count);
+	}
+#endif
+	printf("# %d failed\n", test.failures);
+
+	return test.failures ? 1 : 0;
+}
\ No newline at end of file
@@ -0,0 +1,169 @@
+// Lamp curve calibration: turns a capture of the USART from a LAMPVERIFY_CALIBRATE build into LAMPCURVE_MA
+//
+// The capture is the raw bytes the telemetry sent (a serial terminal's binary log, or RideReplay -r), frames other than
+// TELEMETRY_CURVE and any that don't check are skipped. Readings taken with the wiper count untrusted are left out, so
+// start from a power on (whose sweep makes it trusted) and step up through the levels with the button, a couple of
+// seconds at each. Each level's readings are averaged, a curve point at a level with none is interpolated between the
+// nearest levels either side that have them, and the point one past the top is carried on from the top two levels read.
+// The table lists every level read and each point, marking those that weren't read directly, followed by the flags to
+// build with. Exits with 1 if fewer than two levels were read or the curve doesn't rise, as LampControl.c needs it to.
+//
+// Build from this directory:
+//  cc -std=gnu99 -O2 -I../BikeLightController -o LampCurve LampCurve.c
+//
+// Usage: LampCurve usart.bin
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "LampControl.h"
+#include "Telemetry.h"
+
+#define NLEVELS (LAMPLEVELMAX + 1)
+
+static struct {
+	double sum[NLEVELS];
+	unsigned long count[NLEVELS];
+	unsigned long nFrames;
+	unsigned long nUntrusted;
+	unsigned long nBad;
+} curve;
+
+static void takeFrame(const uint8_t *frame)
+{
+	const uint8_t *p = frame + 3;
+
+	if(frame[1] != TELEMETRY_CURVE || frame[2] != TELEMETRYCURVELENGTH) {
+		return;
+	}
+	curve.nFrames++;
+	if(!p[1] || p[0] >= NLEVELS) {
+		curve.nUntrusted++;
+		return;
+	}
+	curve.sum[p[0]] += p[2] | (p[3] << 8);
+	curve.count[p[0]]++;
+}
+
+static int readCapture(FILE *f)
+{
+	uint8_t frame[3 + 255 + 1];
+	unsigned frameIdx = 0;
+	int c;
+
+	while((c = fgetc(f)) != EOF) {
+		if(frameIdx == 0 && c != TELEMETRYSYNC) { // Hunting for the start of a frame
+			continue;
+		}
+		frame[frameIdx++] = c;
+		if(frameIdx > 3 && frameIdx == 3 + frame[2] + 1u) {
+			uint8_t sum = 0;
+
+			for(unsigned idx = 1; idx < frameIdx; idx++) {
+				sum += frame[idx];
+			}
+			if(sum == 0) {
+				takeFrame(frame);
+			} else {
+				curve.nBad++;
+			}
+			frameIdx = 0;
+		}
+	}
+
+	return ferror(f) ? -1 : 0;
+}
+
+static double levelMean(int level)
+{
+	return curve.sum[level] / curve.count[level];
+}
+
+static double pointAt(int level, int *measured) // Interpolated or carried on from the levels read
+{
+	int below, above;
+
+	*measured = level < NLEVELS && curve.count[level];
+	if(*measured) {
+		return levelMean(level);
+	}
+	for(below = level < NLEVELS ? level : NLEVELS - 1; below >= 0 && !curve.count[below]; below--) {
+		continue;
+	}
+	for(above = level + 1; above < NLEVELS && !curve.count[above]; above++) {
+		continue;
+	}
+	if(below < 0 || above >= NLEVELS) { // Off one end, carry on from the two nearest
+		int a, b;
+
+		if(below < 0) {
+			for(a = above, b = above + 1; b < NLEVELS && !curve.count[b]; b++) {
+				continue;
+			}
+		} else {
+			for(b = below, a = below - 1; a >= 0 && !curve.count[a]; a--) {
+				continue;
+			}
+		}
+		below = a;
+		above = b;
+	}
+
+	return levelMean(below) + (levelMean(above) - levelMean(below)) * (level - below) / (above - below);
+}
+
+int main(int argc, char **argv)
+{
+	FILE *f;
+	int level, nLevels = 0, rising = 1;
+	long point[LAMPCURVEPOINTS];
+
+	if(argc != 2) {
+		fprintf(stderr, "Usage: %s usart.bin\n", argv[0]);
+		return 2;
+	}
+	if(!(f = fopen(argv[1], "rb"))) {
+		perror(argv[1]);
+		return 2;
+	}
+	if(readCapture(f)) {
+		perror(argv[1]);
+		fclose(f);
+		return 2;
+	}
+	fclose(f);
+
+	printf("# %lu lamp curve frames, %lu untrusted, %lu bad frames\n", curve.nFrames, curve.nUntrusted, curve.nBad);
+	for(level = 0; level < NLEVELS; level++) {
+		if(curve.count[level]) {
+			printf("level %2d: %7.1fmA from %lu readings\n", level, levelMean(level), curve.count[level]);
+			nLevels++;
+		}
+	}
+	if(nLevels < 2) {
+		printf("# too few levels read to make a curve from\n");
+		return 1;
+	}
+
+	for(int idx = 0; idx < LAMPCURVEPOINTS; idx++) {
+		int measured;
+		double mA = pointAt(idx << LAMPCURVESHIFT, &measured);
+
+		point[idx] = mA < 0 ? 0 : (long)(mA + 0.5);
+		printf("point %d, level %2d: %5ldmA%s\n", idx, idx << LAMPCURVESHIFT, point[idx], measured ? "" : " (not read)");
+		if(idx > 0 && point[idx] <= point[idx - 1]) {
+			rising = 0;
+		}
+	}
+
+	printf("-DLAMPCURVE_MA=");
+	for(int idx = 0; idx < LAMPCURVEPOINTS; idx++) {
+		printf("%ld%s", point[idx], idx < LAMPCURVEPOINTS - 1 ? "," : " -DLAMPCURVE_CALIBRATED=1\n");
+	}
+	if(!rising) {
+		printf("# the curve doesn't rise from point to point, read the levels again\n");
+		return 1;
+	}
+
+	return 0;
+}
\ No newline at end of file
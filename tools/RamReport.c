@@ -0,0 +1,202 @@
+// Static RAM per module, from the linker map the firmware build writes (BikeLightController.map in the output folder)
+//
+// Every input section the linker placed in .data, .bss (and COMMON) or .noinit is charged to the object file, or the
+// library member, it came from. The table is sorted largest first and ends with the totals and what's left of RAM
+// for the stack, which is what StackMonitor.h's painting has to work with. RAM is the ATmega48's 512 bytes unless -r
+// says otherwise, the map's memory configuration is the architecture's and doesn't know the part. -w exits with 2 if
+// less than that many bytes are left for the stack, so it can be run as a post-build step to fail the build.
+//
+// The optional features (TRACE_ENABLE, FAULTLOG_ENABLE, LAMPMEMORY_ENABLE, SOC_ENABLE, PATTERN_ENABLE, SUPERVISOR_ENABLE,
+// CLOCK_SCALING, STACKMON_ENABLE, ADC_ADAPTIVE and a second lamp with LAMP_MAXLAMPS) are off by default until a build with
+// them has been shown to fit, avr-size for the 4K of flash and this for the RAM. Turn them on with -D once it has.
+//
+// Build from this directory:
+//  cc -std=gnu99 -O2 -o RamReport RamReport.c
+//
+// Usage: RamReport [-r ramBytes] [-w minStackBytes] BikeLightController.map
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#define MAXLINE 512
+#define MAXMODULES 64
+#define MODULENAME 48
+
+#define SECTDATA 0
+#define SECTBSS 1
+#define SECTNOINIT 2
+#define NSECTS 3
+
+static const char *sectNames[NSECTS] = {".data", ".bss", ".noinit"};
+
+static struct {
+	struct RamModule {
+		char name[MODULENAME];
+		unsigned long size[NSECTS];
+	} module[MAXMODULES];
+	unsigned nModules;
+	unsigned long ramSize;
+} report;
+
+static int outputSection(const char *name)
+{
+	for(int sect = 0; sect < NSECTS; sect++) {
+		if(!strcmp(name, sectNames[sect])) {
+			return sect;
+		}
+	}
+	return -1;
+}
+
+static void charge(const char *file, int sect, unsigned long size)
+{
+	const char *name = strrchr(file, '/');
+	unsigned idx;
+
+	name = name ? name + 1 : file;
+	if(strrchr(name, '\\')) {
+		name = strrchr(name, '\\') + 1;
+	}
+
+	for(idx = 0; idx < report.nModules; idx++) {
+		if(!strcmp(report.module[idx].name, name)) {
+			break;
+		}
+	}
+	if(idx == report.nModules) {
+		if(report.nModules == MAXMODULES) {
+			idx--; // Lump the rest in with the last
+		} else {
+			snprintf(report.module[idx].name, MODULENAME, "%s", name);
+			report.nModules++;
+		}
+	}
+	report.module[idx].size[sect] += size;
+}
+
+static unsigned long moduleTotal(const struct RamModule *module)
+{
+	return module->size[SECTDATA] + module->size[SECTBSS] + module->size[SECTNOINIT];
+}
+
+static int byTotal(const void *a, const void *b)
+{
+	unsigned long ta = moduleTotal(a), tb = moduleTotal(b);
+
+	return ta < tb ? 1 : ta > tb ? -1 : strcmp(((const struct RamModule *)a)->name, ((const struct RamModule *)b)->name);
+}
+
+static int readMap(FILE *map)
+{
+	char line[MAXLINE], pending[MAXLINE] = "";
+	int inMap = 0, sect = -1;
+
+	while(fgets(line, sizeof(line), map)) {
+		char name[MAXLINE], file[MAXLINE];
+		unsigned long addr, size;
+
+		line[strcspn(line, "\r\n")] = '\0';
+
+		if(!inMap) {
+			inMap = !strncmp(line, "Linker script and memory map", 28); // Past the memory configuration
+			continue;
+		}
+
+		if(line[0] == '.') { // An output section, the name may be on a line of its own
+			if(sscanf(line, "%s", name) == 1) {
+				sect = outputSection(name);
+			}
+			pending[0] = '\0';
+			continue;
+		}
+		if(line[0] != ' ' || sect < 0) {
+			continue;
+		}
+
+		if(pending[0]) { // Address, size and file for the input section named on the line before
+			if(sscanf(line, " %lx %lx %[^\n]", &addr, &size, file) == 3 && size) {
+				charge(file, sect, size);
+			}
+			pending[0] = '\0';
+			continue;
+		}
+
+		if(line[1] != '.' && strncmp(line + 1, "COMMON", 6)) { // Symbols, *fill* and linker script statements
+			continue;
+		}
+		switch(sscanf(line, " %s %lx %lx %[^\n]", name, &addr, &size, file)) {
+			case 1: // Too long for the column
+				snprintf(pending, sizeof(pending), "%s", name);
+				break;
+			case 4:
+				if(size) {
+					charge(file, sect, size);
+				}
+				break;
+		}
+	}
+	return inMap;
+}
+
+int main(int argc, char **argv)
+{
+	const char *fileName = NULL;
+	long minStack = -1;
+	unsigned long totals[NSECTS] = {0}, used;
+	FILE *map;
+
+	report.ramSize = 512; // ATmega48
+
+	for(int argIdx = 1; argIdx < argc; argIdx++) {
+		if(!strcmp(argv[argIdx], "-r") && argIdx + 1 < argc) {
+			report.ramSize = strtoul(argv[++argIdx], NULL, 0);
+		} else if(!strcmp(argv[argIdx], "-w") && argIdx + 1 < argc) {
+			minStack = strtol(argv[++argIdx], NULL, 0);
+		} else if(argv[argIdx][0] != '-' && !fileName) {
+			fileName = argv[argIdx];
+		} else {
+			fileName = NULL;
+			break;
+		}
+	}
+	if(!fileName) {
+		fprintf(stderr, "Usage: %s [-r ramBytes] [-w minStackBytes] BikeLightController.map\n", argv[0]);
+		return 1;
+	}
+
+	if(!(map = fopen(fileName, "r"))) {
+		perror(fileName);
+		return 1;
+	}
+	if(!readMap(map)) {
+		fprintf(stderr, "%s: no memory map in it\n", fileName);
+		fclose(map);
+		return 1;
+	}
+	fclose(map);
+
+	qsort(report.module, report.nModules, sizeof(report.module[0]), byTotal);
+
+	printf("%-28s %7s %7s %7s %7s\n", "module", ".data", ".bss", ".noinit", "total");
+	for(unsigned idx = 0; idx < report.nModules; idx++) {
+		const struct RamModule *module = &report.module[idx];
+
+		printf("%-28s %7lu %7lu %7lu %7lu\n", module->name, module->size[SECTDATA], module->size[SECTBSS],
+			module->size[SECTNOINIT], moduleTotal(module));
+		for(int sect = 0; sect < NSECTS; sect++) {
+			totals[sect] += module->size[sect];
+		}
+	}
+	used = totals[SECTDATA] + totals[SECTBSS] + totals[SECTNOINIT];
+	printf("%-28s %7lu %7lu %7lu %7lu\n", "total", totals[SECTDATA], totals[SECTBSS], totals[SECTNOINIT], used);
+
+	if(used > report.ramSize) {
+		printf("# static RAM %lu bytes is over the %lu there are\n", used, report.ramSize);
+		return 2;
+	}
+	printf("# %lu of %lu bytes of RAM static, %lu left for the stack\n", used, report.ramSize, report.ramSize - used);
+
+	return minStack >= 0 && report.ramSize - used < (unsigned long)minStack ? 2 : 0;
+}
\ No newline at end of file
@@ -0,0 +1,536 @@
+// Ride replay: runs the unmodified firmware against a recorded (or synthetic) ride on the host peripheral model
+//
+// The trace is CSV, one sample per line: time_s,current,voltage[,buttons[,overcurrent[,lowpower]]]
+//  current and voltage are raw ADC counts unless scaled with -a/-v, and are interpolated linearly between samples
+//  buttons is the MCP23008 GPIO mask held pressed (2 on/off, 4 up, 8 down), the last two columns are 0 or 1
+//  Blank lines, lines starting with '#' and a non-numeric header line are skipped
+//
+// Every conversion the firmware's ADC ISR takes is fed from the trace, so the averaging, bias removal, coulomb
+// counting, the safety checks in main() and the lamp logic all run exactly as built for the target. The output is a
+// timeline of FET and lamp changes, rheostat moves, trips (HALT() and the watchdog reset that follows) and,
+// with -i, every I2C transaction. Changes are stamped when next seen by an ADC conversion or I2C transaction, so
+// to within a fraction of a millisecond once the ADC is running. After a watchdog reset the firmware is started
+// again, as the hardware would, and the replay carries on until the end of the trace.
+//
+// Build from this directory, adding any -D flags the firmware is to be configured with:
+//  cc -std=gnu99 -O2 -DF_CPU=8000000UL -I../BikeLightController -I../BikeLightController/host -o RideReplay RideReplay.c
+//   $(ls ../BikeLightController/*.c | grep -v /BikeLightController.c) ../BikeLightController/host/*.c
+//
+// Most of what follows needs the feature built in, they're off by default (see tools/RamReport.c).
+// -t writes the firmware's event trace ring (TRACE_ENABLE) out at the end, in the form TraceDecode reads. -u adds the
+// telemetry frames the USART sends (TELEMETRY_ENABLE) to the timeline, checking each one as a receiver would.
+// The fault log (FAULTLOG_ENABLE) is listed at the end, -e keeps the EEPROM in a file so that it carries over from one
+// replay to the next, and with it the level and mode LampMemory.h brings the lamp back up at.
+// -g hangs the main line at the given time (its next watchdog kick never returns) to exercise the supervisor.
+// -l puts that many MCP23008 lamp drivers on the bus (up to LAMP_MAXLAMPS are driven), the trace's buttons and the
+// rheostat moves shown are the first's.
+// -s has the first of them hold the bus at the given time, to exercise twi.c's timeouts and recovery.
+// -c adds what the first lamp draws to the trace's current while it's lit, from the firmware's own lampCurveCurrent() at
+// the modelled wiper position times -k (1 unless given), so the wiper verification in LampControl.c finds the count good,
+// or with -k finds a lamp the curve doesn't fit. -w slips that wiper RIDEREPLAYSLIPSTEPS up at the given time without the
+// firmware knowing, to exercise the verification's resync. -r writes every byte the USART sends to a file, the capture
+// tools/LampCurve.c reads from a LAMPVERIFY_CALIBRATE build. -d adds that many counts peak to peak of uniform noise to
+// every conversion before it's rounded, as the real converter's noise does, without which ADC_HIRES's decimation has
+// nothing to resolve between the counts.
+// The summary splits the time by clock (see Clock.h) and sleep, counts the wakes from sleep and gives a rough figure for
+// the MCU's own supply current. It checks the longest stretch with interrupts off and the over current and low power
+// interrupts' latencies against the Hal.h budgets, exiting with 3 if any is over. Built with BENCHMARK_ENABLE it adds
+// the Benchmark.h sections' counts and times, which with -DLAMPWIPER_BACKEND=0 or 1 compares the two lamp wiper
+// backends (BENCH_LAMPRESET 5, BENCH_LAMPLEVEL 7). Built with ENERGY_ENABLE it adds the firmware's own EnergyMonitor.h
+// shares and energy estimate since the last boot, to be read against the model's figure above. The model charges no
+// time for instructions so handlers show up as next to nothing, it's the sleep and busy wait shares that count here.
+//
+// Usage: RideReplay [-i] [-u] [-a countsPerAmp] [-v countsPerVolt] [-b currentBiasCounts] [-t dump.bin] [-e eeprom.bin]
+//  [-g hangTime] [-l lamps] [-s stuckTime] [-c] [-k lampScale] [-w slipTime] [-r usart.bin] [-d ditherCounts] trace.csv
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#define main firmwareMain
+#include "BikeLightController.c"
+#undef main
+
+#include "HostPeripherals.h"
+
+#define MCUACTIVEMAPERMHZ 0.5 // Rough ATmega48 supply current at 5V, running
+#define MCUIDLEMAPERMHZ 0.13 // And in idle sleep
+
+#define LAMPBIT 0x80 // MCP23008 GP7
+#define LEDBIT 0x01 // MCP23008 GP0, active low
+#define RIDEREPLAYSLIPSTEPS 8
+
+struct TraceRow {
+	double t;
+	double current;
+	double voltage;
+	uint8_t buttons;
+	uint8_t overCurrent;
+	uint8_t lowPower;
+};
+
+static struct {
+	struct TraceRow *row;
+	size_t nRows;
+	size_t cursor;
+	double currentScale;
+	double voltageScale;
+	double currentBias;
+	int verbose;
+	int telemetry;
+	int lampModel;
+	double lampScale;
+	double dither; // Counts peak to peak
+	uint32_t ditherSeed;
+	FILE *usartCapture;
+	double slipAt; // Negative once done, or if there's to be none
+	// What the timeline last reported
+	int fet;
+	int lampReset;
+	int olat;
+	int duty;
+	// Summary
+	unsigned long nTwi;
+	unsigned long nTwiFailed;
+	unsigned long nRheostatSteps;
+	unsigned long nTrips;
+	unsigned long nFrames;
+	unsigned long nBadFrames;
+	int overBudget;
+	// Telemetry receiver
+	uint8_t frame[3 + 255 + 1];
+	unsigned frameIdx;
+} replay;
+
+static double simTime(void)
+{
+	return (double)hostCycles() / F_CPU;
+}
+
+static const struct TraceRow *sampleAt(double t, struct TraceRow *interp)
+{
+	const struct TraceRow *r = replay.row;
+
+	while(replay.cursor > 0 && r[replay.cursor].t > t) { // Looking back, at a trip
+		replay.cursor--;
+	}
+	while(replay.cursor + 1 < replay.nRows && r[replay.cursor + 1].t <= t) {
+		replay.cursor++;
+	}
+	*interp = r[replay.cursor];
+	if(replay.cursor + 1 < replay.nRows && t > r[replay.cursor].t) {
+		const struct TraceRow *a = r + replay.cursor;
+		const struct TraceRow *b = a + 1;
+		double f = (t - a->t) / (b->t - a->t);
+
+		interp->current = a->current + f * (b->current - a->current);
+		interp->voltage = a->voltage + f * (b->voltage - a->voltage);
+	}
+
+	return interp;
+}
+
+static uint16_t toCounts(double v)
+{
+	if(replay.dither > 0) { // Uniform, from a fixed seed so that a replay always comes out the same
+		replay.ditherSeed = replay.ditherSeed * 1103515245u + 12345u;
+		v += replay.dither * ((double)(replay.ditherSeed >> 8) / (1u << 24) - 0.5);
+	}
+	if(v < 0) {
+		return 0;
+	}
+	if(v > ADCMAXVALUE) {
+		return ADCMAXVALUE;
+	}
+	return (uint16_t)(v + 0.5);
+}
+
+static void pollOutputs(void)
+{
+	int fet = (PORTC & (1<<PC1)) ? 1 : 0;
+	int lampReset = (PORTD & (1<<PD5)) ? 0 : 1;
+	int olat = hostExpanderOLAT();
+
+	if(fet != replay.fet) {
+		printf("%12.6f fet %s\n", simTime(), fet ? "on" : "off");
+		replay.fet = fet;
+	}
+	if(lampReset != replay.lampReset) {
+		printf("%12.6f lamp %s\n", simTime(), lampReset ? "held in reset" : "released");
+		replay.lampReset = lampReset;
+	}
+	if((olat ^ replay.olat) & LAMPBIT) {
+		printf("%12.6f lamp %s\n", simTime(), (olat & LAMPBIT) ? "on" : "off");
+	}
+	if((olat ^ replay.olat) & LEDBIT) {
+		printf("%12.6f led %s\n", simTime(), (olat & LEDBIT) ? "off" : "on");
+	}
+	replay.olat = olat;
+#if LAMPDIM_BACKEND != LAMPDIM_RHEOSTAT
+	if(pwmDimGet() != replay.duty) {
+		replay.duty = pwmDimGet();
+		printf("%12.6f pwm duty %d\n", simTime(), replay.duty);
+	}
+#endif
+}
+
+static uint16_t adcInput(uint8_t admux)
+{
+	struct TraceRow now;
+
+	sampleAt(simTime(), &now);
+	hostSetButtons(now.buttons);
+	hostSetOverCurrent(now.overCurrent);
+	hostSetLowPower(now.lowPower);
+	pollOutputs();
+	if(replay.slipAt >= 0 && simTime() >= replay.slipAt) {
+		replay.slipAt = -1;
+		printf("%12.6f rheostat slips %d steps\n", simTime(), RIDEREPLAYSLIPSTEPS);
+		hostSlipRheostat(RIDEREPLAYSLIPSTEPS);
+	}
+
+	if((admux & 0x07) == 0x07) { // ADC7, the current sense
+		double lamp = 0;
+
+		if(replay.lampModel && replay.fet == 1 && replay.lampReset == 0 && (replay.olat & LAMPBIT)) {
+			lamp = lampCurveCurrent(hostRheostatPosition()) * replay.lampScale * 256.0 / UNITS_MAPERCOUNT_Q8; // mA to counts
+		}
+		return toCounts(now.current * replay.currentScale + replay.currentBias + lamp);
+	} else { // ADC3, the supply voltage
+		return toCounts(now.voltage * replay.voltageScale);
+	}
+}
+
+static void twiTransaction(uint8_t address, uint8_t isRead, const uint8_t *data, uint8_t length, uint8_t status)
+{
+	replay.nTwi++;
+	replay.nTwiFailed += status != 0;
+	if(replay.verbose) {
+		uint8_t idx;
+
+		printf("%12.6f i2c %s 0x%02x status %u:", simTime(), isRead ? "rd" : "wr", address, status);
+		for(idx = 0; idx < length; idx++) {
+			printf(" %02x", data[idx]);
+		}
+		printf("\n");
+	}
+	pollOutputs();
+}
+
+static void rheostatStep(uint8_t position)
+{
+	static double tLast = -1;
+	static int lastReported = -1;
+
+	replay.nRheostatSteps++;
+	if(simTime() - tLast > 0.01 || position == 0 || position == HOSTRHEOSTATSTEPS - 1) { // Collapse sweeps into their end points
+		if(position != lastReported) {
+			printf("%12.6f rheostat %u\n", simTime(), position);
+			lastReported = position;
+		}
+	}
+	tLast = simTime();
+}
+
+static void printFrame(const uint8_t *frame)
+{
+	const uint8_t *p = frame + 3;
+
+	if(frame[1] == TELEMETRY_STATUS && frame[2] == TELEMETRYSTATUSLENGTH) {
+		printf("%12.6f telemetry seq %u dropped %u current %u voltage %u charge %lu level %u flags 0x%02x\n", simTime(),
+			p[0], p[1] | (p[2] << 8), p[3] | (p[4] << 8), p[5] | (p[6] << 8),
+			(unsigned long)p[7] | ((unsigned long)p[8] << 8) | ((unsigned long)p[9] << 16) | ((unsigned long)p[10] << 24), p[11], p[12]);
+	} else if(frame[1] == TELEMETRY_FAULT && frame[2] == TELEMETRYFAULTLENGTH) {
+		printf("%12.6f telemetry fault seq %u reason %u at %.3fs current %u voltage %u charge %lu level %u\n", simTime(),
+			p[14], p[13], (p[0] | (p[1] << 8) | ((unsigned long)p[2] << 16) | ((unsigned long)p[3] << 24)) / 1000.0,
+			p[8] | (p[9] << 8), p[10] | (p[11] << 8),
+			(unsigned long)p[4] | ((unsigned long)p[5] << 8) | ((unsigned long)p[6] << 16) | ((unsigned long)p[7] << 24), p[12]);
+	} else if(frame[1] == TELEMETRY_CURVE && frame[2] == TELEMETRYCURVELENGTH) {
+		printf("%12.6f telemetry lamp curve level %u%s current %umA (hi-res %u)\n", simTime(), p[0], p[1] ? "" : " (untrusted)",
+			p[2] | (p[3] << 8), p[4] | (p[5] << 8));
+	} else {
+		printf("%12.6f telemetry type %u length %u\n", simTime(), frame[1], frame[2]);
+	}
+}
+
+static void usartTx(uint8_t data)
+{
+	if(replay.usartCapture) {
+		fputc(data, replay.usartCapture);
+	}
+	if(replay.frameIdx == 0 && data != TELEMETRYSYNC) { // Hunting for the start of a frame
+		replay.nBadFrames++;
+		return;
+	}
+	replay.frame[replay.frameIdx++] = data;
+	if(replay.frameIdx > 3 && replay.frameIdx == 3 + replay.frame[2] + 1u) {
+		uint8_t sum = 0;
+
+		for(unsigned idx = 1; idx < replay.frameIdx; idx++) {
+			sum += replay.frame[idx];
+		}
+		if(sum == 0) {
+			replay.nFrames++;
+			if(replay.telemetry) {
+				printFrame(replay.frame);
+			}
+		} else {
+			replay.nBadFrames++;
+		}
+		replay.frameIdx = 0;
+	}
+}
+
+static int loadTrace(const char *fileName)
+{
+	FILE *f = fopen(fileName, "r");
+	char line[256];
+	size_t allocated = 0;
+
+	if(!f) {
+		perror(fileName);
+		return -1;
+	}
+	while(fgets(line, sizeof(line), f)) {
+		struct TraceRow r = {0};
+		int buttons = 0, overCurrent = 0, lowPower = 0;
+		int n = sscanf(line, " %lf , %lf , %lf , %d , %d , %d", &r.t, &r.current, &r.voltage, &buttons, &overCurrent, &lowPower);
+
+		if(n < 3) { // Comment, header or blank
+			continue;
+		}
+		if(replay.nRows && r.t <= replay.row[replay.nRows - 1].t) {
+			fprintf(stderr, "%s: time must increase (%f)\n", fileName, r.t);
+			fclose(f);
+			return -1;
+		}
+		r.buttons = buttons;
+		r.overCurrent = overCurrent != 0;
+		r.lowPower = lowPower != 0;
+		if(replay.nRows == allocated) {
+			allocated = allocated ? allocated * 2 : 1024;
+			replay.row = realloc(replay.row, allocated * sizeof(*replay.row));
+			if(!replay.row) {
+				fclose(f);
+				return -1;
+			}
+		}
+		replay.row[replay.nRows++] = r;
+	}
+	fclose(f);
+
+	if(replay.nRows == 0) {
+		fprintf(stderr, "%s: no samples\n", fileName);
+		return -1;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	const char *fileName = NULL;
+	const char *dumpName = NULL;
+	const char *eepromName = NULL;
+	struct FaultLogEntry entry;
+	struct HostClockStats clockStats;
+	struct HostLatencyStats latencyStats;
+	struct twi_counters twiCounters;
+	FILE *f;
+	uint64_t endCycle;
+	uint8_t resetSource = (1<<PORF);
+	clock_t wallStart;
+	double wallTime;
+	int argIdx;
+
+	replay.currentScale = replay.voltageScale = replay.lampScale = 1.0;
+	replay.slipAt = -1;
+	for(argIdx = 1; argIdx < argc; argIdx++) {
+		if(!strcmp(argv[argIdx], "-i")) {
+			replay.verbose = 1;
+		} else if(!strcmp(argv[argIdx], "-u")) {
+			replay.telemetry = 1;
+		} else if(!strcmp(argv[argIdx], "-a") && argIdx + 1 < argc) {
+			replay.currentScale = atof(argv[++argIdx]);
+		} else if(!strcmp(argv[argIdx], "-v") && argIdx + 1 < argc) {
+			replay.voltageScale = atof(argv[++argIdx]);
+		} else if(!strcmp(argv[argIdx], "-b") && argIdx + 1 < argc) {
+			replay.currentBias = atof(argv[++argIdx]);
+		} else if(!strcmp(argv[argIdx], "-t") && argIdx + 1 < argc) {
+			dumpName = argv[++argIdx];
+		} else if(!strcmp(argv[argIdx], "-e") && argIdx + 1 < argc) {
+			eepromName = argv[++argIdx];
+		} else if(!strcmp(argv[argIdx], "-g") && argIdx + 1 < argc) {
+			hostHangAt((uint64_t)(atof(argv[++argIdx]) * F_CPU));
+		} else if(!strcmp(argv[argIdx], "-l") && argIdx + 1 < argc) {
+			hostSetExpanders(atoi(argv[++argIdx]));
+		} else if(!strcmp(argv[argIdx], "-s") && argIdx + 1 < argc) {
+			hostStickBus((uint64_t)(atof(argv[++argIdx]) * F_CPU));
+		} else if(!strcmp(argv[argIdx], "-c")) {
+			replay.lampModel = 1;
+		} else if(!strcmp(argv[argIdx], "-d") && argIdx + 1 < argc) {
+			replay.dither = atof(argv[++argIdx]);
+		} else if(!strcmp(argv[argIdx], "-k") && argIdx + 1 < argc) {
+			replay.lampScale = atof(argv[++argIdx]);
+		} else if(!strcmp(argv[argIdx], "-w") && argIdx + 1 < argc) {
+			replay.slipAt = atof(argv[++argIdx]);
+		} else if(!strcmp(argv[argIdx], "-r") && argIdx + 1 < argc) {
+			if(!(replay.usartCapture = fopen(argv[++argIdx], "wb"))) {
+				perror(argv[argIdx]);
+				return 1;
+			}
+		} else if(argv[argIdx][0] != '-' && !fileName) {
+			fileName = argv[argIdx];
+		} else {
+			fileName = NULL;
+			break;
+		}
+	}
+	if(!fileName) {
+		fprintf(stderr, "Usage: %s [-i] [-u] [-a countsPerAmp] [-v countsPerVolt] [-b currentBiasCounts] [-t dump.bin] [-e eeprom.bin] [-g hangTime] [-l lamps] [-s stuckTime] [-c] [-k lampScale] [-w slipTime] [-r usart.bin] [-d ditherCounts] trace.csv\n", argv[0]);
+		return 2;
+	}
+	if(loadTrace(fileName)) {
+		return 1;
+	}
+
+	if(eepromName && (f = fopen(eepromName, "rb")) != NULL) { // Carry on from the last replay
+		if(fread(hostEeprom(), E2END + 1, 1, f) != 1) {
+			fprintf(stderr, "%s: short EEPROM image, starting from erased\n", eepromName);
+			memset(hostEeprom(), 0xFF, E2END + 1);
+		}
+		fclose(f);
+	}
+
+	hostHooks.adcInput = adcInput;
+	hostHooks.twiTransaction = twiTransaction;
+	hostHooks.rheostatStep = rheostatStep;
+	hostHooks.usartTx = usartTx;
+
+	endCycle = (uint64_t)(replay.row[replay.nRows - 1].t * F_CPU);
+	wallStart = clock();
+	printf("%12.6f power on, trace runs to %.3fs\n", 0.0, replay.row[replay.nRows - 1].t);
+
+	for(;;) {
+		int exitCode;
+
+		replay.fet = replay.lampReset = -1; // Report the state the firmware sets up
+		replay.olat = hostExpanderOLAT();
+		replay.duty = -1;
+
+		hostReset(resetSource);
+		hostStopAt(endCycle);
+		exitCode = hostRun(firmwareMain);
+		pollOutputs();
+
+		if(exitCode != HOSTEXIT_WATCHDOG) {
+			break;
+		}
+		replay.nTrips++;
+		if(supervisorRecord.cause == SUPERVISORCAUSE_HANG) {
+			printf("%12.6f hang caught by the watchdog interrupt, lamp level %u %s\n", (double)hostHaltCycle() / F_CPU,
+				supervisorRecord.lampLevel, supervisorRecord.lampOn ? "on" : "off");
+		} else if(hostHaltCycle()) {
+			struct TraceRow now;
+
+			sampleAt((double)hostHaltCycle() / F_CPU, &now);
+			printf("%12.6f trip: HALT() with the trace at current %.1f voltage %.1f, firmware readings at reset current %u voltage %u accumulated %lu\n",
+				(double)hostHaltCycle() / F_CPU, now.current, now.voltage, (unsigned)getADCCurrentReading(),
+				(unsigned)getADCVoltageReading(), (unsigned long)getAccumulatedCurrent());
+		}
+		printf("%12.6f watchdog reset\n", simTime());
+		resetSource = (1<<WDRF);
+	}
+	wallTime = (double)(clock() - wallStart) / CLOCKS_PER_SEC;
+
+	printf("%12.6f end of trace\n", simTime());
+	twi_getCounters(&twiCounters);
+	printf("# %lu I2C transactions (%lu failed, %u timed out and recovered), %lu rheostat steps, %lu trips\n", replay.nTwi,
+		replay.nTwiFailed, twiCounters.timeouts, replay.nRheostatSteps, replay.nTrips);
+	if(replay.nFrames || replay.nBadFrames) {
+		printf("# %lu telemetry frames received, %lu bad\n", replay.nFrames, replay.nBadFrames); // Drops are counted in the frames
+	}
+	hostClockStats(&clockStats);
+	printf("# clock: awake %.1f%% (%.1f%% reduced), asleep %.1f%% (%.1f%% reduced), %lu switches, %lu wakes, MCU supply around %.2fmA\n",
+		100.0 * (clockStats.awake[0] + clockStats.awake[1]) / hostCycles(), 100.0 * clockStats.awake[1] / hostCycles(),
+		100.0 * (clockStats.asleep[0] + clockStats.asleep[1]) / hostCycles(), 100.0 * clockStats.asleep[1] / hostCycles(),
+		(unsigned long)clockStats.switches, (unsigned long)clockStats.wakes, (clockStats.cpuClocks * MCUACTIVEMAPERMHZ +
+		(clockStats.ioClocks - clockStats.cpuClocks) * MCUIDLEMAPERMHZ) / 1e6 / simTime());
+#if ENERGY_ENABLE
+	printf("# energy monitor:");
+	for(uint8_t state = 0; state < ENERGY_NSTATES; state++) {
+		static const char *stateNames[ENERGY_NSTATES] = {"run", "idle", "ADC noise reduction", "ADC ISR", "TWI ISR",
+			"timer ISRs", "USART ISRs", "TWI waits", "EEPROM waits"};
+		uint64_t total = 0;
+
+		for(uint8_t idx = 0; idx < ENERGY_NSTATES; idx++) {
+			total += energyTicks(idx);
+		}
+		printf(" %s %.2f%%%s", stateNames[state], total ? 100.0 * energyTicks(state) / total : 0.0, state < ENERGY_NSTATES - 1 ? "," : "");
+	}
+	printf(", MCU around %uuWh an hour\n", (unsigned)energyMicroWattHours());
+#endif
+	hostLatencyStats(&latencyStats);
+	printf("# interrupts held off for up to %lu cycles (budget %u), over current taken %lu times within %lu (%u), low power %lu within %lu (%u)\n",
+		(unsigned long)latencyStats.maxMasked, ISRHOLD_MAX, (unsigned long)latencyStats.taken[HOSTSAFETY_OVERCURRENT],
+		(unsigned long)latencyStats.maxLatency[HOSTSAFETY_OVERCURRENT], ISRLATENCY_ANALOGCOMP,
+		(unsigned long)latencyStats.taken[HOSTSAFETY_LOWPOWER], (unsigned long)latencyStats.maxLatency[HOSTSAFETY_LOWPOWER], ISRLATENCY_INT0);
+	if(latencyStats.maxMasked > ISRHOLD_MAX || latencyStats.maxLatency[HOSTSAFETY_OVERCURRENT] > ISRLATENCY_ANALOGCOMP ||
+		latencyStats.maxLatency[HOSTSAFETY_LOWPOWER] > ISRLATENCY_INT0) {
+		printf("# interrupt latency over budget, see Hal.h\n");
+		replay.overBudget = 1;
+	}
+#if ADC_HIRES
+	printf("# last high resolution window: current %.3f voltage %.3f ADC counts\n",
+		getADCHiResCurrentReading() / (double)(1 << (ADC_HIRESBITS - 10)), getADCHiResVoltageReading() / (double)(1 << (ADC_HIRESBITS - 10)));
+#endif
+#if BENCHMARK_ENABLE
+	for(uint8_t id = 1; id < HOSTBENCHIDS; id++) {
+		struct HostBenchStats benchStats;
+
+		hostBenchStats(id, &benchStats);
+		if(benchStats.count) {
+			printf("# bench section %u: %lu times, mean %.3fms, max %.3fms of modelled time\n", id, (unsigned long)benchStats.count,
+				1e3 * benchStats.total / benchStats.count / F_CPU, 1e3 * benchStats.max / F_CPU);
+		}
+	}
+#endif
+	printf("# %.3fs simulated in %.3fs, %.0fx real time\n", simTime(), wallTime, wallTime > 0 ? simTime() / wallTime : 0.0);
+	for(uint8_t age = 0; faultLogRead(age, &entry); age++) { // As the last boot found it, plus any trip since
+		printf("# fault log -%u: seq %u reason %u at %.3fs current %u voltage %u charge %lu level %u\n", age, entry.seq,
+			entry.reason, entry.time / 1000.0, entry.current, entry.voltage, (unsigned long)entry.charge, entry.level);
+	}
+
+	if(eepromName) {
+		f = fopen(eepromName, "wb");
+		if(!f || fwrite(hostEeprom(), E2END + 1, 1, f) != 1) {
+			perror(eepromName);
+		}
+		if(f) {
+			fclose(f);
+		}
+	}
+
+	if(dumpName) {
+#if TRACE_ENABLE
+		f = fopen(dumpName, "wb");
+
+		if(!f || fwrite(&eventTrace, sizeof(eventTrace), 1, f) != 1) {
+			perror(dumpName);
+		}
+		if(f) {
+			fclose(f);
+		}
+#else
+		fprintf(stderr, "%s: the event trace is not enabled in this build\n", dumpName);
+#endif
+	}
+
+	if(replay.usartCapture) {
+		fclose(replay.usartCapture);
+	}
+	free(replay.row);
+
+	return replay.overBudget ? 3 : 0;
+}
\ No newline at end of file
@@ -0,0 +1,516 @@
+// Cycle counts for the Benchmark.h sections, from the firmware image run under simavr
+//
+// The image is the one built for the target with BENCHMARK_ENABLE=1, so every count is of the code as it ships. Each
+// write to GPIOR0 opens or closes a section and the cycles between the two are charged to its id, interrupts taken
+// inside it included (the main loop wake's ADC and TWI handlers, say). ISR(ADC_vect) and ISR(TWI_vect) are their bodies
+// between the markers, the prologue and epilogue aren't counted. Boot runs from main() to the main loop, the C startup
+// before it is given on its own line. getTicks() is set against getTime() on a line of its own too, best case (no
+// overflow taken under the read) and mean, for what the scaling to milliseconds costs. getTime() is only called to
+// stamp the event trace and fault log, so a build without either has nothing to set it against.
+//
+// The board is stubbed out around the MCU: one MCP23008 at 0x20 (its rheostat isn't modelled, the steps are only
+// writes), an 8.2V supply and no lamp current on the ADC, the comparator's AIN0 held above AIN1 so it doesn't trip and
+// PD2 held high. The up button is pressed at 5.0s and on/off at 5.5s, each for 0.1s, so the lamp level change and the
+// wakes with the lamp on are in the figures. simavr runs the core at F_CPU whatever CLKPR says, so the counts are right
+// but the clock's reduced speed stretches nothing in the run. -t runs for that many simulated seconds (10 unless
+// given). -b writes the counts to a baseline file, -c compares against one and exits with 1 if any section's mean has
+// grown by more than -p percent (2 unless given). A boot count over one means the watchdog reset it part way, exits
+// with 3 if simavr stopped the core before the end of the run.
+//
+// The interrupt flag is looked at after every instruction for the stretches it's off, the figures Hal.h's budgets
+// and so the safety handlers' latencies are meant to come from. A stretch that starts at a vector is that handler's
+// entry, the response as simavr counts it, the prologue and (for the nested ones) up to their sei(), and any other is a
+// main line cli() section or a nested handler's way out. Boot, up to the first sei(), isn't counted and neither are
+// the handlers that never return. Each longest stretch is listed against its budget, along with the ANALOG_COMP
+// latency worked out from them as Hal.h works out ISRLATENCY_ANALOGCOMP and the longest nested entry for the host
+// model's HOSTISRENTRYCYCLES, exits with 4 if any is over (ahead of 1, after 3).
+//
+// Build the image with the project's Release settings and BENCHMARK_ENABLE=1 added to its symbols, or from this
+// directory:
+//  avr-gcc -mmcu=atmega48 -std=gnu99 -Os -funsigned-char -funsigned-bitfields -fpack-struct -fshort-enums
+//   -DF_CPU=8000000UL -DBENCHMARK_ENABLE=1 -I../BikeLightController -o BikeLightController.elf
+//   ../BikeLightController/*.c -lm
+//
+// Build from this directory, against an installed simavr (add -I and -L for wherever it went):
+//  cc -std=gnu99 -O2 -DF_CPU=8000000UL -I../BikeLightController -I../BikeLightController/host
+//   -I/usr/local/include/simavr -o SimBench SimBench.c -lsimavr -lelf
+//
+// Usage: SimBench [-t seconds] [-b baseline.txt] [-c baseline.txt] [-p percent] BikeLightController.elf
+//
+// It's only been checked against stand-in simavr headers so far, not built against simavr or run, so there's no
+// baseline in the tree yet. The first run's -b output is the one to commit beside this file as SimBench.txt.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "avr_ioport.h"
+#include "avr_adc.h"
+#include "avr_twi.h"
+#if __has_include("avr_acomp.h")
+	#include "avr_acomp.h"
+#endif
+
+#include "Benchmark.h"
+#include "Hal.h"
+#include "LampWiper.h"
+
+#define NSECTIONS 16
+#define STR(_x) #_x
+#define XSTR(_x) STR(_x) // A macro's value as a string, for the section names
+#define GPIOR0ADDR 0x3E // ATmega48 data space
+#define ACSRADDR 0x50
+#define ACOBIT 0x20
+
+// ATmega48 vector numbers, as avr-libc's
+#define NVECTORS 26
+#define VECTTIMER2COMPA 7
+#define VECTTIMER1OVF 13
+#define VECTUSARTUDRE 19
+#define VECTUSARTTX 20
+#define VECTADC 21
+#define VECTTWI 24
+#define CLISECTION NVECTORS // A stretch that didn't start at a vector
+
+#define EXPANDERADDR 0x20
+#define SUPPLYMV 886 // 8.2V, 825 counts against the 1.1V reference
+#define AIN0MV 500 // Comparator reference, above AIN1
+#define AIN1MV 0
+
+#define BUTTONONOFF 0x02 // MCP23008 GP1..GP3, held low
+#define BUTTONUP 0x04
+
+#define IODIR 0x00
+#define IPOL 0x01
+#define GPINTEN 0x02
+#define DEFVAL 0x03
+#define INTCON 0x04
+#define IOCON 0x05
+#define INTF 0x07
+#define INTCAP 0x08
+#define GPIO 0x09
+#define OLAT 0x0A
+
+static const char *sectionNames[NSECTIONS] = {
+	[BENCH_ADCISR] = "ADC ISR",
+	[BENCH_TWIISR] = "TWI ISR",
+	[BENCH_MAINWAKE] = "main loop wake",
+	[BENCH_GETTIME] = "getTime()",
+	[BENCH_LAMPRESET] = "lampPowerDown(" XSTR(LAMPRESYNCSTEPS) ")",
+	[BENCH_BOOT] = "boot",
+	[BENCH_LAMPLEVEL] = "lamp level change",
+	[BENCH_GETTICKS] = "getTicks()",
+};
+
+struct Section {
+	avr_cycle_count_t start; // Zero when not open
+	unsigned long count;
+	avr_cycle_count_t min;
+	avr_cycle_count_t max;
+	avr_cycle_count_t total;
+};
+
+static const struct {
+	const char *name;
+	unsigned budget;
+} holds[NVECTORS + 1] = { // Only the handlers that return
+	[VECTTIMER2COMPA] = {"Timer-2 entry", ISRHOLD_NESTED},
+	[VECTTIMER1OVF] = {"Timer-1 overflow", ISRHOLD_BLOCKING},
+	[VECTUSARTUDRE] = {"USART UDRE", ISRHOLD_BLOCKING},
+	[VECTUSARTTX] = {"USART TX", ISRHOLD_BLOCKING},
+	[VECTADC] = {"ADC entry", ISRHOLD_NESTED},
+	[VECTTWI] = {"TWI entry", ISRHOLD_NESTED},
+	[CLISECTION] = {"cli() and exits", ISRHOLD_MAX},
+};
+
+static struct {
+	avr_t *avr;
+	struct Section section[NSECTIONS];
+	avr_cycle_count_t startup; // Reset to the first BENCH_BOOT
+	struct {
+		uint8_t armed; // Interrupts have been on, boot is over
+		avr_cycle_count_t start; // Cycle interrupts went off, zero while they're on
+		unsigned vector; // Where they went off, CLISECTION if not at a vector
+		avr_cycle_count_t max[NVECTORS + 1];
+		unsigned long count[NVECTORS + 1];
+	} hold;
+	struct {
+		avr_irq_t *irq;
+		uint8_t reg[OLAT + 1];
+		uint8_t pointer;
+		uint8_t selected; // SLA of the transaction addressing it, zero if none
+		uint8_t nWritten;
+		uint8_t buttons;
+		uint8_t lastGpio;
+		uint8_t intLatched;
+	} mcp;
+} bench;
+
+static void markerWrite(struct avr_t *avr, avr_io_addr_t addr, uint8_t v, void *param)
+{
+	struct Section *s = bench.section + ((v >> 1) % NSECTIONS);
+
+	avr->data[addr] = v;
+	if(!(v & 1)) {
+		s->start = avr->cycle;
+		if((v >> 1) == BENCH_BOOT && !bench.startup) {
+			bench.startup = avr->cycle;
+		}
+	} else if(s->start) {
+		avr_cycle_count_t cycles = avr->cycle - s->start;
+
+		s->start = 0;
+		s->min = s->count && s->min < cycles ? s->min : cycles;
+		s->max = s->max > cycles ? s->max : cycles;
+		s->total += cycles;
+		s->count++;
+	}
+}
+
+static void watchInterrupts(avr_t *avr) // After each instruction
+{
+	if(avr->sreg[S_I]) {
+		if(bench.hold.start) {
+			avr_cycle_count_t cycles = avr->cycle - bench.hold.start;
+
+			bench.hold.max[bench.hold.vector] = cycles > bench.hold.max[bench.hold.vector] ? cycles :
+				bench.hold.max[bench.hold.vector];
+			bench.hold.count[bench.hold.vector]++;
+			bench.hold.start = 0;
+		}
+		bench.hold.armed = 1;
+	} else if(bench.hold.armed && !bench.hold.start) {
+		bench.hold.start = avr->cycle;
+		bench.hold.vector = avr->pc < NVECTORS * avr->vector_size ? avr->pc / avr->vector_size : CLISECTION;
+	}
+}
+
+static int reportHolds(void) // Non-zero if anything's over its budget
+{
+	avr_cycle_count_t longest = 0, nested = 0, blocking = 0, latency;
+	int over = 0;
+
+	printf("%-20s %8s %10s %10s\n", "interrupts off", "count", "max", "budget");
+	for(unsigned vector = 0; vector <= NVECTORS; vector++) {
+		if(!holds[vector].name || !bench.hold.count[vector]) {
+			continue;
+		}
+		printf("%-20s %8lu %10llu %10u%s\n", holds[vector].name, bench.hold.count[vector],
+			(unsigned long long)bench.hold.max[vector], holds[vector].budget,
+			bench.hold.max[vector] > holds[vector].budget ? " over" : "");
+		over |= bench.hold.max[vector] > holds[vector].budget;
+		longest = bench.hold.max[vector] > longest ? bench.hold.max[vector] : longest;
+		if(holds[vector].budget == ISRHOLD_NESTED) {
+			nested = bench.hold.max[vector] > nested ? bench.hold.max[vector] : nested;
+		} else if(vector != CLISECTION) {
+			blocking = bench.hold.max[vector] > blocking ? bench.hold.max[vector] : blocking;
+		}
+	}
+
+	// As Hal.h: what's under way, then the nested entries and short handlers that can go ahead of ANALOG_COMP twice each
+	latency = longest + 2 * nested + 2 * blocking;
+	printf("# ANALOG_COMP latency up to %llu cycles from the stretches (ISRLATENCY_ANALOGCOMP %u), INT0 up to %llu (%u)\n",
+		(unsigned long long)latency, ISRLATENCY_ANALOGCOMP, (unsigned long long)longest, ISRLATENCY_INT0);
+	printf("# longest nested entry %llu cycles, the host model's HOSTISRENTRYCYCLES should be no less\n",
+		(unsigned long long)nested);
+
+	return over || latency > ISRLATENCY_ANALOGCOMP || longest > ISRLATENCY_INT0;
+}
+
+static uint8_t acsrRead(struct avr_t *avr, avr_io_addr_t addr, void *param) // Without a comparator model
+{
+	return avr->data[addr] | ACOBIT;
+}
+
+static uint8_t gpioLevels(void)
+{
+	uint8_t inputs = ~bench.mcp.buttons;
+
+	return ((bench.mcp.reg[OLAT] & ~bench.mcp.reg[IODIR]) | (inputs & bench.mcp.reg[IODIR])) ^
+		(bench.mcp.reg[IPOL] & bench.mcp.reg[IODIR]);
+}
+
+static void updateInterrupt(void)
+{
+	uint8_t gpio = gpioLevels();
+	uint8_t flags;
+
+	if(bench.mcp.intLatched) {
+		return;
+	}
+	flags = bench.mcp.reg[INTCON] & (gpio ^ bench.mcp.reg[DEFVAL]);
+	flags |= ~bench.mcp.reg[INTCON] & (gpio ^ bench.mcp.lastGpio);
+	flags &= bench.mcp.reg[GPINTEN] & bench.mcp.reg[IODIR];
+	if(flags) {
+		bench.mcp.intLatched = 1;
+		bench.mcp.reg[INTF] = flags;
+		bench.mcp.reg[INTCAP] = gpio;
+	}
+}
+
+static uint8_t readExpander(void)
+{
+	uint8_t regAddr = bench.mcp.pointer;
+	uint8_t data = regAddr == GPIO ? gpioLevels() : bench.mcp.reg[regAddr];
+
+	if(regAddr == GPIO || regAddr == INTCAP) { // Either read clears the interrupt
+		bench.mcp.intLatched = 0;
+		bench.mcp.reg[INTF] = 0;
+		bench.mcp.lastGpio = gpioLevels();
+	}
+	if(!(bench.mcp.reg[IOCON] & 0x20)) { // Sequential operation unless SEQOP is set
+		bench.mcp.pointer = bench.mcp.pointer < OLAT ? bench.mcp.pointer + 1 : 0;
+	}
+
+	return data;
+}
+
+static void writeExpander(uint8_t data)
+{
+	if(bench.mcp.nWritten++ == 0) {
+		bench.mcp.pointer = data <= OLAT ? data : 0;
+		return;
+	}
+	if(bench.mcp.pointer != INTF && bench.mcp.pointer != INTCAP) { // Read only
+		bench.mcp.reg[bench.mcp.pointer == GPIO ? OLAT : bench.mcp.pointer] = data;
+	}
+	if(!(bench.mcp.reg[IOCON] & 0x20)) {
+		bench.mcp.pointer = bench.mcp.pointer < OLAT ? bench.mcp.pointer + 1 : 0;
+	}
+}
+
+static void twiHook(struct avr_irq_t *irq, uint32_t value, void *param) // simavr's TWI master to the expander
+{
+	avr_twi_msg_irq_t msg;
+
+	msg.u.v = value;
+	if(msg.u.twi.msg & TWI_COND_STOP) {
+		bench.mcp.selected = 0;
+	}
+	if(msg.u.twi.msg & TWI_COND_START) {
+		bench.mcp.selected = 0;
+		bench.mcp.nWritten = 0;
+		if((msg.u.twi.addr >> 1) == EXPANDERADDR) {
+			bench.mcp.selected = msg.u.twi.addr;
+			avr_raise_irq(bench.mcp.irq + TWI_IRQ_INPUT, avr_twi_irq_msg(TWI_COND_ACK, bench.mcp.selected, 1));
+		}
+	}
+	if(!bench.mcp.selected) {
+		return;
+	}
+	if(msg.u.twi.msg & TWI_COND_WRITE) {
+		writeExpander(msg.u.twi.data);
+		avr_raise_irq(bench.mcp.irq + TWI_IRQ_INPUT, avr_twi_irq_msg(TWI_COND_ACK, bench.mcp.selected, 1));
+	}
+	if(msg.u.twi.msg & TWI_COND_READ) {
+		avr_raise_irq(bench.mcp.irq + TWI_IRQ_INPUT, avr_twi_irq_msg(TWI_COND_READ, bench.mcp.selected, readExpander()));
+	}
+}
+
+static void attachBoard(avr_t *avr)
+{
+	static const char *twiNames[2] = {[TWI_IRQ_INPUT] = "8>mcp23008.out", [TWI_IRQ_OUTPUT] = "32<mcp23008.in"};
+	avr_irq_t *irq;
+
+	avr_register_io_write(avr, GPIOR0ADDR, markerWrite, NULL);
+
+	bench.mcp.reg[IODIR] = 0xFF; // Power on
+	bench.mcp.lastGpio = gpioLevels();
+	bench.mcp.irq = avr_alloc_irq(&avr->irq_pool, 0, 2, twiNames);
+	avr_irq_register_notify(bench.mcp.irq + TWI_IRQ_OUTPUT, twiHook, NULL);
+	avr_connect_irq(bench.mcp.irq + TWI_IRQ_INPUT, avr_io_getirq(avr, AVR_IOCTL_TWI_GETIRQ(0), TWI_IRQ_INPUT));
+	avr_connect_irq(avr_io_getirq(avr, AVR_IOCTL_TWI_GETIRQ(0), TWI_IRQ_OUTPUT), bench.mcp.irq + TWI_IRQ_OUTPUT);
+
+	avr->avcc = avr->aref = 5000;
+	avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_ADC_GETIRQ, ADC_IRQ_ADC3), SUPPLYMV);
+	avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_ADC_GETIRQ, ADC_IRQ_ADC7), 0);
+
+	irq = NULL;
+#ifdef AVR_IOCTL_ACOMP_GETIRQ
+	if((irq = avr_io_getirq(avr, AVR_IOCTL_ACOMP_GETIRQ, ACOMP_IRQ_AIN0))) {
+		avr_raise_irq(irq, AIN0MV);
+		avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_ACOMP_GETIRQ, ACOMP_IRQ_AIN1), AIN1MV);
+	}
+#endif
+	if(!irq) {
+		avr_register_io_read(avr, ACSRADDR, acsrRead, NULL);
+	}
+
+	avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('D'), 2), 1);
+}
+
+static void pressButtons(double t)
+{
+	uint8_t buttons = 0;
+
+	if(t >= 5.0 && t < 5.1) {
+		buttons = BUTTONUP;
+	} else if(t >= 5.5 && t < 5.6) {
+		buttons = BUTTONONOFF;
+	}
+	if(buttons != bench.mcp.buttons) {
+		bench.mcp.buttons = buttons;
+		updateInterrupt();
+	}
+}
+
+static int writeBaseline(const char *fileName)
+{
+	FILE *f;
+
+	if(!(f = fopen(fileName, "w"))) {
+		perror(fileName);
+		return -1;
+	}
+	fprintf(f, "# id count min max mean\n");
+	for(int id = 0; id < NSECTIONS; id++) {
+		struct Section *s = bench.section + id;
+
+		if(s->count) {
+			fprintf(f, "%d %lu %llu %llu %.1f\n", id, s->count, (unsigned long long)s->min, (unsigned long long)s->max,
+				(double)s->total / s->count);
+		}
+	}
+
+	if(fclose(f)) {
+		perror(fileName);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int compareBaseline(const char *fileName, double percent)
+{
+	double baseline[NSECTIONS] = {0};
+	char line[128];
+	int worse = 0;
+	FILE *f;
+
+	if(!(f = fopen(fileName, "r"))) {
+		perror(fileName);
+		return -1;
+	}
+	while(fgets(line, sizeof(line), f)) {
+		unsigned long count;
+		unsigned long long min, max;
+		double mean;
+		int id;
+
+		if(line[0] != '#' && sscanf(line, "%d %lu %llu %llu %lf", &id, &count, &min, &max, &mean) == 5 &&
+			id >= 0 && id < NSECTIONS) {
+			baseline[id] = mean;
+		}
+	}
+	fclose(f);
+
+	printf("%-20s %10s %10s %8s\n", "section", "mean", "baseline", "change");
+	for(int id = 0; id < NSECTIONS; id++) {
+		struct Section *s = bench.section + id;
+		double mean;
+
+		if(!s->count || !baseline[id]) {
+			continue;
+		}
+		mean = (double)s->total / s->count;
+		printf("%-20s %10.1f %10.1f %+7.1f%%%s\n", sectionNames[id] ? sectionNames[id] : "?", mean, baseline[id],
+			(mean - baseline[id]) * 100.0 / baseline[id], mean > baseline[id] * (1.0 + percent / 100.0) ? " worse" : "");
+		worse |= mean > baseline[id] * (1.0 + percent / 100.0);
+	}
+
+	return worse;
+}
+
+int main(int argc, char **argv)
+{
+	const char *fileName = NULL, *writeName = NULL, *compareName = NULL;
+	double runTime = 10.0, percent = 2.0;
+	elf_firmware_t firmware;
+	avr_cycle_count_t end;
+	int state, worse = 0, over;
+
+	for(int argIdx = 1; argIdx < argc; argIdx++) {
+		if(!strcmp(argv[argIdx], "-t") && argIdx + 1 < argc) {
+			runTime = atof(argv[++argIdx]);
+		} else if(!strcmp(argv[argIdx], "-b") && argIdx + 1 < argc) {
+			writeName = argv[++argIdx];
+		} else if(!strcmp(argv[argIdx], "-c") && argIdx + 1 < argc) {
+			compareName = argv[++argIdx];
+		} else if(!strcmp(argv[argIdx], "-p") && argIdx + 1 < argc) {
+			percent = atof(argv[++argIdx]);
+		} else if(argv[argIdx][0] != '-' && !fileName) {
+			fileName = argv[argIdx];
+		} else {
+			fileName = NULL;
+			break;
+		}
+	}
+	if(!fileName) {
+		fprintf(stderr, "Usage: %s [-t seconds] [-b baseline.txt] [-c baseline.txt] [-p percent] BikeLightController.elf\n",
+			argv[0]);
+		return 2;
+	}
+
+	memset(&firmware, 0, sizeof(firmware));
+	if(elf_read_firmware(fileName, &firmware)) {
+		fprintf(stderr, "%s: not an AVR ELF image\n", fileName);
+		return 2;
+	}
+	if(!(bench.avr = avr_make_mcu_by_name("atmega48"))) {
+		fprintf(stderr, "simavr has no ATmega48 core\n");
+		return 2;
+	}
+	avr_init(bench.avr);
+	firmware.frequency = F_CPU;
+	avr_load_firmware(bench.avr, &firmware);
+	attachBoard(bench.avr);
+
+	end = (avr_cycle_count_t)(runTime * F_CPU);
+	do {
+		pressButtons((double)bench.avr->cycle / F_CPU);
+		state = avr_run(bench.avr);
+		watchInterrupts(bench.avr);
+	} while(state != cpu_Done && state != cpu_Crashed && bench.avr->cycle < end);
+
+	printf("%-20s %8s %10s %10s %10s\n", "section", "count", "min", "max", "mean");
+	for(int id = 0; id < NSECTIONS; id++) {
+		struct Section *s = bench.section + id;
+
+		if(s->count) {
+			printf("%-20s %8lu %10llu %10llu %10.1f\n", sectionNames[id] ? sectionNames[id] : "?", s->count,
+				(unsigned long long)s->min, (unsigned long long)s->max, (double)s->total / s->count);
+		}
+	}
+	if(bench.section[BENCH_GETTICKS].count && bench.section[BENCH_GETTIME].count) {
+		struct Section *ticks = bench.section + BENCH_GETTICKS, *time = bench.section + BENCH_GETTIME;
+
+		printf("# getTicks() against getTime(): %llu to %llu cycles at best, %.1f to %.1f on average, %.0f%% of it\n",
+			(unsigned long long)ticks->min, (unsigned long long)time->min, (double)ticks->total / ticks->count,
+			(double)time->total / time->count, (double)ticks->total * time->count * 100.0 / time->total / ticks->count);
+	}
+	printf("# C startup to main() %llu cycles\n", (unsigned long long)bench.startup);
+	printf("# %.3fs simulated, %llu cycles\n", (double)bench.avr->cycle / F_CPU, (unsigned long long)bench.avr->cycle);
+
+	over = reportHolds();
+
+	if(bench.section[BENCH_BOOT].count > 1) {
+		printf("# booted %lu times, a trip's HALT() or a hang was reset by the watchdog\n", bench.section[BENCH_BOOT].count);
+	}
+
+	if(writeName && writeBaseline(writeName)) {
+		return 2;
+	}
+	if(compareName && (worse = compareBaseline(compareName, percent)) < 0) {
+		return 2;
+	}
+	if(bench.avr->cycle < end) {
+		printf("# the firmware stopped at %.3fs (%s)\n", (double)bench.avr->cycle / F_CPU,
+			state == cpu_Crashed ? "crashed" : "asleep with interrupts off");
+		return 3;
+	}
+
+	return over ? 4 : worse ? 1 : 0;
+}
\ No newline at end of file
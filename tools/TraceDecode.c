@@ -0,0 +1,137 @@
+// Turns a dump of the firmware's eventTrace ring (see BikeLightController/EventTrace.h) into a timeline
+//
+// The dump is the raw bytes of the eventTrace structure, as read out over debugWIRE, from the simulator, or written by
+// RideReplay -t. Times are in seconds since the boot record that precedes them, records older than the first boot
+// still in the ring are timed from the oldest record.
+//
+// Build from this directory:
+//  cc -std=gnu99 -O2 -I../BikeLightController -o TraceDecode TraceDecode.c
+//
+// Usage: TraceDecode dump.bin
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "EventTrace.h"
+
+#define MAXLENGTH 128
+
+static const char *tripName(uint8_t reason)
+{
+	switch(reason) {
+		case TRACETRIP_OVERCURRENT:
+			return "over current comparator";
+		case TRACETRIP_LOWPOWER:
+			return "low power signal";
+		case TRACETRIP_CAPACITY:
+			return "accumulated current limit";
+		case TRACETRIP_CURRENT:
+			return "current limit";
+		case TRACETRIP_VOLTAGE:
+			return "voltage limit";
+		case TRACETRIP_HANG:
+			return "watchdog (hang)";
+		default:
+			return "unknown reason";
+	}
+}
+
+static const char *lampName(uint8_t payload)
+{
+	static char name[8];
+
+	if((payload >> 5) == 0) { // The first lamp, or a build with only the one
+		return "";
+	}
+	snprintf(name, sizeof(name), " %u", payload >> 5);
+	return name;
+}
+
+static void printRecord(double t, uint16_t dt, uint8_t id, uint8_t payload)
+{
+	printf("%10.3f%s ", t, dt == 0xFFFF ? "+" : " "); // A saturated delta means at least this late
+
+	switch(id) {
+		case TRACE_BOOT:
+			printf("boot, reset source%s%s%s%s\n", payload & 0x01 ? " power-on" : "", payload & 0x02 ? " external" : "",
+				payload & 0x04 ? " brown-out" : "", payload & 0x08 ? " watchdog" : "");
+			break;
+		case TRACE_FETON:
+			printf("fet on\n");
+			break;
+		case TRACE_FETOFF:
+			printf("fet off\n");
+			break;
+		case TRACE_TRIP:
+			printf("TRIP: %s\n", tripName(payload));
+			break;
+		case TRACE_RHEOSTAT:
+			printf("lamp%s level %u\n", lampName(payload), payload & 0x1F);
+			break;
+		case TRACE_BUTTONS:
+			printf("buttons%s%s%s%s%s\n", lampName(payload), (payload & 0x0E) == 0x0E ? " released" : "", payload & 0x02 ? "" : " on/off", payload & 0x04 ? "" : " up", payload & 0x08 ? "" : " down");
+			break;
+		case TRACE_LAMP:
+			printf("lamp%s %s\n", lampName(payload), payload & 0x01 ? "on" : "off");
+			break;
+		case TRACE_I2CERR:
+			printf("i2c error %u\n", payload);
+			break;
+		case TRACE_ADCWARN:
+			printf("adc warnings:%s%s%s%s\n", payload == 0 ? " clear" : "", payload & TRACEWARN_CURRENT ? " current" : "",
+				payload & TRACEWARN_VOLTAGE ? " voltage" : "", payload & TRACEWARN_CAPACITY ? " capacity" : "");
+			break;
+		default:
+			printf("unknown event %u, payload 0x%02x\n", id, payload);
+			break;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	uint8_t dump[8 + 4 * MAXLENGTH];
+	size_t nBytes;
+	uint8_t length, head, count;
+	double t = 0;
+	FILE *f;
+
+	if(argc != 2) {
+		fprintf(stderr, "Usage: %s dump.bin\n", argv[0]);
+		return 2;
+	}
+	f = fopen(argv[1], "rb");
+	if(!f) {
+		perror(argv[1]);
+		return 1;
+	}
+	nBytes = fread(dump, 1, sizeof(dump), f);
+	fclose(f);
+
+	// Byte offsets as laid out by struct EventTrace, there's no padding as every field is a byte
+	if(nBytes < 8 || dump[0] != TRACEMAGIC0 || dump[1] != TRACEMAGIC1) {
+		fprintf(stderr, "%s: not an event trace dump\n", argv[1]);
+		return 1;
+	}
+	length = dump[2];
+	head = dump[3];
+	count = dump[4];
+	if(length == 0 || length > MAXLENGTH || head >= length || count > length || nBytes < 8 + 4 * (size_t)length) {
+		fprintf(stderr, "%s: corrupt header (length %u head %u count %u, %zu bytes)\n", argv[1], length, head, count, nBytes);
+		return 1;
+	}
+
+	printf("# %u of %u records\n", count, length);
+	for(unsigned idx = 0; idx < count; idx++) {
+		const uint8_t *rec = dump + 8 + 4 * ((head + length - count + idx) % length);
+		uint16_t dt = rec[2] | (rec[3] << 8);
+
+		if(rec[0] == TRACE_BOOT) {
+			t = 0;
+		} else if(idx != 0) {
+			t += dt / 1000.0;
+		}
+		printRecord(t, dt, rec[0], rec[1]);
+	}
+
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,66 @@
+// Checks BikeLightController/Units.h on the host: each fixed point scale and limit conversion against the exact floating
+// point figure, and the raw safety limits in BikeLightController.c against the round figures Units.h gives for them
+//
+// Scales must be within half a unit of their last place, conversions within half a count. Any -D board or clock flags the
+// firmware is built with should be given here too, though the raw limits are only expected to come to their round
+// figures on the nominal board. Exits with 1 if anything is out, listing each check either way.
+//
+// Build from this directory:
+//  cc -std=gnu99 -O2 -Wall -pedantic -I../BikeLightController -o UnitsTest UnitsTest.c
+//
+// Usage: UnitsTest
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "Units.h"
+
+// The raw counts the limits in BikeLightController.c are pinned to and what they're documented as
+#define TRIPCAPACITY 1574074
+#define TRIPCURRENT 20
+#define TRIPVOLTAGE 600
+#define TRIPCAPACITYMAH 9.77
+#define TRIPCURRENTMA 2150.0
+#define TRIPVOLTAGEMV 5990.0
+
+#define EXACTMAPERCOUNT ((double)BOARD_VREF_MV * 1000.0 / UNITS_ADCCOUNTS / BOARD_SHUNT_MILLIOHM / BOARD_SENSEGAIN)
+#define EXACTMVPERCOUNT ((double)BOARD_VREF_MV / UNITS_ADCCOUNTS * (BOARD_DIVIDER_HIGH + BOARD_DIVIDER_LOW) / BOARD_DIVIDER_LOW)
+#define EXACTACCPERMAH (3600.0 / EXACTMAPERCOUNT * UNITS_ACCPERCOUNT * (F_CPU / 2.0) / UNITS_ADCCONVCYCLES)
+
+static int failures;
+
+static void check(const char *what, double fixed, double exact, double tol)
+{
+	int bad = fixed - exact > tol || exact - fixed > tol;
+
+	printf("%-32s %14.4f %14.4f %s\n", what, fixed, exact, bad ? "FAIL" : "ok");
+	failures += bad;
+}
+
+int main(void)
+{
+	printf("%-32s %14s %14s\n", "check", "fixed", "exact");
+
+	check("mA per count scale", UNITS_MAPERCOUNT_Q8, EXACTMAPERCOUNT * 256.0, 0.5);
+	check("mV per count scale", UNITS_MVPERCOUNT_Q8, EXACTMVPERCOUNT * 256.0, 0.5);
+	check("mS per Timer-1 count scale", UNITS_MSPERTIMER1_Q16, 1024000.0 / F_CPU * 65536.0, 0.5);
+	check("current conversion", UNITS_CURRENT(1000), 1000.0 / EXACTMAPERCOUNT, 0.5);
+	check("voltage conversion", UNITS_VOLTAGE(1000), 1000.0 / EXACTMVPERCOUNT, 0.5);
+	check("charge conversion", UNITS_CHARGE(1), EXACTACCPERMAH, 0.5);
+	if(!UNITS_CHARGE(1) || !UNITS_CURRENT(100)) {
+		printf("# the sense resistor is too small to resolve the limits\n");
+		failures++;
+	}
+
+	// The figures are rounded, so a count's worth (a hundredth of a mAh for the capacity) either way
+	check("current limit (mA)", TRIPCURRENT * EXACTMAPERCOUNT, TRIPCURRENTMA, EXACTMAPERCOUNT);
+	check("voltage limit (mV)", TRIPVOLTAGE * EXACTMVPERCOUNT, TRIPVOLTAGEMV, EXACTMVPERCOUNT);
+	check("capacity limit (mAh)", TRIPCAPACITY / EXACTACCPERMAH, TRIPCAPACITYMAH, 0.01);
+	check("current limit from its figure", UNITS_CURRENT(2150), TRIPCURRENT, 0.0);
+	check("voltage limit from its figure", UNITS_VOLTAGE(5990), TRIPVOLTAGE, 0.0);
+	check("capacity limit from its figure", UNITS_CHARGE(977) / 100, TRIPCAPACITY, UNITS_CHARGE(1) / 200);
+
+	printf("# %d failed\n", failures);
+
+	return failures ? 1 : 0;
+}
\ No newline at end of file